@@ -1,5 +1,19 @@
 @REM to lazy to write a makefile or use vs
-g++ .\src\main.cpp .\src\Dissasembler.cpp ^
--std=c++17 -Wall -Wextra -Werror ^
--DDEBUG -DNOP_ON_UNSUPPORTED_OPCODE ^
--o dissasembler.exe
\ No newline at end of file
+g++ .\src\main.cpp .\src\Dissasembler.cpp .\src\ThreadPool.cpp .\src\ControlFlow.cpp .\src\RomSet.cpp ^
+-std=c++17 -O2 -Wall -Wextra -Werror -pthread ^
+-o dissasembler.exe
+
+g++ .\src\emulator.cpp .\src\InvadersMachine.cpp .\src\InvadersIO.cpp ^
+.\src\8080.cpp .\src\Bus.cpp .\src\Ports.cpp .\src\Scheduler.cpp .\src\RomSet.cpp ^
+.\src\Batch.cpp .\src\ThreadPool.cpp .\src\CowMemory.cpp .\src\Snapshot.cpp .\src\Rewind.cpp ^
+.\src\Jit.cpp .\src\DecodeCache.cpp .\src\InvadersRenderer.cpp .\src\FrameCapture.cpp ^
+.\src\Profiler.cpp .\src\Dissasembler.cpp ^
+-std=c++17 -O2 -Wall -Wextra -Werror -pthread ^
+-o emulator.exe
+
+g++ .\src\bench.cpp .\src\InvadersMachine.cpp .\src\InvadersIO.cpp ^
+.\src\8080.cpp .\src\Bus.cpp .\src\Ports.cpp .\src\Scheduler.cpp .\src\RomSet.cpp ^
+.\src\CowMemory.cpp .\src\Snapshot.cpp .\src\Jit.cpp .\src\DecodeCache.cpp .\src\Dissasembler.cpp ^
+.\src\Profiler.cpp .\src\ThreadPool.cpp ^
+-std=c++17 -O2 -Wall -Wextra -Werror -pthread ^
+-o bench.exe
@@ -1,13 +1,279 @@
 #include "8080.h"
-#include <iostream>
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
+#include "DecodeCache.h"
+#include "Jit.h"
+#include "Profiler.h"
+
+// dispatch engine, pick one at build time with
+// -DP8080_DISPATCH_SWITCH, -DP8080_DISPATCH_TABLE or -DP8080_DISPATCH_THREADED
+#if !defined P8080_DISPATCH_SWITCH && !defined P8080_DISPATCH_TABLE && !defined P8080_DISPATCH_THREADED
+	#if defined __GNUC__
+		// computed goto, gcc and clang only
+		#define P8080_DISPATCH_THREADED
+	#else
+		#define P8080_DISPATCH_TABLE
+	#endif
+#endif
+
 namespace p8080 {
 
-void State8080::unimplementedInstruction() {
-	pc--;
-	std::cerr << "ERROR: Unimplemented instruction" << std::endl;
-	throw std::runtime_error("Unimplemented instruction");
+namespace {
+	// longest loop idle() looks at, jump included
+	constexpr unsigned IDLE_LOOP_BYTES = 16;
+
+	// pairs a loop reads memory through, for State8080::idleReads
+	constexpr uint8_t READS_BC = 1;
+	constexpr uint8_t READS_DE = 2;
+	constexpr uint8_t READS_HL = 4;
+}
+
+// a loop that polls memory for something an interrupt sets, like
+//
+//	0ADA  LDA  $20C0
+//	0ADD  ANA  A
+//	0ADE  JNZ  $0ADA
+//
+// goes through the same states forever once it's gone round once, until an
+// event changes memory. so when an iteration ends in exactly the state it
+// started in, with nothing in it that writes or talks to a device, every
+// whole iteration that finishes before the deadline gets skipped. the
+// interpreter runs the last one, so where it stops is exactly where it
+// would have stopped anyway
+void State8080::idle(uint16_t head, uint16_t end)
+{
+	if (head != idleHead || end != idleEnd) {
+		idleHead = head;
+		idleEnd = end;
+		idleCandidate = idleBody(head, end, idleIteration, idleReads);
+	} else if (idleCandidate && cycles - idleStart == idleIteration && deadline > cycles
+		&& sp == idleSp && flags() == idleFlags && std::memcmp(&r, &idleRegs, sizeof(r)) == 0) {
+		// mapping may have changed since the first look
+		bool plain = idleBody(head, end, idleIteration, idleReads);
+		if ((idleReads & READS_BC) && !bus.readPage(r.b)) plain = false;
+		if ((idleReads & READS_DE) && !bus.readPage(r.d)) plain = false;
+		if ((idleReads & READS_HL) && !bus.readPage(r.h)) plain = false;
+		if (plain) {
+			uint64_t skipped = (deadline - cycles - 1) / idleIteration * idleIteration;
+			cycles += skipped;
+			idleCycles += skipped;
+#ifdef P8080_PROFILE
+			profiler->repeat(bus, head, end, skipped / idleIteration);
+#endif
+		}
+	}
+	if (idleCandidate) {
+		idleStart = cycles;
+		idleRegs = r;
+		idleSp = sp;
+		idleFlags = flags();
+	}
+}
+
+// true if the code from head up to the jump back at end can only ever land
+// in the same state when it runs from the same state. that's reads of plain
+// memory and registers set from them or from constants, anything that
+// works a register off its own old value (INR, ADD, XCHG) would never
+// settle so it's out as well
+bool State8080::idleBody(uint16_t head, uint16_t end, uint32_t& iteration, uint8_t& reads) const
+{
+	uint8_t writes = 0;
+	reads = 0;
+	iteration = 0;
+	uint16_t at = head;
+	while (at != end) {
+		const uint8_t* page = bus.readPage(static_cast<uint8_t>(at >> 8));
+		if (!page) {
+			return false;
+		}
+		uint8_t op = page[at & 0xff];
+		uint16_t next = static_cast<uint16_t>(at + LENGTH[op]);
+		if (next > end || next < at) {
+			return false;
+		}
+		// operands, without going near a handler
+		uint16_t address = 0;
+		for (unsigned i = LENGTH[op] - 1; i > 0; i--) {
+			uint16_t operand = static_cast<uint16_t>(at + i);
+			const uint8_t* operandPage = bus.readPage(static_cast<uint8_t>(operand >> 8));
+			if (!operandPage) {
+				return false;
+			}
+			address = static_cast<uint16_t>((address << 8) | operandPage[operand & 0xff]);
+		}
+		iteration += CYCLES[op];
+
+		if (next == end) {
+			// has to be the jump that got here
+			return (op == 0xC3 || (op & 0xC7) == 0xC2) && address == head
+				&& !((reads & READS_BC) && (writes & READS_BC))
+				&& !((reads & READS_DE) && (writes & READS_DE))
+				&& !((reads & READS_HL) && (writes & READS_HL));
+		}
+
+		unsigned dst = (op >> 3) & 7;
+		unsigned src = op & 7;
+		// pair a register number belongs to, A and M belong to none
+		auto pairOf = [](unsigned reg) -> uint8_t {
+			return reg < 2 ? READS_BC : reg < 4 ? READS_DE : reg < 6 ? READS_HL : 0;
+		};
+		if (op >= 0x40 && op < 0x80) { // MOV
+			if (dst == 6) {
+				return false;
+			}
+			writes |= pairOf(dst);
+			if (src == 6) {
+				reads |= READS_HL;
+			}
+		} else if ((op >= 0xA0 && op < 0xA8) || (op >= 0xB0 && op < 0xC0) || op == 0xAF) { // ANA ORA CMP, XRA A
+			if (src == 6) {
+				reads |= READS_HL;
+			}
+		} else if ((op & 0xC7) == 0x06) { // MVI
+			if (dst == 6) {
+				return false;
+			}
+			writes |= pairOf(dst);
+		} else {
+			switch (op) {
+				case 0x00: case 0x08: case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+				case 0xCB: case 0xD9: case 0xDD: case 0xED: case 0xFD: // NOP
+				case 0xE6: case 0xF6: case 0xFE: // ANI ORI CPI
+				case 0x37: case 0x31: case 0xF9: // STC, LXI SP, SPHL
+					break;
+				case 0x01: writes |= READS_BC; break; // LXI
+				case 0x11: writes |= READS_DE; break;
+				case 0x21: writes |= READS_HL; break;
+				case 0x0A: reads |= READS_BC; break; // LDAX
+				case 0x1A: reads |= READS_DE; break;
+				case 0x3A: // LDA
+				case 0x2A: // LHLD
+					if (!bus.readPage(static_cast<uint8_t>(address >> 8))
+						|| !bus.readPage(static_cast<uint8_t>((address + 1) >> 8))) {
+						return false;
+					}
+					if (op == 0x2A) {
+						writes |= READS_HL;
+					}
+					break;
+				default:
+					return false;
+			}
+		}
+		at = next;
+	}
+	return false;
+}
+
+void State8080::halt()
+{
+	status = Status::Halted;
+	deadline = 0;
+}
+
+
+uint8_t State8080::flags()
+{
+#ifdef P8080_LAZY_FLAGS
+	if (lazyOp != FLAGOP_NONE) {
+		cc = computeFlags(lazyOp, lazyA, lazyB, lazyRes, cc & FLAG_CY);
+		lazyOp = FLAGOP_NONE;
+	}
+#endif
+#ifdef P8080_LAZY_FLAGS_CHECK
+	if (cc != eagerCC) {
+		throw std::runtime_error("lazy flags differ from eager flags");
+	}
+#endif
+	return cc;
+}
+
+void State8080::setFlags(uint8_t psw)
+{
+	writeFlags(psw & FLAG_ALL);
+}
+
+CpuState State8080::save()
+{
+	CpuState state;
+	state.r = r;
+	state.sp = sp;
+	state.pc = pc;
+	state.psw = flags();
+	state.int_enable = int_enable;
+	state.status = status;
+	state.cycles = cycles;
+	return state;
+}
+
+void State8080::load(const CpuState& state)
+{
+	r = state.r;
+	sp = state.sp;
+	pc = state.pc;
+	setFlags(state.psw);
+	int_enable = state.int_enable;
+	status = state.status;
+	error = status == Status::Error ? "restored in error state" : nullptr;
+	cycles = state.cycles;
+	// RAM was most likely written behind the bus's back
+#ifdef P8080_JIT
+	if (jit) {
+		jit->invalidateRam(bus);
+	}
+#endif
+#ifdef P8080_DECODE_CACHE
+	decoded->invalidateRam(bus);
+#endif
+}
+
+void State8080::writeFlags(uint8_t f)
+{
+#ifdef P8080_LAZY_FLAGS
+	lazyOp = FLAGOP_NONE;
+#endif
+#ifdef P8080_LAZY_FLAGS_CHECK
+	eagerCC = f;
+#endif
+	cc = f;
+}
+
+void State8080::aluFlags(uint8_t op, uint8_t a, uint8_t b, uint16_t res)
+{
+#ifdef P8080_LAZY_FLAGS_CHECK
+	// eager flags next to the lazy ones, flags() compares them
+	eagerCC = computeFlags(op, a, b, res, eagerCC & FLAG_CY);
+#endif
+#ifdef P8080_LAZY_FLAGS
+	if (op == FLAGOP_INR || op == FLAGOP_DCR) {
+		// these keep CY, so resolve it now and park it in cc
+		cc = carry();
+	}
+	lazyOp = op;
+	lazyA = a;
+	lazyB = b;
+	lazyRes = res;
+#else
+	cc = computeFlags(op, a, b, res, cc & FLAG_CY);
+#endif
+}
+
+uint8_t State8080::carry()
+{
+#ifdef P8080_LAZY_FLAGS
+	// CY can be had without working out the rest
+	switch (lazyOp) {
+		case FLAGOP_ADD:
+		case FLAGOP_SUB:   return (lazyRes >> 8) & FLAG_CY;
+		case FLAGOP_ANA:
+		case FLAGOP_LOGIC: return 0;
+		default:           return cc & FLAG_CY;
+	}
+#else
+	return cc & FLAG_CY;
+#endif
 }
 
 
@@ -19,62 +285,46 @@ void State8080::lxi(uint8_t& r1, uint8_t& r2)
 
 void State8080::stax(uint8_t r1, uint8_t r2)
 {
-	memory[(r1 << 8) | r2] = r.a;
+	store((r1 << 8) | r2, r.a);
 }
 
 void State8080::ldax(uint8_t r1, uint8_t r2)
 {
-	memory[(r1 << 8) | r2] = r.a;
+	r.a = load((r1 << 8) | r2);
 }
 
 void State8080::inx(reg_t& r1, reg_t& r2)
 {
-	// could add registers, increment, and then sepparate again, or could not, or could not and just do this
-	if(r1 == 0xff && r2 == 0xff) {
-		r1 = 0;
-		r2 = 0;
-	} else if(r2 == 0xff) {
-		r1++;
-		r2 = 0;
-	} else {
-		r2++;
-	}
+	// add registers, increment, and then sepparate again
+	uint16_t rp = static_cast<uint16_t>(((r1 << 8) | r2) + 1);
+	r1 = static_cast<reg_t>(rp >> 8);
+	r2 = static_cast<reg_t>(rp & 0xff);
 }
 void State8080::inr(reg_t& r)
 {
-	// aux carry
-	cc.ac = (r & 0xf) == 0xf;
 	r++;
 	// ALL FLAGS MINUS CARRY
-	arithFlags(r, FLAG_ALL ^ FLAG_CY);
+	aluFlags(FLAGOP_INR, 0, 0, r);
 }
-void State8080::inr(reg_t& r)
+void State8080::dcr(reg_t& r)
 {
-	// aux carry
-	cc.ac = 0;
+	r--;
 	// ALL FLAGS MINUS CARRY
-	arithFlags(r, FLAG_ALL ^ FLAG_CY);
+	aluFlags(FLAGOP_DCR, 0, 0, r);
 }
 void State8080::dcx(reg_t& r1, reg_t& r2)
 {
-	// could add registers, decrement, and then sepparate again, or could not, or could not and just do this
-	if(r1 == 0x00 && r2 == 0x00) {
-		r1 = 0xff;
-		r2 = 0xff;
-	} else if((r2 == 0xff) && (r1 > 0)) {
-		r1--;
-		r2 = 0xff;
-	} else {
-		r2--;
-	}
+	// add registers, decrement, and then sepparate again
+	uint16_t rp = static_cast<uint16_t>(((r1 << 8) | r2) - 1);
+	r1 = static_cast<reg_t>(rp >> 8);
+	r2 = static_cast<reg_t>(rp & 0xff);
 }
 
 void State8080::dad(uint16_t rp)
 {
-	// TODO: make this simpler
 	uint32_t hl_32 = (r.h << 8) | r.l;
 	hl_32 = hl_32 + static_cast<uint32_t>(rp);
-	cc.cy = (hl_32 > 0xffff);
+	writeFlags((flags() & ~FLAG_CY) | static_cast<uint8_t>(hl_32 >> 16));
 
 	uint16_t hl = (hl_32 & 0xffff);
 	r.h = static_cast<reg_t>(hl >> 8);
@@ -86,63 +336,74 @@ void State8080::add(uint8_t other)
 {
 	//A = A + other
 	uint16_t res = static_cast<uint16_t>(r.a) + static_cast<uint16_t>(other);
-	arithFlags(res, FLAG_ALL);
-	auxCarry(r.a, other);
+	aluFlags(FLAGOP_ADD, r.a, other, res);
 
 	r.a = static_cast<reg_t>(res & 0xff);
 }
 void State8080::adc(uint8_t other)
 {
 	//A = A + other + cy;
-	uint16_t res = static_cast<uint16_t>(r.a) + static_cast<uint16_t>(other) + static_cast<uint16_t>(cc.cy);
-	arithFlags(res, FLAG_ALL);
-	auxCarry(r.a, other);
+	uint16_t res = static_cast<uint16_t>(r.a) + static_cast<uint16_t>(other) + static_cast<uint16_t>(carry());
+	aluFlags(FLAGOP_ADD, r.a, other, res);
 
 	r.a = static_cast<reg_t>(res & 0xff);
 }
 void State8080::sub(uint8_t other)
 {
 	//A = A - other
-	uint16_t res = static_cast<uint16_t>(r.a) - static_cast<uint16_t>(other);
-	arithFlags(res, FLAG_ALL);
-	// I think the aux carry is always 0 in this case
-	// auxCarry(r.a, other);
-	cc.ac = 0;
+	uint16_t res = (static_cast<uint16_t>(r.a) - static_cast<uint16_t>(other)) & 0x1ff;
+	aluFlags(FLAGOP_SUB, r.a, other, res);
 
 	r.a = static_cast<reg_t>(res & 0xff);
 }
 void State8080::sbb(uint8_t other)
 {
- 	//A = A - other
-	uint16_t res = static_cast<uint16_t>(r.a) - static_cast<uint16_t>(other) - static_cast<uint16_t>(cc.cy);
-	arithFlags(res, FLAG_ALL);
- 	// I think the aux carry is always 0 in this case
- 	// auxCarry(r.a, other);
-	cc.ac = 0;
+	//A = A - other - cy
+	uint16_t res = (static_cast<uint16_t>(r.a) - static_cast<uint16_t>(other) - static_cast<uint16_t>(carry())) & 0x1ff;
+	aluFlags(FLAGOP_SUB, r.a, other, res);
 
 	r.a = static_cast<reg_t>(res & 0xff);
 }
+void State8080::daa()
+{
+	uint8_t f = flags();
+	uint8_t correction = 0;
+	uint8_t carry = f & FLAG_CY;
+	uint8_t lo = r.a & 0xf;
+	uint8_t hi = r.a >> 4;
+
+	if ((f & FLAG_AC) || lo > 9) {
+		correction |= 0x06;
+	}
+	if (carry || hi > 9 || (hi >= 9 && lo > 9)) {
+		correction |= 0x60;
+		carry = FLAG_CY;
+	}
+	add(correction);
+	// carry is only ever set here, never cleared
+	writeFlags(flags() | carry);
+}
 void State8080::ana(uint8_t other)
 {
+	uint8_t a = r.a;
 	r.a = r.a & other;
-	logicFlags(r.a, FLAG_ALL);
+	aluFlags(FLAGOP_ANA, a, other, r.a);
 }
 void State8080::ora(uint8_t other)
 {
 	r.a = r.a | other;
-	logicFlags(r.a, FLAG_ALL);
+	aluFlags(FLAGOP_LOGIC, 0, 0, r.a);
 }
 void State8080::xra(uint8_t other)
 {
 	r.a = r.a ^ other;
-	logicFlags(r.a, FLAG_ALL);
+	aluFlags(FLAGOP_LOGIC, 0, 0, r.a);
 }
 void State8080::cmp(uint8_t other)
 {
-	uint8_t x = r.a - other;
-	logicFlags(x, FLAG_ALL ^ FLAG_CY);
-	cc.cy = r.a < other;
-	cc.ac = 0;
+	// SUB without storing the result
+	uint16_t res = (static_cast<uint16_t>(r.a) - static_cast<uint16_t>(other)) & 0x1ff;
+	aluFlags(FLAGOP_SUB, r.a, other, res);
 }
 
 void State8080::jmp(uint8_t hi, uint8_t lo)
@@ -153,82 +414,94 @@ void State8080::jmp(bool cond)
 {
 	uint8_t lo = getNextByte();
 	uint8_t hi = getNextByte();
-	if (cond)
+	if (cond) {
+		uint16_t end = pc;
 		jmp(hi, lo);
+		if (idleArmed && pc < end && end - pc <= static_cast<int>(IDLE_LOOP_BYTES)) {
+			idle(pc, end);
+		}
+	}
 }
 
 void State8080::rst(uint16_t address)
 {
-	uint16_t ret = pc + 2;
+	// pc already points past the RST opcode
+	uint16_t ret = pc;
 	uint8_t lo = static_cast<uint8_t>(ret & 0xff);
 	uint8_t hi = static_cast<uint8_t>(ret >> 8);
 	push(hi, lo);
 	pc = address;
+#ifdef P8080_PROFILE
+	profiler->enter(static_cast<uint16_t>(ret - 1), address, sp, cycles);
+#endif
 }
 void State8080::call(bool cond)
 {
 	uint16_t addr = getNextAddress();
 	if (cond) {	// if it doesn't happen pc + 2
+		cycles += CYCLES_BRANCH_TAKEN;
 		uint8_t lo = static_cast<uint8_t>(pc & 0xff);
 		uint8_t hi = static_cast<uint8_t>(pc >> 8);
 		push(hi, lo);
+#ifdef P8080_PROFILE
+		profiler->enter(static_cast<uint16_t>(pc - 3), addr, sp, cycles);
+#endif
 		pc = addr;
 	}
 }
 
+void State8080::ret()
+{
+#ifdef P8080_PROFILE
+	profiler->leave(sp, cycles);
+#endif
+	pc = load(sp) | (load(sp + 1) << 8);
+	sp += 2;
+}
 void State8080::ret(bool cond)
 {
 	if (cond) {
-		pc = memory[sp] | (memory[sp+1] << 8);
-		sp += 2;
+		cycles += CYCLES_BRANCH_TAKEN;
+		ret();
 	}
 }
 
 void State8080::pop(uint8_t& r1, uint8_t& r2)
 {
-	r2 = memory[sp];
-	r1 = memory[sp + 1];
+	r2 = load(sp);
+	r1 = load(sp + 1);
 	sp += 2;
 }
 
 void State8080::push(uint8_t r1, uint8_t r2)
 {
-	memory[sp - 1] = r2;
-	memory[sp - 2] = r1;
+	// high byte goes on top, so pop reads it back from sp + 1
+	store(sp - 1, r1);
+	store(sp - 2, r2);
 	sp -= 2;
 }
 
 void State8080::popPSW()
 {
-	r.a = memory[sp+1];
-	uint8_t psw = memory[sp];
-	cc.z  = (0x01 == (psw & 0x01));
-	cc.s  = (0x02 == (psw & 0x02));
-	cc.p  = (0x04 == (psw & 0x04));
-	cc.cy = (0x08 == (psw & 0x08));	// check this in tutorial repo
-	cc.ac = (0x10 == (psw & 0x10));
-	sp += 2;
+	uint8_t psw;
+	pop(r.a, psw);
+	setFlags(psw);
 }
 
 void State8080::pushPSW()
 {
-	memory[sp-1] = r.a;
-	uint8_t psw = (cc.z | cc.s << 1 | cc.p << 2 | cc.cy << 3 | cc.ac << 4 );
-	memory[sp-2] = psw;
-	sp = sp - 2;
+	push(r.a, flags() | FLAG_PSW_SET);
 }
 
 void State8080::xthl()
 {
 	uint8_t exchange = r.l;
-	r.l = memory[sp];
-	memory[sp] = exchange;
+	r.l = load(sp);
+	store(sp, exchange);
 
 	exchange = r.h;
-	r.h = memory[sp + 1];
-	memory[sp + 1] = exchange;
-
-	sp++;
+	r.h = load(sp + 1);
+	store(sp + 1, exchange);
 }
 
 void State8080::xchg()
@@ -244,53 +517,64 @@ void State8080::xchg()
 	r.e = exchange;
 }
 
-// AC flag, carry is set from bit 3 to bit 4,
-// so when an operation with bits under 0x10 trigger the 0x10 bit
-void State8080::auxCarry(uint16_t a, uint16_t b)
+inline uint8_t State8080::load(uint16_t address)
 {
-	uint8_t low_A = a & 0xf;
-	uint8_t low_B = b & 0xf;
+#ifdef P8080_PROFILE
+	profiler->read(address);
+#endif
+	return bus.read(address);
+}
 
-	cc.ac = (low_A + low_B) > 0xf;
+inline void State8080::store(uint16_t address, uint8_t value)
+{
+#ifdef P8080_PROFILE
+	profiler->write(address);
+#endif
+	bus.write(address, value);
 }
 
-int State8080::parity(int x, int size)
+uint8_t State8080::getHL()
 {
-	int p = 0;
-	x = (x & ((1 << size) - 1));
+	uint16_t offset = (r.h << 8) | r.l;
+	return load(offset);
+}
 
-	for(int i = 0; i < size; i++) {
-		if(x & 0x1) p++;
-		x = x >> 1;
-	}
-	return (0 == (p & 0x1));
-};
+void State8080::setHL(uint8_t value)
+{
+	uint16_t offset = (r.h << 8) | r.l;
+	store(offset, value);
+}
 
-void State8080::arithFlags(uint16_t res, uint8_t flags)
+#ifdef P8080_DECODE_CACHE
+inline uint8_t State8080::fetch()
 {
-	if(flags & FLAG_Z)  cc.z = ((res & 0xff) == 0);
-	if(flags & FLAG_S)  cc.s = ((res & 0x80) != 0);
-	if(flags & FLAG_P)  cc.p = parity(res & 0xff);
-	if(flags & FLAG_CY) cc.cy = (res > 0xff);
+	Decoded entry = decoded->fetch(bus, pc++);
+	operand = entry.operand;
+	return entry.opcode;
 }
-void State8080::logicFlags(reg_t reg, uint8_t flags)
+
+uint8_t State8080::getNextByte()
 {
-	if(flags & FLAG_Z)  cc.z = (reg == 0);
-	if(flags & FLAG_S)  cc.s = ((reg & 0x80) != 0);
-	if(flags & FLAG_P)  cc.p = parity(reg & 0xff);
- 	// data book says these are zeroed
-	if(flags & FLAG_CY) cc.cy = cc.ac = 0;
+	pc++;
+	uint8_t next = static_cast<uint8_t>(operand);
+	operand >>= 8;
+	return next;
 }
 
-uint8_t& State8080::getHL()
+uint16_t State8080::getNextAddress()
 {
-	uint16_t offset = (r.h << 8) | r.l;
-	return memory[offset];
+	pc += 2;
+	return operand;
+}
+#else
+inline uint8_t State8080::fetch()
+{
+	return bus.read(pc++);
 }
 
-uint8_t& State8080::getNextByte()
+uint8_t State8080::getNextByte()
 {
-	return memory[++pc];
+	return bus.read(pc++);
 }
 
 uint16_t State8080::getNextAddress()
@@ -299,24 +583,34 @@ uint16_t State8080::getNextAddress()
 	uint8_t hi = getNextByte();
 	return (hi << 8) | lo;
 }
+#endif
 
 
 
-int State8080::Emulate8080p() {
+// every instruction lives here, OPCODE is a constant so the switch folds away
+// and each instantiation is only the body of its case
+template<uint8_t OPCODE>
+inline void State8080::execute()
+{
+	cycles += CYCLES[OPCODE];
+#ifdef P8080_PROFILE
+	profiler->step(static_cast<uint16_t>(pc - 1), OPCODE);
+#endif
 
-	switch(memory[pc]) {
+	switch(OPCODE) {
 		case 0x00: break; // NOP
-		case 0x01: lxi(r.b, r.c); // LXI B, WORD
+		case 0x01: lxi(r.b, r.c); break; // LXI B, WORD
 		case 0x02: stax(r.b, r.c); break; //STAX B
 		case 0x03: inx(r.b, r.c); break; // INX B
 		case 0x04: inr(r.b); break; // INR B
 		case 0x05: dcr(r.b); break; // DCR B
 		case 0x06: mov(r.b, getNextByte()); break; // MVI B, BYTE
-		case 0x07: // RLC
+		case 0x07: { // RLC
 			uint8_t x = r.a;
 			r.a = ((x & 0x80) >> 7) | (x << 1);
-			cc.cy = 1 == (x & 0x80);
+			writeFlags((flags() & ~FLAG_CY) | (x >> 7));
 			break;
+		}
 		case 0x08: break; // -
 		case 0x09: dad((r.b << 8) | r.c); break; // DAD B
 		case 0x0A: ldax(r.b, r.c); break; // LDAX B
@@ -324,11 +618,12 @@ int State8080::Emulate8080p() {
 		case 0x0C: inr(r.c); break; // INR C
 		case 0x0D: dcr(r.c); break; // DCR C
 		case 0x0E: mov(r.c, getNextByte()); break; // MVI C, BYTE
-		case 0x0F: // RRC
+		case 0x0F: { // RRC
 			uint8_t x = r.a;
 			r.a = ((x & 1) << 7) | (x >> 1);
-			cc.cy = (1 == (x & 1));
+			writeFlags((flags() & ~FLAG_CY) | (x & 1));
 			break;
+		}
 		case 0x10: break; // -
 		case 0x11: lxi(r.d, r.e); break; // LXI D, WORD
 		case 0x12: stax(r.d, r.e); break; // STAX D
@@ -336,11 +631,12 @@ int State8080::Emulate8080p() {
 		case 0x14: inr(r.d); break; // INR E
 		case 0x15: dcr(r.d); break; // DCR D
 		case 0x16: mov(r.d, getNextByte()); break; // MVI D, BYTE
-		case 0x17: // RAL
+		case 0x17: { // RAL
 			uint8_t x = r.a;
-			r.a = (x << 1) | cc.cy ;
-			cc.cy = (1 == (x&0x80));
+			r.a = (x << 1) | carry();
+			writeFlags((flags() & ~FLAG_CY) | (x >> 7));
 			break;
+		}
 
 		case 0x18: break; // -
 		case 0x19: dad((r.d << 8) | r.e); break; // DAD D
@@ -349,33 +645,35 @@ int State8080::Emulate8080p() {
 		case 0x1C: inr(r.e); break; // INR E
 		case 0x1D: dcr(r.e); break; // DCR E
 		case 0x1E: mov(r.e, getNextByte()); break; // MVI E
-		case 0x1F: //RAR
+		case 0x1F: { //RAR
 			uint8_t x = r.a;
-			r.a = (cc.cy << 7) | (x >> 1);
-			cc.cy = (1 == (x&1));
+			r.a = (carry() << 7) | (x >> 1);
+			writeFlags((flags() & ~FLAG_CY) | (x & 1));
 			break;
+		}
 
 		case 0x20: break; // -
 		case 0x21: lxi(r.h, r.l); break; // LXI H, WORD
-		case 0x22: // SHLD H
+		case 0x22: { // SHLD H
 			uint16_t addr = getNextAddress();
-			memory[addr] = r.l;
-			memory[addr + 1] = r.h;
+			store(addr, r.l);
+			store(addr + 1, r.h);
 			break;
+		}
 		case 0x23: inx(r.h, r.l); break; // INX H
 		case 0x24: inr(r.h); break; // INR H
 		case 0x25: dcr(r.h); break; // DCR H
 		case 0x26: mov(r.h, getNextByte()); break; // MVI H, BYTE
-			break;
-		case 0x27: unimplementedInstruction(); break; // DAA
+		case 0x27: daa(); break; // DAA
 
 		case 0x28: break; // -
 		case 0x29: dad((r.h << 8) | r.l); break; // DAD H
-		case 0x2A: // LHLD
+		case 0x2A: { // LHLD
 			uint16_t address = getNextAddress();
-			r.l = memory[address];
-			r.h = memory[address + 1];
+			r.l = load(address);
+			r.h = load(address + 1);
 			break;
+		}
 		case 0x2B: dcx(r.h, r.l); break; // DCX H
 		case 0x2C: inr(r.l); break; // INR L
 		case 0x2D: dcr(r.l); break; // DCR L
@@ -384,21 +682,31 @@ int State8080::Emulate8080p() {
 
 		case 0x30: break; // -
 		case 0x31: sp = getNextAddress(); break; // LXI SP, WORD
-		case 0x32: ; break;
+		case 0x32: store(getNextAddress(), r.a); break; // STA adr
 		case 0x33: sp++; break; // INX SP
-		case 0x34: inr(getHL()); break; // INR M
-		case 0x36: mov(getHL(), getNextByte()); break; // MVI M, BYTE
-		case 0x35: dcr(getHL()); break; // DCR M
-		case 0x37: cc.cy = 1; break; // STC
+		case 0x34: { // INR M
+			uint8_t m = getHL();
+			inr(m);
+			setHL(m);
+			break;
+		}
+		case 0x35: { // DCR M
+			uint8_t m = getHL();
+			dcr(m);
+			setHL(m);
+			break;
+		}
+		case 0x36: setHL(getNextByte()); break; // MVI M, BYTE
+		case 0x37: writeFlags(flags() | FLAG_CY); break; // STC
 
 		case 0x38: break; // -
 		case 0x39: dad(sp); break; // DAD SP, quick and dirty, should work
-		case 0x3A: r.a = memory[getNextAddress()]; break; // LDA adr
+		case 0x3A: r.a = load(getNextAddress()); break; // LDA adr
 		case 0x3B: sp--; break; // DCX SP
 		case 0x3C: inr(r.a); break; // INR A
-		case 0x3D: dcr(r.b); break; // DCR A
+		case 0x3D: dcr(r.a); break; // DCR A
 		case 0x3E: mov(r.a, getNextByte()); break; // MVI A, BYTE
-		case 0x3F: cc.cy = ~cc.cy; break; // CMC
+		case 0x3F: writeFlags(flags() ^ FLAG_CY); break; // CMC
 
 		case 0x40: mov(r.b, r.b); break; // MOV B,B
 		case 0x41: mov(r.b, r.c); break; // MOV B,C
@@ -454,14 +762,14 @@ int State8080::Emulate8080p() {
 		case 0x6E: mov(r.l, getHL()); break;// MOV L,HL
 		case 0x6F: mov(r.l, r.a); break; // MOV L,A
 
-		case 0x70: mov(getHL(), r.b); break; // MOV M,B
-		case 0x71: mov(getHL(), r.c); break; // MOV M,C
-		case 0x72: mov(getHL(), r.d); break; // MOV M,D
-		case 0x73: mov(getHL(), r.e); break; // MOV M,E
-		case 0x74: mov(getHL(), r.h); break; // MOV M,H
-		case 0x75: mov(getHL(), r.l); break; // MOV M,L
-		case 0x76: std::exit(0); break; // HLT, lol
-		case 0x77: mov(getHL(), r.a); break; // MOV C,A
+		case 0x70: setHL(r.b); break; // MOV M,B
+		case 0x71: setHL(r.c); break; // MOV M,C
+		case 0x72: setHL(r.d); break; // MOV M,D
+		case 0x73: setHL(r.e); break; // MOV M,E
+		case 0x74: setHL(r.h); break; // MOV M,H
+		case 0x75: setHL(r.l); break; // MOV M,L
+		case 0x76: halt(); break; // HLT
+		case 0x77: setHL(r.a); break; // MOV M,A
 
 		case 0x78: mov(r.a, r.b); break; // MOV A,B
 		case 0x79: mov(r.a, r.c); break; // MOV A,C
@@ -512,8 +820,8 @@ int State8080::Emulate8080p() {
 		case 0xA1: ana(r.c); break; // ANA C
 		case 0xA2: ana(r.d); break; // ANA D
 		case 0xA3: ana(r.e); break; // ANA E
-		case 0xA4: ana(r.l); break; // ANA L
-		case 0xA5: ana(r.h); break; // ANA H
+		case 0xA4: ana(r.h); break; // ANA H
+		case 0xA5: ana(r.l); break; // ANA L
 		case 0xA6: ana(getHL()); break; // ANA M
 		case 0xA7: ana(r.a); break; // ANA A
 
@@ -521,8 +829,8 @@ int State8080::Emulate8080p() {
 		case 0xA9: xra(r.c); break; // XRA C
 		case 0xAA: xra(r.d); break; // XRA D
 		case 0xAB: xra(r.e); break; // XRA E
-		case 0xAC: xra(r.l); break; // XRA L
-		case 0xAD: xra(r.h); break; // XRA H
+		case 0xAC: xra(r.h); break; // XRA H
+		case 0xAD: xra(r.l); break; // XRA L
 		case 0xAE: xra(getHL()); break; // XRA M
 		case 0xAF: xra(r.a); break; // XRA A
 
@@ -530,8 +838,8 @@ int State8080::Emulate8080p() {
 		case 0xB1: ora(r.c); break; // ORA C
 		case 0xB2: ora(r.d); break; // ORA D
 		case 0xB3: ora(r.e); break; // ORA E
-		case 0xB4: ora(r.l); break; // ORA L
-		case 0xB5: ora(r.h); break; // ORA H
+		case 0xB4: ora(r.h); break; // ORA H
+		case 0xB5: ora(r.l); break; // ORA L
 		case 0xB6: ora(getHL()); break; // ORA M
 		case 0xB7: ora(r.a); break; // ORA A
 
@@ -544,79 +852,251 @@ int State8080::Emulate8080p() {
 		case 0xBE: cmp(getHL()); break; // CMP M
 		case 0xBF: cmp(r.a); break; // CMP A
 
-		case 0xC0: ret(cc.z == 0); break;  						// RNZ
+		case 0xC0: ret(!(flags() & FLAG_Z)); break;  						// RNZ
 		case 0xC1: pop(r.b, r.c); break;						// POP B
-		case 0xC2: jmp(cc.z == 0); break;						// JNZ address
+		case 0xC2: jmp(!(flags() & FLAG_Z)); break;						// JNZ address
 		case 0xC3: jmp(true); break;							// JMP address
-		case 0xC4: call(cc.z == 0); break;  					// CNZ address
+		case 0xC4: call(!(flags() & FLAG_Z)); break;  					// CNZ address
 		case 0xC5: push(r.b, r.c); break;						// PUSH B
 		case 0xC6: add(getNextByte()); break;					// ADI byte
 		case 0xC7: rst(0x0); break;								// RST 0
 
-		case 0xC8: ret(cc.z != 0); break;						// RZ
-		case 0xC9: ret(true); break;							// RET
-		case 0xCA: jmp(cc.z != 0); break;	  					// JZ address
+		case 0xC8: ret(flags() & FLAG_Z); break;						// RZ
+		case 0xC9: ret(); break;								// RET
+		case 0xCA: jmp(flags() & FLAG_Z); break;	  					// JZ address
 		case 0xCB: break;										//
-		case 0xCC: call(cc.z != 0); break;  					// CZ address
+		case 0xCC: call(flags() & FLAG_Z); break;  					// CZ address
 		case 0xCD: call(true); break;							// CALL address
 		case 0xCE: adc(getNextByte()); break;					// ACY byte
 		case 0xCF: rst(0x8); break;								// RST 1
 
-		case 0xD0: ret(cc.cy == 0); break;						// RNC
+		case 0xD0: ret(!(flags() & FLAG_CY)); break;						// RNC
 		case 0xD1: pop(r.d, r.e); break;						// POP D
-		case 0xD2: jmp(cc.cy == 0); break;						// JNC address
-		case 0xD3: /* NOT YET IMPLEMENTED */; pc++; break;		// OUT
-		case 0xD4: call(cc.cy == 0); break; 					// CNC address
+		case 0xD2: jmp(!(flags() & FLAG_CY)); break;						// JNC address
+		case 0xD3: ports.out(getNextByte(), r.a); break;		// OUT port
+		case 0xD4: call(!(flags() & FLAG_CY)); break; 					// CNC address
 		case 0xD5: push(r.d, r.e); break;						// PUSH D
 		case 0xD6: sub(getNextByte()); break;					// SUI byte
 		case 0xD7: rst(0x10); break;							// RST 2
 
-		case 0xD8: ret(cc.cy != 0); break;						// RC
+		case 0xD8: ret(flags() & FLAG_CY); break;						// RC
 		case 0xD9: break;										// -
-		case 0xDA: jmp(cc.cy != 0); break;						// JC address
-		case 0xDB: /* NOT YET IMPLEMENTED */; pc++; break;		// IN
-		case 0xDC: call(cc.cy != 0); break; 					// CC address
+		case 0xDA: jmp(flags() & FLAG_CY); break;						// JC address
+		case 0xDB: r.a = ports.in(getNextByte()); break;		// IN port
+		case 0xDC: call(flags() & FLAG_CY); break; 					// CC address
 		case 0xDD: break;										// -
 		case 0xDE: sbb(getNextByte()); break;					// SBI byte
 		case 0xDF: rst(0x18); break;							// RST 3
 
-		case 0xE0: ret(cc.p == 0); break;						// RPO
+		case 0xE0: ret(!(flags() & FLAG_P)); break;						// RPO
 		case 0xE1: pop(r.h, r.l); break;						// POP H
-		case 0xE2: jmp(cc.p == 0); break;						// JPO address (parity odd, not set)
+		case 0xE2: jmp(!(flags() & FLAG_P)); break;						// JPO address (parity odd, not set)
 		case 0xE3: xthl(); break;								// XTHL
-		case 0xE4: call(cc.p == 0); break;						// CPO address
+		case 0xE4: call(!(flags() & FLAG_P)); break;						// CPO address
 		case 0xE5: push(r.h, r.l); break;						// PUSH H
 		case 0xE6: ana(getNextByte()); break;					// ANI byte
 		case 0xE7: rst(0x20); break;							// RST 4
 
-		case 0xE8: ret(cc.p != 0); break;						// RPE
+		case 0xE8: ret(flags() & FLAG_P); break;						// RPE
 		case 0xE9: jmp(r.h, r.l); break;						// PCHL
-		case 0xEA: jmp(cc.p != 0); break;					  	// JPE address (parity even, set)
+		case 0xEA: jmp(flags() & FLAG_P); break;					  	// JPE address (parity even, set)
 		case 0xEB: xchg(); break;								// XCHG
-		case 0xEC: call(cc.p != 0); break;  					// CPE address
+		case 0xEC: call(flags() & FLAG_P); break;  					// CPE address
 		case 0xED: break;										// -
 		case 0xEE: xra(getNextByte()); break;					// XRI byte
 		case 0xEF: rst(0x28); break;							// RST 5
 
-		case 0xF0: ret(cc.s == 0); break;						// RP
+		case 0xF0: ret(!(flags() & FLAG_S)); break;						// RP
 		case 0xF1: popPSW(); break;								// POP PSW
-		case 0xF2: jmp(cc.s == 0); break;						// JP address (plus)
+		case 0xF2: jmp(!(flags() & FLAG_S)); break;						// JP address (plus)
 		case 0xF3: int_enable = 0; break;						// DI
-		case 0xF4: call(cc.s == 0); break;						// CP address
+		case 0xF4: call(!(flags() & FLAG_S)); break;						// CP address
 		case 0xF5: pushPSW(); break;							// PUSH PSW
 		case 0xF6: ora(getNextByte()); break;					// ORI byte
 		case 0xF7: rst(0x30); break;							// RST 6
 
-		case 0xF8: ret(cc.p != 0); break;						// RM
+		case 0xF8: ret(flags() & FLAG_S); break;						// RM
 		case 0xF9: sp = (r.h << 8) | r.l; break;				// SPHL
-		case 0xFA: jmp(cc.s != 0); break; 						// JM address (minus)
+		case 0xFA: jmp(flags() & FLAG_S); break; 						// JM address (minus)
 		case 0xFB: int_enable = 1; break;						// EI
-		case 0xFC: call(cc.s != 0); break;						// CM address
+		case 0xFC: call(flags() & FLAG_S); break;						// CM address
 		case 0xFD: break;										// -
 		case 0xFE: cmp(getNextByte()); break;					// CPI byte
 		case 0xFF: rst(0x38); break;							// RST 7
 	}
-	pc++;
+}
+
+// opcode list, used to stamp out the dispatch table, the switch and the labels
+#define P8080_OPCODE_ROW(X, h) \
+	X(0x##h##0) X(0x##h##1) X(0x##h##2) X(0x##h##3) \
+	X(0x##h##4) X(0x##h##5) X(0x##h##6) X(0x##h##7) \
+	X(0x##h##8) X(0x##h##9) X(0x##h##A) X(0x##h##B) \
+	X(0x##h##C) X(0x##h##D) X(0x##h##E) X(0x##h##F)
+
+#define P8080_FOR_EACH_OPCODE(X) \
+	P8080_OPCODE_ROW(X, 0) P8080_OPCODE_ROW(X, 1) P8080_OPCODE_ROW(X, 2) P8080_OPCODE_ROW(X, 3) \
+	P8080_OPCODE_ROW(X, 4) P8080_OPCODE_ROW(X, 5) P8080_OPCODE_ROW(X, 6) P8080_OPCODE_ROW(X, 7) \
+	P8080_OPCODE_ROW(X, 8) P8080_OPCODE_ROW(X, 9) P8080_OPCODE_ROW(X, A) P8080_OPCODE_ROW(X, B) \
+	P8080_OPCODE_ROW(X, C) P8080_OPCODE_ROW(X, D) P8080_OPCODE_ROW(X, E) P8080_OPCODE_ROW(X, F)
+
+
+#if defined P8080_DISPATCH_TABLE
+template<uint8_t OPCODE>
+void State8080::executeOp(State8080& state)
+{
+	state.execute<OPCODE>();
+}
+
+#define P8080_TABLE_ENTRY(op) &State8080::executeOp<op>,
+const State8080::OpHandler State8080::opTable[256] = {
+	P8080_FOR_EACH_OPCODE(P8080_TABLE_ENTRY)
+};
+#undef P8080_TABLE_ENTRY
+#endif
+
+
+State8080::State8080(size_t memorySize)
+	: r{}, sp(0), pc(0), memory(std::min<size_t>(memorySize, 0x10000)), cc{}, int_enable(0), cycles(0)
+{
+	// plain RAM until a machine maps something else
+	if (memory.size() >= PAGE_SIZE) {
+		bus.mapRam(0, static_cast<unsigned>(memory.size() / PAGE_SIZE), memory.data());
+	}
+#ifdef P8080_DECODE_CACHE
+	decoded.reset(new DecodeCache());
+	bus.setObserver(decoded.get());
+#endif
+#ifdef P8080_PROFILE
+	profiler.reset(new Profiler());
+#endif
+}
+
+// out of line for unique_ptr<Jit>
+State8080::State8080(State8080&&) = default;
+State8080& State8080::operator=(State8080&&) = default;
+State8080::~State8080() = default;
+
+int State8080::Emulate8080p()
+{
+	if (status != Status::Running) {
+		return 0;
+	}
+	uint64_t start = cycles;
+	dispatch(1, UINT64_MAX);
+	scheduler.runDue(cycles);
+	return static_cast<int>(cycles - start);
+}
+
+// events only get looked at when the dispatch loop hits the next deadline,
+// so they cost nothing per instruction
+
+uint64_t State8080::run(uint64_t n)
+{
+	uint64_t executed = 0;
+	while (executed < n && status != Status::Error) {
+		if (status == Status::Halted) {
+			// only an interrupt gets out of HLT, skip to the next event if one can
+			if (!int_enable || scheduler.next() == UINT64_MAX) {
+				break;
+			}
+			cycles = std::max(cycles, scheduler.next());
+		} else {
+			executed += dispatch(n - executed, scheduler.next());
+		}
+		scheduler.runDue(cycles);
+	}
+	return executed;
+}
+
+int State8080::runCycles(uint64_t budget)
+{
+	uint64_t target = cycles + budget;
+	while (cycles < target && status != Status::Error) {
+		uint64_t stop = std::min(target, scheduler.next());
+		if (status == Status::Halted) {
+			// time still passes and events still fire while halted
+			cycles = std::max(cycles, stop);
+		} else {
+			idleArmed = skipIdle;
+#ifdef P8080_JIT
+			if (!jit) {
+				jit.reset(new Jit());
+				bus.setObserver(jit.get());
+			}
+			jit->run(*this, stop);
+#else
+			dispatch(UINT64_MAX, stop);
+#endif
+			idleArmed = false;
+		}
+		scheduler.runDue(cycles);
+	}
+	return static_cast<int>(cycles - target);
+}
+
+bool State8080::interrupt(uint8_t n)
+{
+	if (!int_enable) {
+		return false;
+	}
+	// the device jams RST n on the data bus, pc already points at the
+	// instruction that would have run next so that's what gets pushed
+	int_enable = 0;
+	if (status == Status::Halted) {
+		status = Status::Running;
+	}
+	cycles += CYCLES[0xC7 | (n << 3)];
+	push(static_cast<uint8_t>(pc >> 8), static_cast<uint8_t>(pc & 0xff));
+	pc = static_cast<uint16_t>(n << 3);
+#ifdef P8080_PROFILE
+	profiler->enter(Profiler::INTERRUPT + (n & 7), pc, sp, cycles);
+#endif
+	return true;
+}
+
+uint64_t State8080::dispatch(uint64_t n, uint64_t target)
+{
+	uint64_t executed = 0;
+	// a member, so HLT and errors can pull it in and stop the loop
+	deadline = target;
+
+#if defined P8080_DISPATCH_THREADED
+	// one indirect jump at the end of every handler instead of a shared one,
+	// so the branch predictor gets a history per opcode
+	#define P8080_LABEL_ADDRESS(op) &&op_##op,
+	static void* const labels[256] = {
+		P8080_FOR_EACH_OPCODE(P8080_LABEL_ADDRESS)
+	};
+	#undef P8080_LABEL_ADDRESS
+
+	#define P8080_NEXT()                                      \
+		if (executed == n || cycles >= deadline) goto done; \
+		executed++;                                       \
+		goto *labels[fetch()];
+
+	P8080_NEXT();
+
+	#define P8080_LABEL(op) op_##op: execute<op>(); P8080_NEXT();
+	P8080_FOR_EACH_OPCODE(P8080_LABEL)
+	#undef P8080_LABEL
+	#undef P8080_NEXT
+
+done:
+#elif defined P8080_DISPATCH_TABLE
+	for (; executed < n && cycles < deadline; executed++) {
+		opTable[fetch()](*this);
+	}
+#else
+	for (; executed < n && cycles < deadline; executed++) {
+		switch(fetch()) {
+			#define P8080_CASE(op) case op: execute<op>(); break;
+			P8080_FOR_EACH_OPCODE(P8080_CASE)
+			#undef P8080_CASE
+		}
+	}
+#endif
+
+	return executed;
 }
 
 }
\ No newline at end of file
@@ -1,27 +1,91 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
+#include "Bus.h"
+#include "Flags.h"
+#include "Ports.h"
+#include "Scheduler.h"
+
+// lazy flags, ALU ops only remember what they did and flags are worked out
+// when something reads them, P8080_LAZY_FLAGS_CHECK also keeps eager flags
+// around and throws as soon as both disagree, tests/lazyflags.cpp runs the
+// two side by side
+#if defined P8080_LAZY_FLAGS_CHECK && !defined P8080_LAZY_FLAGS
+	#define P8080_LAZY_FLAGS
+#endif
+
+// -DP8080_JIT runs runCycles() through the recompiler in Jit.h, x86-64 only
+#if defined P8080_JIT && !defined __x86_64__ && !defined _M_X64
+	#undef P8080_JIT
+#endif
+
+// -DP8080_DECODE_CACHE fetches through DecodeCache.h, the JIT keeps track of
+// code on its own and leaves it out
+#if defined P8080_DECODE_CACHE && defined P8080_JIT
+	#undef P8080_DECODE_CACHE
+#endif
+
+// -DP8080_PROFILE counts what the interpreter runs, see Profiler.h, the JIT
+// would run past it so it's left out
+#if defined P8080_PROFILE && defined P8080_JIT
+	#undef P8080_JIT
+#endif
+
 namespace p8080 {
 
+class Jit;
+class DecodeCache;
+class Profiler;
+
 typedef std::vector<uint8_t> Memory;
 typedef uint8_t reg_t;
 
 
-constexpr uint8_t FLAG_Z  =  0b00000001;
-constexpr uint8_t FLAG_S  =  0b00000010;
-constexpr uint8_t FLAG_P  =  0b00000100;
-constexpr uint8_t FLAG_CY =  0b00001000;
-constexpr uint8_t FLAG_AC =  0b00010000;
-constexpr uint8_t FLAG_ALL=	 0b00011111;
-
-struct ConditionCodes8080 {
-	uint8_t z : 1;
-	uint8_t s : 1;
-	uint8_t p : 1;
-	uint8_t cy: 1;
-	uint8_t ac: 1;
-	uint8_t   : 3;
+// T-states per opcode, conditional CALL and RET are listed as not taken
+constexpr uint8_t CYCLES[256] = {
+//	 0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+	 4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 0x00
+	 4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 0x10
+	 4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4, // 0x20
+	 4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4, // 0x30
+	 5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x40
+	 5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x50
+	 5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x60
+	 7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5, // 0x70
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x80
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x90
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0xA0
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0xB0
+	 5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10,  4, 11, 11,  7, 11, // 0xC0
+	 5, 10, 10, 10, 11, 11,  7, 11,  5,  4, 10, 10, 11,  4,  7, 11, // 0xD0
+	 5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  4, 11,  4,  7, 11, // 0xE0
+	 5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11,  4,  7, 11, // 0xF0
+};
+// extra T-states when a conditional CALL or RET is taken
+constexpr uint8_t CYCLES_BRANCH_TAKEN = 6;
+
+// bytes per opcode, operands included, the undocumented ones are all NOPs
+constexpr uint8_t LENGTH[256] = {
+//	0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+	1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x00
+	1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x10
+	1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, // 0x20
+	1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, // 0x30
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x50
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x70
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x80
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x90
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xA0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xB0
+	1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1, // 0xC0
+	1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 1, 2, 1, // 0xD0
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // 0xE0
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // 0xF0
 };
 
 struct registers8080 {
@@ -35,19 +99,144 @@ struct registers8080 {
 };
 
 
+enum class Status : uint8_t {
+	Running,
+	// HLT, waiting for an interrupt
+	Halted,
+	// stopped for good, see State8080::error
+	Error,
+};
+
+// everything in State8080 that isn't memory, devices or events, plain
+// bytes so it can be memcpy'd in and out of save states
+struct CpuState {
+	registers8080 r;
+	uint16_t sp;
+	uint16_t pc;
+	uint8_t psw;
+	uint8_t int_enable;
+	Status status;
+	uint64_t cycles;
+};
+
 class State8080 {
 public:
 	registers8080 r;
 	uint16_t sp;
 	uint16_t pc;
+	// default backing store, the bus maps all of it as RAM from 0 on
+	// construction, machines that bring their own memory can leave it empty
 	Memory memory;
-	ConditionCodes8080 cc;
+	// every load, store and fetch goes through here
+	Bus bus;
+	// IN and OUT go through here
+	Ports ports;
+	// packed flags, see FLAG_*, may be stale in lazy mode so go through flags()
+	uint8_t cc;
 	uint8_t int_enable;
+	// T-states since reset
+	uint64_t cycles;
+	// timed events, fired between instructions once cycles reaches them
+	Scheduler scheduler;
+	// run loops return early unless Running, nothing ever exits or throws
+	Status status = Status::Running;
+	// what went wrong when status is Error
+	const char* error = nullptr;
+	// runCycles() jumps over loops that only poll memory, straight to the
+	// next event, see idle(). exact, the cycle count and state after it
+	// are the same as running every iteration
+	bool skipIdle = false;
+	// T-states jumped over that way
+	uint64_t idleCycles = 0;
+#ifdef P8080_PROFILE
+	// made with the cpu, counts from the first instruction
+	std::unique_ptr<Profiler> profiler;
+#endif
 
 public:
+	// memorySize is rounded down to whole pages, anything past it is open bus
+	explicit State8080(size_t memorySize = 0x10000);
+	// the bus points into memory, a copy would share it
+	State8080(const State8080&) = delete;
+	State8080& operator=(const State8080&) = delete;
+	State8080(State8080&&);
+	State8080& operator=(State8080&&);
+	~State8080();
+
+	// execute a single instruction, returns the T-states it took
 	int Emulate8080p();
+	// execute n instructions in one go, returns how many were executed
+	uint64_t run(uint64_t n);
+	// execute until budget T-states have passed, returns the overshoot,
+	// goes through the JIT when built with it
+	int runCycles(uint64_t budget);
+
+	// run RST n as if a device had put it on the bus, false if interrupts
+	// are disabled and it got dropped
+	bool interrupt(uint8_t n);
+
+	// up to date flags, computes them first in lazy mode
+	uint8_t flags();
+	// overwrite the flags, takes the PSW layout
+	void setFlags(uint8_t psw);
+
+	CpuState save();
+	// error is cleared, the message doesn't survive a save
+	void load(const CpuState& state);
 private:
-	void unimplementedInstruction();
+	friend class Jit;
+
+#ifdef P8080_JIT
+	// made on the first runCycles()
+	std::unique_ptr<Jit> jit;
+#endif
+#ifdef P8080_DECODE_CACHE
+	std::unique_ptr<DecodeCache> decoded;
+	// operands of the instruction being run, fetched along with the opcode
+	uint16_t operand = 0;
+#endif
+#ifdef P8080_LAZY_FLAGS
+	// last flag setting ALU op and its operands
+	uint8_t lazyOp = FLAGOP_NONE;
+	uint8_t lazyA = 0;
+	uint8_t lazyB = 0;
+	uint16_t lazyRes = 0;
+#endif
+#ifdef P8080_LAZY_FLAGS_CHECK
+	uint8_t eagerCC = 0;
+#endif
+
+	uint64_t dispatch(uint64_t n, uint64_t target);
+	uint64_t deadline = 0;
+
+	// the short loop last jumped back into, from the jump that ends at
+	// idleEnd, and the state it was in at the top
+	bool idleArmed = false;
+	bool idleCandidate = false;
+	uint16_t idleHead = 0;
+	uint16_t idleEnd = 0;
+	uint32_t idleIteration = 0;
+	uint8_t idleReads = 0;
+	uint64_t idleStart = 0;
+	registers8080 idleRegs = {};
+	uint16_t idleSp = 0;
+	uint8_t idleFlags = 0;
+
+	void idle(uint16_t head, uint16_t end);
+	bool idleBody(uint16_t head, uint16_t end, uint32_t& iteration, uint8_t& reads) const;
+
+	typedef void (*OpHandler)(State8080&);
+	static const OpHandler opTable[256];
+
+	template<uint8_t OPCODE> void execute();
+	template<uint8_t OPCODE> static void executeOp(State8080& state);
+
+	void halt();
+
+	// flag helpers
+	void writeFlags(uint8_t f);
+	void aluFlags(uint8_t op, uint8_t a, uint8_t b, uint16_t res);
+	uint8_t carry();
 
 	// arithmetic
 	void inx(reg_t& r1, reg_t& r2);
@@ -58,7 +247,7 @@ private:
 	void adc(uint8_t other);
 	void sub(uint8_t other);
 	void sbb(uint8_t other);
-	void arithFlags(uint16_t res, uint8_t flags);
+	void daa();
 
 	// data
 	void mov(uint8_t& r1, uint8_t r2);
@@ -72,12 +261,12 @@ private:
 	void xra(uint8_t other);
 	void cmp(uint8_t other);
 	void dad(uint16_t rp);
-	void logicFlags(reg_t reg, uint8_t flags);
 
 	// branch
 	void jmp(uint8_t hi, uint8_t lo);
 	void jmp(bool cond);
 	void call(bool cond);
+	void ret();
 	void ret(bool cond);
 	void rst(uint16_t address);
 
@@ -88,16 +277,19 @@ private:
 	void pushPSW();
 	void xthl();
 	void xchg();
-	
-	// flag helpers
-	int parity(int x, int size=8);
-	void auxCarry(uint16_t a, uint16_t b);
 
 
-	// get memory pos of HL
-	uint8_t& getHL();
+	// data reads and writes, everything but fetches goes through these
+	uint8_t load(uint16_t address);
+	void store(uint16_t address, uint8_t value);
+
+	// read and write memory pos of HL
+	uint8_t getHL();
+	void setHL(uint8_t value);
 
-	uint8_t& getNextByte();
+	// opcode at pc, and its operands too with the decode cache
+	uint8_t fetch();
+	uint8_t getNextByte();
 	uint16_t getNextAddress();
 
 };
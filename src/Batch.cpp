@@ -0,0 +1,102 @@
+#include "Batch.h"
+#include <algorithm>
+#include <exception>
+
+namespace p8080 {
+
+BatchRunner::BatchRunner(SharedImage rom, size_t count)
+	: instances(count)
+{
+	for (Instance& instance : instances) {
+		instance.machine.reset(new InvadersMachine(rom));
+	}
+}
+
+void BatchRunner::setScript(size_t instance, InputScript script)
+{
+	instances[instance].script = std::move(script);
+	instances[instance].nextStep = 0;
+}
+
+void BatchRunner::run(ThreadPool& pool, uint64_t n, uint64_t sliceFrames)
+{
+	sliceFrames = std::max<uint64_t>(sliceFrames, 1);
+	for (size_t i = 0; i < instances.size(); i++) {
+		Instance& instance = instances[i];
+		if (instance.result.status == Status::Error) {
+			continue;
+		}
+		instance.target = instance.machine->screen.frames + n;
+		pool.submit([this, &pool, i, sliceFrames] { runSlice(pool, i, sliceFrames); });
+	}
+	pool.wait();
+}
+
+void BatchRunner::runSlice(ThreadPool& pool, size_t index, uint64_t sliceFrames)
+{
+	Instance& instance = instances[index];
+	InvadersMachine& machine = *instance.machine;
+	uint64_t end = std::min(instance.target, machine.screen.frames + sliceFrames);
+
+	try {
+		while (machine.screen.frames < end && machine.cpu.status != Status::Error) {
+			// inputs only change on frame boundaries, run up to the next change
+			uint64_t until = end;
+			while (instance.nextStep < instance.script.size()) {
+				const InputStep& step = instance.script[instance.nextStep];
+				if (step.frame > machine.screen.frames) {
+					until = std::min(until, step.frame);
+					break;
+				}
+				machine.io.inputs[1] = step.port1;
+				machine.io.inputs[2] = step.port2;
+				instance.nextStep++;
+			}
+			machine.runFrames(until - machine.screen.frames);
+		}
+	} catch (const std::exception& e) {
+		// the cpu itself doesn't throw, but a device or the lazy flag check might
+		machine.cpu.status = Status::Error;
+		instance.result.error = e.what();
+	}
+
+	instance.result.frames = machine.screen.frames;
+	instance.result.cycles = machine.cpu.cycles;
+	instance.result.status = machine.cpu.status;
+	if (machine.cpu.status == Status::Error && instance.result.error.empty()) {
+		instance.result.error = machine.cpu.error ? machine.cpu.error : "unknown error";
+	}
+
+	if (machine.cpu.status != Status::Error && machine.screen.frames < instance.target) {
+		pool.submit([this, &pool, index, sliceFrames] { runSlice(pool, index, sliceFrames); });
+	}
+}
+
+uint64_t BatchRunner::totalFrames() const
+{
+	uint64_t total = 0;
+	for (const Instance& instance : instances) {
+		total += instance.result.frames;
+	}
+	return total;
+}
+
+uint64_t BatchRunner::totalCycles() const
+{
+	uint64_t total = 0;
+	for (const Instance& instance : instances) {
+		total += instance.result.cycles;
+	}
+	return total;
+}
+
+size_t BatchRunner::failed() const
+{
+	size_t count = 0;
+	for (const Instance& instance : instances) {
+		count += instance.result.status == Status::Error;
+	}
+	return count;
+}
+
+}
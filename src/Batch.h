@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "InvadersMachine.h"
+#include "ThreadPool.h"
+
+namespace p8080 {
+
+// from this frame on input ports 1 and 2 read these values
+struct InputStep {
+	uint64_t frame;
+	uint8_t port1;
+	uint8_t port2;
+};
+// sorted by frame
+typedef std::vector<InputStep> InputScript;
+
+struct BatchResult {
+	uint64_t frames = 0;
+	uint64_t cycles = 0;
+	Status status = Status::Running;
+	// set if the cpu stopped on an error or something threw
+	std::string error;
+};
+
+// a lot of independent machines run side by side on a ThreadPool, every
+// task runs one machine for a slice of frames and then queues the next
+// slice, so a machine never runs on two threads at once and a broken one
+// only stops itself
+class BatchRunner {
+public:
+	// every instance shares the one ROM image
+	BatchRunner(SharedImage rom, size_t instances);
+
+	void setScript(size_t instance, InputScript script);
+	InvadersMachine& machine(size_t instance) { return *instances[instance].machine; }
+	size_t size() const { return instances.size(); }
+
+	// run every instance for n more frames, sliceFrames at a time, and wait
+	// for all of them
+	void run(ThreadPool& pool, uint64_t n, uint64_t sliceFrames = 60);
+
+	const BatchResult& result(size_t instance) const { return instances[instance].result; }
+	uint64_t totalFrames() const;
+	uint64_t totalCycles() const;
+	size_t failed() const;
+
+private:
+	// own cache line each, workers write the results while others run
+	struct alignas(64) Instance {
+		std::unique_ptr<InvadersMachine> machine;
+		InputScript script;
+		size_t nextStep = 0;
+		uint64_t target = 0;
+		BatchResult result;
+	};
+
+	void runSlice(ThreadPool& pool, size_t instance, uint64_t sliceFrames);
+
+	std::vector<Instance> instances;
+};
+
+}
@@ -0,0 +1,152 @@
+#include "Bus.h"
+#include <stdexcept>
+
+namespace p8080 {
+
+namespace {
+	// nothing answers, the data lines float high
+	class OpenBus : public BusHandler {
+	public:
+		uint8_t read(uint16_t) override { return 0xff; }
+		void write(uint16_t, uint8_t) override {}
+	};
+
+	OpenBus openBus;
+
+	void checkRange(uint8_t page, unsigned count)
+	{
+		if (page + count > PAGE_COUNT) {
+			throw std::runtime_error("mapping goes past the end of the address space");
+		}
+	}
+}
+
+Bus::Bus()
+	: dirtyPages{}, watchedPages{}
+{
+	unmap(0, PAGE_COUNT);
+}
+
+uint8_t Bus::readSlow(uint16_t address) const
+{
+	return handlers[address >> 8]->read(address);
+}
+
+void Bus::writeSlow(uint16_t address, uint8_t value)
+{
+	unsigned page = address >> 8;
+	dirtyPages[page >> 6] |= uint64_t(1) << (page & 63);
+	if (protectedPages[page]) {
+		uint8_t* storage = protectedPages[page];
+		storage[address & 0xff] = value;
+		if (watchedPages[page]) {
+			// the observer may unwatch it, or remap it altogether
+			observer->pageWritten(*this, static_cast<uint8_t>(page));
+		}
+		if (!watchedPages[page] && protectedPages[page] == storage) {
+			// first write since protect(), back to plain RAM
+			writePages[page] = storage;
+			protectedPages[page] = nullptr;
+		}
+		return;
+	}
+	handlers[page]->write(address, value);
+}
+
+void Bus::watch(uint8_t page)
+{
+	watchedPages[page] = true;
+	if (writePages[page]) {
+		protectedPages[page] = writePages[page];
+		writePages[page] = nullptr;
+	}
+}
+
+void Bus::unwatch(uint8_t page)
+{
+	watchedPages[page] = false;
+	// still protected if it hasn't been written since protect()
+	if (protectedPages[page] && dirty(page)) {
+		writePages[page] = protectedPages[page];
+		protectedPages[page] = nullptr;
+	}
+}
+
+void Bus::mapped(uint8_t page, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++) {
+		watchedPages[page + i] = false;
+	}
+	if (observer) {
+		observer->pageMapped(*this, page, count);
+	}
+}
+
+void Bus::protect()
+{
+	for (unsigned page = 0; page < PAGE_COUNT; page++) {
+		if (writePages[page]) {
+			protectedPages[page] = writePages[page];
+			writePages[page] = nullptr;
+		}
+	}
+	for (uint64_t& bits : dirtyPages) {
+		bits = 0;
+	}
+}
+
+void Bus::mapRam(uint8_t page, unsigned count, uint8_t* storage)
+{
+	checkRange(page, count);
+	for (unsigned i = 0; i < count; i++) {
+		readPages[page + i] = storage + i * PAGE_SIZE;
+		writePages[page + i] = storage + i * PAGE_SIZE;
+		handlers[page + i] = &openBus;
+		protectedPages[page + i] = nullptr;
+	}
+	mapped(page, count);
+}
+
+void Bus::mapRom(uint8_t page, unsigned count, const uint8_t* storage, BusHandler* onWrite)
+{
+	checkRange(page, count);
+	for (unsigned i = 0; i < count; i++) {
+		readPages[page + i] = storage + i * PAGE_SIZE;
+		writePages[page + i] = nullptr;
+		handlers[page + i] = onWrite ? onWrite : &openBus;
+		protectedPages[page + i] = nullptr;
+	}
+	mapped(page, count);
+}
+
+void Bus::mapHandler(uint8_t page, unsigned count, BusHandler* handler)
+{
+	checkRange(page, count);
+	for (unsigned i = 0; i < count; i++) {
+		readPages[page + i] = nullptr;
+		writePages[page + i] = nullptr;
+		handlers[page + i] = handler;
+		protectedPages[page + i] = nullptr;
+	}
+	mapped(page, count);
+}
+
+void Bus::mapMirror(uint8_t page, unsigned count, uint8_t target)
+{
+	checkRange(page, count);
+	checkRange(target, count);
+	for (unsigned i = 0; i < count; i++) {
+		readPages[page + i] = readPages[target + i];
+		writePages[page + i] = writePages[target + i];
+		handlers[page + i] = handlers[target + i];
+		protectedPages[page + i] = protectedPages[target + i];
+	}
+	mapped(page, count);
+}
+
+void Bus::unmap(uint8_t page, unsigned count)
+{
+	mapHandler(page, count, &openBus);
+}
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+
+namespace p8080 {
+
+constexpr unsigned PAGE_SIZE  = 0x100;
+constexpr unsigned PAGE_COUNT = 0x100;
+
+// slow path for pages that are not plain memory, ROM write traps, device
+// registers and the like
+class BusHandler {
+public:
+	virtual ~BusHandler() = default;
+
+	virtual uint8_t read(uint16_t address) = 0;
+	virtual void write(uint16_t address, uint8_t value) = 0;
+};
+
+class Bus;
+
+// told when what the cpu sees in a page may have changed behind its back,
+// for anything that caches what's in memory, like translated code
+class BusObserver {
+public:
+	virtual ~BusObserver() = default;
+
+	// a watched page got written
+	virtual void pageWritten(Bus& bus, uint8_t page) = 0;
+	// pages got mapped to something else, watches on them are gone
+	virtual void pageMapped(Bus& bus, uint8_t page, unsigned count) = 0;
+};
+
+// 64K address space split in 256 byte pages, every page either points
+// straight at its storage or goes through a handler
+class Bus {
+public:
+	Bus();
+
+	uint8_t read(uint16_t address) const
+	{
+		const uint8_t* page = readPages[address >> 8];
+		if (page) {
+			return page[address & 0xff];
+		}
+		return readSlow(address);
+	}
+
+	void write(uint16_t address, uint8_t value)
+	{
+		uint8_t* page = writePages[address >> 8];
+		if (page) {
+			page[address & 0xff] = value;
+			return;
+		}
+		writeSlow(address, value);
+	}
+
+	// storage needs count * PAGE_SIZE bytes, page + count can't go over PAGE_COUNT
+	void mapRam(uint8_t page, unsigned count, uint8_t* storage);
+	// writes go to onWrite, or are dropped if there is none
+	void mapRom(uint8_t page, unsigned count, const uint8_t* storage, BusHandler* onWrite = nullptr);
+	// every access goes through handler
+	void mapHandler(uint8_t page, unsigned count, BusHandler* handler);
+	// pages behave like the count pages starting at target, as mapped right now
+	void mapMirror(uint8_t page, unsigned count, uint8_t target);
+	// reads return 0xff, writes are dropped
+	void unmap(uint8_t page, unsigned count);
+
+	const uint8_t* readPage(uint8_t page) const { return readPages[page]; }
+	uint8_t* writePage(uint8_t page) const { return writePages[page]; }
+	BusHandler* handler(uint8_t page) const { return handlers[page]; }
+
+	// dirty tracking, every write that takes the slow path marks its page.
+	// protect() clears the marks and sends the next write to every RAM page
+	// down the slow path once, after that the page is plain RAM again until
+	// the next protect(), so the fast path doesn't change at all. mapping
+	// a page drops its protection
+	void protect();
+	bool dirty(uint8_t page) const { return (dirtyPages[page >> 6] >> (page & 63)) & 1; }
+	// 64 pages per word, lowest page first
+	const uint64_t* dirtyMask() const { return dirtyPages; }
+
+	// writes to a watched RAM page always take the slow path and tell the
+	// observer, same trick as protect() but it stays until unwatch(). the
+	// watch is on the page and not what it shows, mirrors need their own
+	void setObserver(BusObserver* watcher) { observer = watcher; }
+	void watch(uint8_t page);
+	void unwatch(uint8_t page);
+	bool watched(uint8_t page) const { return watchedPages[page]; }
+	// plain RAM, even if writes are being trapped right now
+	bool writable(uint8_t page) const { return writePages[page] || protectedPages[page]; }
+
+	// the page tables themselves, for code that does its own lookups
+	const uint8_t* const* readTable() const { return readPages; }
+	uint8_t* const* writeTable() const { return writePages; }
+
+private:
+	// out of line so the fast path stays small enough to inline everywhere
+	uint8_t readSlow(uint16_t address) const;
+	void writeSlow(uint16_t address, uint8_t value);
+	void mapped(uint8_t page, unsigned count);
+
+	const uint8_t* readPages[PAGE_COUNT];
+	uint8_t* writePages[PAGE_COUNT];
+	BusHandler* handlers[PAGE_COUNT];
+	// where writePages points once the page's protection is lifted
+	uint8_t* protectedPages[PAGE_COUNT];
+	uint64_t dirtyPages[PAGE_COUNT / 64];
+	bool watchedPages[PAGE_COUNT];
+	BusObserver* observer = nullptr;
+};
+
+}
@@ -0,0 +1,411 @@
+#include "ControlFlow.h"
+#include <algorithm>
+#include <cstdio>
+
+#include "Dissasembler.h"
+
+namespace p8080 {
+
+namespace {
+	bool isJump(uint8_t op) { return op == 0xC3 || (op & 0xC7) == 0xC2; }
+	bool isCall(uint8_t op) { return op == 0xCD || (op & 0xC7) == 0xC4; }
+	bool isRst(uint8_t op) { return (op & 0xC7) == 0xC7; }
+	bool isReturn(uint8_t op) { return op == 0xC9 || (op & 0xC7) == 0xC0; }
+
+	// anything that ends a block
+	bool endsBlock(uint8_t op)
+	{
+		return isJump(op) || isCall(op) || isRst(op) || isReturn(op) || op == 0xE9 || op == 0x76;
+	}
+
+	// comes back to the next instruction, or can
+	bool fallsThrough(uint8_t op)
+	{
+		return op != 0xC3 && op != 0xC9 && op != 0xE9;
+	}
+
+	std::string hex(uint32_t value, int digits)
+	{
+		char text[16];
+		std::snprintf(text, sizeof(text), "%0*x", digits, static_cast<unsigned>(value));
+		return text;
+	}
+
+	const char* kindName(EdgeKind kind)
+	{
+		switch (kind) {
+			case EdgeKind::Fall: return "fall";
+			case EdgeKind::Jump: return "jump";
+			case EdgeKind::Call: return "call";
+		}
+		return "";
+	}
+}
+
+std::vector<uint16_t> ControlFlow::defaultEntries(uint16_t origin, size_t size)
+{
+	std::vector<uint16_t> entries;
+	for (uint32_t vector = 0; vector < 0x40; vector += 8) {
+		if (vector >= origin && vector - origin < size) {
+			entries.push_back(static_cast<uint16_t>(vector));
+		}
+	}
+	return entries;
+}
+
+ControlFlow::ControlFlow(const uint8_t* code, size_t size, uint16_t origin)
+	: ControlFlow(code, size, origin, defaultEntries(origin, size))
+{
+}
+
+ControlFlow::ControlFlow(const uint8_t* code, size_t size, uint16_t origin, const std::vector<uint16_t>& entries)
+	: code(code), size(std::min<size_t>(size, 0x10000 - origin)), origin(origin),
+	  bytes(this->size, DATA), leader(this->size), target(0x10000), routine(0x10000)
+{
+	for (uint16_t entry : entries) {
+		if (!routine[entry]) {
+			entryList.push_back(entry);
+		}
+		routine[entry] = true;
+		target[entry] = true;
+		trace(entry);
+	}
+	// an entry that lands inside something else's instruction isn't one
+	for (uint32_t address = 0; address < 0x10000; address++) {
+		if (routine[address] && instructionAt(static_cast<uint16_t>(address))) {
+			routineList.push_back(static_cast<uint16_t>(address));
+		}
+	}
+	std::sort(externalList.begin(), externalList.end());
+	externalList.erase(std::unique(externalList.begin(), externalList.end()), externalList.end());
+	std::sort(conflictList.begin(), conflictList.end());
+	conflictList.erase(std::unique(conflictList.begin(), conflictList.end()), conflictList.end());
+	findBlocks();
+}
+
+// follows one path until it ends or runs into code that's already been
+// seen, every branch off it goes on a stack for later instead of recursing
+void ControlFlow::trace(uint16_t start)
+{
+	std::vector<uint16_t> pending = {start};
+	while (!pending.empty()) {
+		uint32_t address = pending.back();
+		pending.pop_back();
+		if (!inside(address)) {
+			externalList.push_back(static_cast<uint16_t>(address));
+			continue;
+		}
+		leader[address - origin] = true;
+		for (;;) {
+			size_t at = address - origin;
+			if (bytes[at] == OPCODE) {
+				break;
+			}
+			uint8_t op = code[at];
+			size_t length = dissasemble::length(op);
+			bool clear = at + length <= size;
+			for (size_t i = 0; clear && i < length; i++) {
+				clear = bytes[at + i] == DATA;
+			}
+			if (!clear) {
+				// lands in an instruction, or the image ends halfway through one
+				if (bytes[at] == OPERAND) {
+					conflictList.push_back(static_cast<uint16_t>(address));
+				}
+				break;
+			}
+			bytes[at] = OPCODE;
+			for (size_t i = 1; i < length; i++) {
+				bytes[at + i] = OPERAND;
+			}
+
+			uint16_t next = static_cast<uint16_t>(address + length);
+			uint16_t to = 0;
+			if (isJump(op) || isCall(op)) {
+				to = static_cast<uint16_t>(code[at + 1] | code[at + 2] << 8);
+			} else if (isRst(op)) {
+				to = op & 0x38;
+			}
+			if (isJump(op) || isCall(op) || isRst(op)) {
+				target[to] = true;
+				if (!isJump(op)) {
+					routine[to] = true;
+				}
+				pending.push_back(to);
+			}
+			if (!endsBlock(op)) {
+				address = next;
+				if (inside(address)) {
+					continue;
+				}
+			} else if (fallsThrough(op)) {
+				// runs on after it, but as a block of its own
+				pending.push_back(next);
+			}
+			break;
+		}
+	}
+}
+
+void ControlFlow::findBlocks()
+{
+	BasicBlock* block = nullptr;
+	for (size_t at = 0; at < size; at++) {
+		if (bytes[at] != OPCODE) {
+			if (bytes[at] == DATA) {
+				block = nullptr;
+			}
+			continue;
+		}
+		uint16_t address = static_cast<uint16_t>(origin + at);
+		if (!block || leader[at]) {
+			if (block) {
+				// ends without a jump, because something jumps in after it
+				block->successors.push_back({address, EdgeKind::Fall});
+			}
+			blockList.push_back({address, 0, 0, 0, {}});
+			block = &blockList.back();
+		}
+		uint8_t op = code[at];
+		block->instructions++;
+		block->last = op;
+		block->end = static_cast<uint32_t>(origin + at + dissasemble::length(op));
+		if (endsBlock(op)) {
+			if (isJump(op) || isCall(op)) {
+				uint16_t to = static_cast<uint16_t>(code[at + 1] | code[at + 2] << 8);
+				block->successors.push_back({to, isJump(op) ? EdgeKind::Jump : EdgeKind::Call});
+			} else if (isRst(op)) {
+				block->successors.push_back({static_cast<uint16_t>(op & 0x38), EdgeKind::Call});
+			}
+			if (fallsThrough(op) && block->end < 0x10000) {
+				block->successors.push_back({static_cast<uint16_t>(block->end), EdgeKind::Fall});
+			}
+			block = nullptr;
+		}
+	}
+}
+
+const BasicBlock* ControlFlow::blockAt(uint16_t address) const
+{
+	auto after = std::upper_bound(blockList.begin(), blockList.end(), address,
+		[](uint16_t at, const BasicBlock& block) { return at < block.start; });
+	if (after == blockList.begin()) {
+		return nullptr;
+	}
+	const BasicBlock& block = *(after - 1);
+	return address < block.end ? &block : nullptr;
+}
+
+bool ControlFlow::instructionAt(uint16_t address) const
+{
+	return inside(address) && bytes[address - origin] == OPCODE;
+}
+
+bool ControlFlow::codeAt(uint16_t address) const
+{
+	return inside(address) && bytes[address - origin] != DATA;
+}
+
+std::vector<const BasicBlock*> ControlFlow::routineBlocks(uint16_t entry) const
+{
+	std::vector<const BasicBlock*> found;
+	std::vector<bool> seen(blockList.size());
+	std::vector<uint16_t> pending = {entry};
+	while (!pending.empty()) {
+		uint16_t at = pending.back();
+		pending.pop_back();
+		// conflicts land inside a block, they don't start one
+		const BasicBlock* block = blockAt(at);
+		if (!block || block->start != at) {
+			continue;
+		}
+		size_t index = static_cast<size_t>(block - blockList.data());
+		if (seen[index]) {
+			continue;
+		}
+		seen[index] = true;
+		found.push_back(block);
+		for (const Edge& edge : block->successors) {
+			if (edge.kind != EdgeKind::Call) {
+				pending.push_back(edge.target);
+			}
+		}
+	}
+	std::sort(found.begin(), found.end(), [](const BasicBlock* a, const BasicBlock* b) { return a->start < b->start; });
+	return found;
+}
+
+std::string ControlFlow::label(uint16_t address) const
+{
+	bool entry = std::find(entryList.begin(), entryList.end(), address) != entryList.end();
+	if (entry && address == 0) {
+		return "reset";
+	}
+	if (entry && address < 0x40 && address % 8 == 0) {
+		return "rst" + std::to_string(address / 8);
+	}
+	if (routine[address]) {
+		return "sub_" + hex(address, 4);
+	}
+	if (target[address]) {
+		return "loc_" + hex(address, 4);
+	}
+	return std::string();
+}
+
+size_t ControlFlow::codeBytes() const
+{
+	return static_cast<size_t>(std::count_if(bytes.begin(), bytes.end(), [](uint8_t b) { return b != DATA; }));
+}
+
+void ControlFlow::listing(std::string& out) const
+{
+	char text[dissasemble::TEXT_SIZE];
+	size_t at = 0;
+	while (at < size) {
+		uint16_t address = static_cast<uint16_t>(origin + at);
+		if (bytes[at] == OPCODE) {
+			std::string name = label(address);
+			if (!name.empty()) {
+				out += name;
+				out += ":\n";
+			}
+			dissasemble::Instruction instruction = dissasemble::decode(code, size, at);
+			dissasemble::format(instruction, text);
+			out += hex(address, 4);
+			out += ' ';
+			out += text;
+			out += '\n';
+			at += instruction.size;
+			continue;
+		}
+		// DB lines of up to 8, broken where code starts
+		out += hex(address, 4);
+		out += " DB     ";
+		for (size_t count = 0; count < 8 && at < size && bytes[at] != OPCODE; count++, at++) {
+			if (count) {
+				out += ", ";
+			}
+			out += '$';
+			out += hex(code[at], 2);
+		}
+		out += '\n';
+	}
+}
+
+std::string ControlFlow::blockText(const BasicBlock& block) const
+{
+	std::string text;
+	char line[dissasemble::TEXT_SIZE];
+	for (uint32_t address = block.start; address < block.end;) {
+		dissasemble::Instruction instruction = dissasemble::decode(code, size, address - origin);
+		dissasemble::format(instruction, line);
+		text += hex(address, 4) + " " + line + "\\l";
+		address += instruction.size;
+	}
+	return text;
+}
+
+void ControlFlow::writeDot(std::ostream& out) const
+{
+	out << "digraph cfg {\n";
+	out << "\tnode [shape=box fontname=monospace];\n";
+	for (const BasicBlock& block : blockList) {
+		std::string name = label(block.start);
+		out << "\tb" << hex(block.start, 4) << " [label=\"";
+		if (!name.empty()) {
+			out << name << ":\\l";
+		}
+		out << blockText(block) << "\"";
+		if (routine[block.start]) {
+			out << " peripheries=2";
+		}
+		out << "];\n";
+	}
+	for (const BasicBlock& block : blockList) {
+		for (const Edge& edge : block.successors) {
+			out << "\tb" << hex(block.start, 4) << " -> ";
+			if (blockAt(edge.target)) {
+				out << "b" << hex(edge.target, 4);
+			} else {
+				// outside the image or into a conflict, gets a node of its own
+				out << "\"" << hex(edge.target, 4) << "\"";
+			}
+			if (edge.kind == EdgeKind::Fall) {
+				out << " [style=dashed]";
+			} else if (edge.kind == EdgeKind::Call) {
+				out << " [style=dotted]";
+			}
+			out << ";\n";
+		}
+	}
+	out << "}\n";
+}
+
+void ControlFlow::writeJson(std::ostream& out) const
+{
+	auto list = [&](const std::vector<uint16_t>& values) {
+		out << '[';
+		for (size_t i = 0; i < values.size(); i++) {
+			out << (i ? ", " : "") << values[i];
+		}
+		out << ']';
+	};
+
+	out << "{\n";
+	out << "\t\"origin\": " << origin << ",\n";
+	out << "\t\"size\": " << size << ",\n";
+	out << "\t\"code_bytes\": " << codeBytes() << ",\n";
+	out << "\t\"entries\": ";
+	list(entryList);
+	out << ",\n\t\"external\": ";
+	list(externalList);
+	out << ",\n\t\"conflicts\": ";
+	list(conflictList);
+
+	out << ",\n\t\"routines\": [";
+	for (size_t i = 0; i < routineList.size(); i++) {
+		uint16_t entry = routineList[i];
+		out << (i ? "," : "") << "\n\t\t{\"address\": " << entry << ", \"label\": \"" << label(entry) << "\", \"blocks\": [";
+		std::vector<const BasicBlock*> blocks = routineBlocks(entry);
+		for (size_t j = 0; j < blocks.size(); j++) {
+			out << (j ? ", " : "") << blocks[j]->start;
+		}
+		out << "]}";
+	}
+	out << "\n\t],\n";
+
+	out << "\t\"blocks\": [";
+	for (size_t i = 0; i < blockList.size(); i++) {
+		const BasicBlock& block = blockList[i];
+		out << (i ? "," : "") << "\n\t\t{\"start\": " << block.start << ", \"end\": " << block.end
+			<< ", \"instructions\": " << block.instructions << ", \"label\": \"" << label(block.start)
+			<< "\", \"successors\": [";
+		for (size_t j = 0; j < block.successors.size(); j++) {
+			const Edge& edge = block.successors[j];
+			out << (j ? ", " : "") << "{\"address\": " << edge.target << ", \"kind\": \"" << kindName(edge.kind) << "\"}";
+		}
+		out << "]}";
+	}
+	out << "\n\t],\n";
+
+	// runs of bytes nothing reaches
+	out << "\t\"data\": [";
+	bool first = true;
+	for (size_t at = 0; at < size;) {
+		if (bytes[at] != DATA) {
+			at++;
+			continue;
+		}
+		size_t end = at;
+		while (end < size && bytes[end] == DATA) {
+			end++;
+		}
+		out << (first ? "" : ",") << "\n\t\t{\"start\": " << origin + at << ", \"end\": " << origin + end << "}";
+		first = false;
+		at = end;
+	}
+	out << "\n\t]\n}\n";
+}
+
+}
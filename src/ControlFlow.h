@@ -0,0 +1,116 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace p8080 {
+
+// how a basic block hands over to the one after it
+enum class EdgeKind : uint8_t {
+	// on into the next instruction, also what comes back after a CALL, RST,
+	// conditional RET or HLT
+	Fall,
+	// JMP, or a conditional jump when it's taken
+	Jump,
+	// CALL or RST into a subroutine
+	Call,
+};
+
+struct Edge {
+	uint16_t target;
+	EdgeKind kind;
+};
+
+struct BasicBlock {
+	uint16_t start;
+	// one past the last byte, can be 0x10000
+	uint32_t end;
+	uint32_t instructions;
+	// opcode of the instruction that ends it
+	uint8_t last;
+	// RET and PCHL have none, where they go isn't known from the code
+	std::vector<Edge> successors;
+};
+
+// recursive traversal of a ROM image, code is only what can be reached
+// from the entry points following JMP, CALL, RST and conditional jumps,
+// everything else is data. calls are taken to come back, PCHL and jump
+// tables aren't followed, extra entries can be handed in for those
+//
+// blocks end at the first jump, call, return, RST, PCHL or HLT, like the
+// JIT's, and wherever a jump lands, so they're the same units the JIT and
+// the decode cache work on. a jump into the middle of an instruction that's
+// already been decoded is not followed and ends up in conflicts()
+class ControlFlow {
+public:
+	// reset and every RST vector the image covers
+	static std::vector<uint16_t> defaultEntries(uint16_t origin, size_t size);
+
+	// code is mapped at origin, anything past the 64K address space is ignored
+	ControlFlow(const uint8_t* code, size_t size, uint16_t origin = 0);
+	ControlFlow(const uint8_t* code, size_t size, uint16_t origin, const std::vector<uint16_t>& entries);
+
+	// sorted on start
+	const std::vector<BasicBlock>& blocks() const { return blockList; }
+	// block the byte at address belongs to, nullptr for data
+	const BasicBlock* blockAt(uint16_t address) const;
+	// first byte of an instruction that can be reached
+	bool instructionAt(uint16_t address) const;
+	// any byte of one
+	bool codeAt(uint16_t address) const;
+
+	const std::vector<uint16_t>& entries() const { return entryList; }
+	// entries and every CALL and RST target that start an instruction in
+	// the image, sorted
+	const std::vector<uint16_t>& routines() const { return routineList; }
+	// jumps and calls that land outside the image, sorted
+	const std::vector<uint16_t>& external() const { return externalList; }
+	// jumps and calls into the middle of an instruction, sorted
+	const std::vector<uint16_t>& conflicts() const { return conflictList; }
+	// blocks of the routine at entry, reached without going through a call
+	std::vector<const BasicBlock*> routineBlocks(uint16_t entry) const;
+
+	// reset, rst1 to rst7, sub_0ada for routines, loc_0ade for what else
+	// gets jumped to, empty for anything else
+	std::string label(uint16_t address) const;
+	size_t codeBytes() const;
+
+	// code as instructions under their labels, data as DB lines, appended
+	// to out in the same "address text" form as dissasemble::listing()
+	void listing(std::string& out) const;
+	// one node per block with its instructions, routines drawn double
+	void writeDot(std::ostream& out) const;
+	void writeJson(std::ostream& out) const;
+
+private:
+	enum Byte : uint8_t {
+		DATA,
+		OPCODE,
+		OPERAND,
+	};
+
+	bool inside(uint32_t address) const { return address >= origin && address - origin < size; }
+	void trace(uint16_t address);
+	void findBlocks();
+	std::string blockText(const BasicBlock& block) const;
+
+	const uint8_t* code;
+	size_t size;
+	uint16_t origin;
+	// per byte of the image
+	std::vector<uint8_t> bytes;
+	std::vector<bool> leader;
+	// per address, something jumps, calls or starts there
+	std::vector<bool> target;
+	std::vector<bool> routine;
+
+	std::vector<BasicBlock> blockList;
+	std::vector<uint16_t> entryList;
+	std::vector<uint16_t> routineList;
+	std::vector<uint16_t> externalList;
+	std::vector<uint16_t> conflictList;
+};
+
+}
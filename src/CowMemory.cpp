@@ -0,0 +1,119 @@
+#include "CowMemory.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace p8080 {
+
+CowMemory::CowMemory(Bus& bus)
+	: bus(&bus)
+{
+}
+
+void CowMemory::map(uint8_t page, unsigned count, SharedImage image, size_t offset)
+{
+	if (!image || offset + count * PAGE_SIZE > image->size()) {
+		throw std::runtime_error("image is too small for the mapping");
+	}
+	for (unsigned i = 0; i < count; i++) {
+		const uint8_t* source = image->data() + offset + i * PAGE_SIZE;
+		// mirrors of the old page follow it to the new one
+		const uint8_t* old = owned[page + i] ? owned[page + i].get() : shared[page + i];
+		if (old) {
+			remap(old, source, true);
+		}
+		bus->mapRom(static_cast<uint8_t>(page + i), 1, source, this);
+		shared[page + i] = source;
+		if (owned[page + i]) {
+			owned[page + i].reset();
+			copies--;
+		}
+	}
+	images.push_back(std::move(image));
+
+	// let go of images nothing reads from anymore
+	images.erase(std::remove_if(images.begin(), images.end(), [this](const SharedImage& old) {
+		const uint8_t* begin = old->data();
+		const uint8_t* end = begin + old->size();
+		return std::none_of(std::begin(shared), std::end(shared), [=](const uint8_t* p) {
+			return p >= begin && p < end;
+		});
+	}), images.end());
+}
+
+void CowMemory::reset()
+{
+	for (unsigned page = 0; page < PAGE_COUNT; page++) {
+		drop(static_cast<uint8_t>(page));
+	}
+}
+
+void CowMemory::drop(uint8_t page)
+{
+	if (owned[page]) {
+		remap(owned[page].get(), shared[page], true);
+		owned[page].reset();
+		copies--;
+	}
+}
+
+uint8_t CowMemory::read(uint16_t address)
+{
+	// never gets here, reads always have a page to go to
+	return bus->read(address);
+}
+
+void CowMemory::write(uint16_t address, uint8_t value)
+{
+	// a mirror of a shared page ends up here with its own address, find the
+	// page it mirrors so every view of it gets the same copy
+	const uint8_t* source = bus->readPage(static_cast<uint8_t>(address >> 8));
+	unsigned page = address >> 8;
+	if (shared[page] != source) {
+		for (page = 0; page < PAGE_COUNT && shared[page] != source; page++) {
+		}
+		if (page == PAGE_COUNT) {
+			return;
+		}
+	}
+
+	copy(page);
+	bus->write(address, value);
+}
+
+uint8_t* CowMemory::own(uint8_t page)
+{
+	if (!shared[page]) {
+		throw std::runtime_error("page isn't mapped copy on write");
+	}
+	return owned[page] ? owned[page].get() : copy(page);
+}
+
+uint8_t* CowMemory::copy(unsigned page)
+{
+	owned[page].reset(new uint8_t[PAGE_SIZE]);
+	std::memcpy(owned[page].get(), shared[page], PAGE_SIZE);
+	copies++;
+	remap(shared[page], owned[page].get(), false);
+	return owned[page].get();
+}
+
+void CowMemory::remap(const uint8_t* from, const uint8_t* to, bool isShared)
+{
+	// every page showing from, the page itself and its mirrors, shows to
+	// instead, as RAM if to is a copy and through here if it's shared
+	for (unsigned other = 0; other < PAGE_COUNT; other++) {
+		uint8_t p = static_cast<uint8_t>(other);
+		if (bus->readPage(p) != from) {
+			continue;
+		}
+		if (isShared) {
+			bus->mapRom(p, 1, to, this);
+		} else if (bus->handler(p) == this) {
+			bus->mapRam(p, 1, const_cast<uint8_t*>(to));
+		}
+	}
+}
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Bus.h"
+
+namespace p8080 {
+
+// read only memory that any number of machines can point at
+typedef std::shared_ptr<const std::vector<uint8_t>> SharedImage;
+
+// pages that read straight out of a SharedImage until the first write, which
+// gives this machine its own copy of just that page, so a thousand machines
+// started from the same image only pay for the pages they actually touch
+class CowMemory : public BusHandler {
+public:
+	explicit CowMemory(Bus& bus);
+	CowMemory(const CowMemory&) = delete;
+	CowMemory& operator=(const CowMemory&) = delete;
+
+	// count pages starting at page read from image at offset, which needs
+	// count * PAGE_SIZE bytes past it. copies get remapped everywhere the
+	// shared page shows up, so mirrors keep working, and mapping over pages
+	// already here drops their copies
+	void map(uint8_t page, unsigned count, SharedImage image, size_t offset = 0);
+	// throw away every copy and go back to reading the images
+	void reset();
+
+	// pages that got their own copy
+	unsigned copied() const { return copies; }
+	bool isCopied(uint8_t page) const { return owned[page] != nullptr; }
+	// this machine's copy of a mapped page, made now if there isn't one
+	uint8_t* own(uint8_t page);
+	// throw away the copy of one page, if there is one
+	void drop(uint8_t page);
+
+	uint8_t read(uint16_t address) override;
+	// first write to a page, copies it and remaps it as RAM
+	void write(uint16_t address, uint8_t value) override;
+
+private:
+	uint8_t* copy(unsigned page);
+	void remap(const uint8_t* from, const uint8_t* to, bool isShared);
+
+	Bus* bus;
+	std::vector<SharedImage> images;
+	const uint8_t* shared[PAGE_COUNT] = {};
+	std::unique_ptr<uint8_t[]> owned[PAGE_COUNT];
+	unsigned copies = 0;
+};
+
+}
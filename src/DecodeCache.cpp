@@ -0,0 +1,102 @@
+#include "DecodeCache.h"
+#include <cstring>
+
+#include "8080.h"
+
+namespace p8080 {
+
+DecodeCache::DecodeCache()
+	: entries(new Decoded[0x10000]())
+{
+}
+
+Decoded DecodeCache::decode(Bus& bus, uint16_t pc)
+{
+	Decoded entry;
+	entry.opcode = bus.read(pc);
+	entry.length = LENGTH[entry.opcode];
+	uint8_t lo = entry.length > 1 ? bus.read(static_cast<uint16_t>(pc + 1)) : 0;
+	uint8_t hi = entry.length > 2 ? bus.read(static_cast<uint16_t>(pc + 2)) : 0;
+	entry.operand = static_cast<uint16_t>(lo | (hi << 8));
+
+	uint8_t page = static_cast<uint8_t>(pc >> 8);
+	const uint8_t* shows = bus.readPage(page);
+	if (!shows || (pc & 0xffu) + entry.length > PAGE_SIZE) {
+		// handler reads can change every time, and a write to the next page
+		// wouldn't clear this one
+		return entry;
+	}
+	if (storage[page] != shows) {
+		dropPage(page);
+		storage[page] = shows;
+	}
+	if (bus.writable(page) && !ramCode[page]) {
+		// every page showing the same RAM, mirrors included
+		ramCode[page] = true;
+		for (unsigned p = 0; p < PAGE_COUNT; p++) {
+			if (bus.readPage(static_cast<uint8_t>(p)) == shows) {
+				bus.watch(static_cast<uint8_t>(p));
+			}
+		}
+	}
+	entries[pc] = entry;
+	return entry;
+}
+
+void DecodeCache::dropPage(unsigned page)
+{
+	std::memset(&entries[page << 8], 0, PAGE_SIZE * sizeof(Decoded));
+	storage[page] = nullptr;
+	ramCode[page] = false;
+}
+
+void DecodeCache::invalidateRam(Bus& bus)
+{
+	for (unsigned page = 0; page < PAGE_COUNT; page++) {
+		if (ramCode[page]) {
+			dropPage(page);
+		}
+		if (bus.watched(static_cast<uint8_t>(page))) {
+			bus.unwatch(static_cast<uint8_t>(page));
+		}
+	}
+}
+
+void DecodeCache::pageWritten(Bus& bus, uint8_t page)
+{
+	const uint8_t* written = bus.readPage(page);
+	for (unsigned p = 0; p < PAGE_COUNT; p++) {
+		if (ramCode[p] && storage[p] == written) {
+			dropPage(p);
+		}
+	}
+	for (unsigned p = 0; p < PAGE_COUNT; p++) {
+		if (bus.watched(static_cast<uint8_t>(p)) && bus.readPage(static_cast<uint8_t>(p)) == written) {
+			bus.unwatch(static_cast<uint8_t>(p));
+		}
+	}
+}
+
+void DecodeCache::pageMapped(Bus& bus, uint8_t page, unsigned count)
+{
+	for (unsigned p = page; p < page + count; p++) {
+		if (storage[p]) {
+			dropPage(p);
+		}
+	}
+	// a new mirror of RAM that has entries needs a watch of its own
+	for (unsigned p = page; p < page + count; p++) {
+		const uint8_t* shows = bus.readPage(static_cast<uint8_t>(p));
+		if (!shows) {
+			continue;
+		}
+		for (unsigned q = 0; q < PAGE_COUNT; q++) {
+			if (ramCode[q] && storage[q] == shows) {
+				bus.watch(static_cast<uint8_t>(p));
+				break;
+			}
+		}
+	}
+}
+
+}
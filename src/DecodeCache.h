@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+
+#include "Bus.h"
+
+namespace p8080 {
+
+// an instruction as the interpreter would fetch it, 4 bytes so the whole
+// address space fits in 256K
+struct Decoded {
+	uint8_t opcode;
+	// bytes including the opcode, 0 for an entry that isn't decoded yet
+	uint8_t length;
+	// immediate or address, low byte first like in memory
+	uint16_t operand;
+};
+
+// decode-once cache for the interpreter, only built with -DP8080_DECODE_CACHE
+//
+// one entry per address, filled the first time pc gets there, so fetching
+// an instruction with its operands is a single load instead of up to three
+// trips through the bus. handler pages and instructions that run into the
+// next page are decoded every time and never stored
+//
+// entries from RAM pages get the page watched on the bus like the JIT does,
+// a write through it or a remap throws away the whole page
+class DecodeCache : public BusObserver {
+public:
+	DecodeCache();
+
+	Decoded fetch(Bus& bus, uint16_t pc)
+	{
+		Decoded entry = entries[pc];
+		if (entry.length) {
+			return entry;
+		}
+		return decode(bus, pc);
+	}
+
+	// forget every page that came from RAM, for when memory changed without
+	// going through the bus, like restoring a save state
+	void invalidateRam(Bus& bus);
+
+	void pageWritten(Bus& bus, uint8_t page) override;
+	void pageMapped(Bus& bus, uint8_t page, unsigned count) override;
+
+private:
+	Decoded decode(Bus& bus, uint16_t pc);
+	void dropPage(unsigned page);
+
+	std::unique_ptr<Decoded[]> entries;
+	// what each page with entries showed when they were decoded
+	const uint8_t* storage[PAGE_COUNT] = {};
+	bool ramCode[PAGE_COUNT] = {};
+};
+
+}
@@ -1,378 +1,256 @@
 #include "Dissasembler.h"
-#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <stdexcept>
-#include <iostream>
-#include <iomanip>
-
-#if defined DEBUG || defined _DEBUG
-	#define LOG_TRACE(x) std::cout << x;
-#else
-	#define LOG_TRACE(x)
-#endif
 
+#include "ThreadPool.h"
 
 namespace {
-	template<typename ... Args>
-	std::string format(const std::string& format, Args ... args) {
-		// get string size
-		int opcode_size = std::snprintf(nullptr, 0, format.c_str(), args ...) + 1;
-		if (opcode_size <= 0) { 
-			throw std::runtime_error("Error during formatting."); 
-		}
-		size_t size = static_cast<size_t>(opcode_size);
-		// create buffer
-		char* buffer = new char[size];
-		// fill buffer
-		std::snprintf(buffer, size, format.c_str(), args ...);
+	constexpr char HEX[] = "0123456789abcdef";
 
-		// convert char* to std string
-		std::string res = std::string(buffer, buffer + size - 1);
-		// free memory
-		delete buffer;
-		return res;
-	}
-
-	OpcodeData makeOpcode(const char* opcode, const char* argPrefix) 
+	// hex digits in an address, never fewer than 4
+	int digits(size_t address)
 	{
-		std::string symbol = format("%-7s%s", opcode, argPrefix);
-		return {symbol, 1};
+		int count = 4;
+		while (count < 16 && address >> (count * 4)) {
+			count++;
+		}
+		return count;
 	}
 
-	OpcodeData makeOpcode2b(const char* opcode, const char* argPrefix, uint8_t data)
+	// what format() writes for every opcode, with the operand digits left
+	// for it to fill in
+	struct Templates {
+		char text[256][dissasemble::TEXT_SIZE];
+		uint8_t length[256];
+		// where the operand's first hex digit goes
+		uint8_t operand[256];
+
+		constexpr Templates() : text(), length(), operand()
+		{
+			using namespace dissasemble;
+			for (unsigned op = 0; op < 256; op++) {
+				const Mnemonic& mnemonic = MNEMONICS[op];
+				char* at = text[op];
+				unsigned used = 0;
+				for (const char* c = mnemonic.name; *c; c++) {
+					at[used++] = *c;
+				}
+				if (*mnemonic.args || mnemonic.operand != Operand::None) {
+					// mnemonics line up in a 7 wide column
+					while (used < 7) {
+						at[used++] = ' ';
+					}
+					for (const char* c = mnemonic.args; *c; c++) {
+						at[used++] = *c;
+					}
+				}
+				if (mnemonic.operand != Operand::None) {
+					at[used++] = '$';
+					operand[op] = static_cast<uint8_t>(used);
+					used += 2 * (dissasemble::length(static_cast<uint8_t>(op)) - 1);
+				}
+				length[op] = static_cast<uint8_t>(used);
+			}
+		}
+	};
+	constexpr Templates TEMPLATES;
+
+	// the text without a terminator, TEMPLATES.length[opcode] bytes of it.
+	// with room for TEXT_SIZE at out it's one fixed size copy, the bytes
+	// past the text are garbage
+	inline void text(const dissasemble::Instruction& instruction, char* out, bool room)
 	{
-		std::string symbol = format("%-7s%s$%02x", opcode, argPrefix, data);
-		return {symbol, 2};
+		uint8_t op = instruction.opcode;
+		if (room) {
+			std::memcpy(out, TEMPLATES.text[op], dissasemble::TEXT_SIZE);
+		} else {
+			std::memcpy(out, TEMPLATES.text[op], TEMPLATES.length[op]);
+		}
+		char* digits = out + TEMPLATES.operand[op];
+		switch (instruction.operand) {
+			case dissasemble::Operand::None:
+				break;
+			case dissasemble::Operand::Byte:
+				digits[0] = HEX[(instruction.immediate >> 4) & 0xf];
+				digits[1] = HEX[instruction.immediate & 0xf];
+				break;
+			case dissasemble::Operand::Word:
+				digits[0] = HEX[instruction.immediate >> 12];
+				digits[1] = HEX[(instruction.immediate >> 8) & 0xf];
+				digits[2] = HEX[(instruction.immediate >> 4) & 0xf];
+				digits[3] = HEX[instruction.immediate & 0xf];
+				break;
+		}
 	}
 
-	OpcodeData makeOpcode4b(const char* opcode, const char* argPrefix, uint8_t dataHigh, uint8_t dataLow)
+	// where a walk over the code on opcode sizes alone leaves off, and what
+	// the listing for it comes to
+	struct Walk {
+		size_t exit;
+		size_t instructions;
+		size_t bytes;
+	};
+
+	// walks from every one of starts up to end at once. walks that land on
+	// the same instruction go the same way from there, so when two meet one
+	// of them only keeps what it has over the other and stops
+	template<size_t N>
+	void walk(const uint8_t* code, size_t end, size_t origin, const size_t (&starts)[N], Walk (&walks)[N])
 	{
-		std::string symbol = format("%-7s%s$%02x%02x", opcode, argPrefix, dataHigh, dataLow);
-		return {symbol, 3};
+		size_t pcs[N];
+		// the walk each one follows, itself until it meets another
+		size_t follows[N];
+		for (size_t i = 0; i < N; i++) {
+			pcs[i] = starts[i];
+			follows[i] = i;
+			walks[i] = {0, 0, 0};
+		}
+		// every address has as many digits unless it's a chunk that crosses
+		// into more of them
+		int fixed = digits(origin + starts[0]) == digits(origin + end + 2) ? digits(origin + starts[0]) : 0;
+		for (;;) {
+			// the one furthest behind moves, so it can't jump over another
+			size_t next = N;
+			for (size_t i = 0; i < N; i++) {
+				if (follows[i] == i && pcs[i] < end && (next == N || pcs[i] < pcs[next])) {
+					next = i;
+				}
+			}
+			if (next == N) {
+				break;
+			}
+			uint8_t op = code[pcs[next]];
+			walks[next].instructions++;
+			walks[next].bytes += static_cast<size_t>(fixed ? fixed : digits(origin + pcs[next])) + 2 + TEMPLATES.length[op];
+			pcs[next] += dissasemble::length(op);
+			for (size_t i = 0; i < N; i++) {
+				if (i != next && follows[i] == i && pcs[i] == pcs[next]) {
+					// can wrap round, it's only ever added back to what i comes to
+					follows[next] = i;
+					walks[next].instructions -= walks[i].instructions;
+					walks[next].bytes -= walks[i].bytes;
+					break;
+				}
+			}
+		}
+		Walk totals[N];
+		for (size_t i = 0; i < N; i++) {
+			size_t at = i;
+			totals[i] = walks[i];
+			while (follows[at] != at) {
+				at = follows[at];
+				totals[i].instructions += walks[at].instructions;
+				totals[i].bytes += walks[at].bytes;
+			}
+			totals[i].exit = pcs[at];
+		}
+		std::copy(totals, totals + N, walks);
 	}
 
-
-	OpcodeData opcodeNotFound()
+	// lines for the instructions that start from pc up to end, operands
+	// can run on past end up to size. nothing gets written at or past limit
+	char* listRange(const uint8_t* code, size_t size, size_t pc, size_t end, size_t origin, char* at, char* limit)
 	{
-	#ifdef THROW_ON_UNSUPPORTED_OPCODE
-		throw std::runtime_error("unsupported opcode");
-	#endif//THROW_ON_UNSUPPORTED_OPCODE
-	
-	return {"NOP", 1};
+		using namespace dissasemble;
+		while (pc < end) {
+			Instruction instruction = decode(code, size, pc);
+			size_t address = origin + pc;
+			for (int shift = (digits(address) - 1) * 4; shift >= 0; shift -= 4) {
+				*at++ = HEX[(address >> shift) & 0xf];
+			}
+			*at++ = ' ';
+			text(instruction, at, limit - at >= static_cast<std::ptrdiff_t>(TEXT_SIZE));
+			at += TEMPLATES.length[instruction.opcode];
+			*at++ = '\n';
+			pc += instruction.size;
+		}
+		return at;
 	}
 }
 
 
-OpcodeData dissasemble::dissasemble(std::vector<uint8_t>& code, int pc)
+size_t dissasemble::format(const Instruction& instruction, char* out)
 {
+	text(instruction, out, true);
+	size_t length = TEMPLATES.length[instruction.opcode];
+	out[length] = '\0';
+	return length;
+}
 
-	OpcodeData opcode;
-
-	switch(code[pc])
-	{
-		case 0x00: opcode = {"NOP", 1}; break;
-		case 0x01: opcode = makeOpcode4b("LXI","B, #", code[pc + 2], code[pc + 1]); break;
-		case 0x02: opcode = makeOpcode("STAX", "B"); break;
-		case 0x03: opcode = makeOpcode("INX", "B"); break;
-		case 0x04: opcode = makeOpcode("INR", "B"); break;
-		case 0x05: opcode = makeOpcode("DCR", "B"); break;
-		case 0x06: opcode = makeOpcode2b("MVI","B, #", code[pc + 1]); break;
-		case 0x07: opcode = {"RLC", 1}; break;
-
-		case 0x08: opcode = opcodeNotFound(); break;
-		case 0x09: opcode = makeOpcode("DAD", "B"); break;
-		case 0x0A: opcode = makeOpcode("LDAX", "B"); break;
-		case 0x0B: opcode = makeOpcode("DCX", "B"); break;
-		case 0x0C: opcode = makeOpcode("INR", "C"); break;
-		case 0x0D: opcode = makeOpcode("DCR", "C"); break;
-		case 0x0E: opcode = makeOpcode2b("MVI", "C, #", code[pc + 1]); break;
-		case 0x0F: opcode = {"RRC", 1}; break;
-
-		case 0x10: opcode = opcodeNotFound(); break;
-		case 0x11: opcode = makeOpcode4b("LXI", "D, #", code[pc + 2], code[pc + 1]); break;
-		case 0x12: opcode = makeOpcode("STAX", "D"); break;
-		case 0x13: opcode = makeOpcode("INX", "D"); break;
-		case 0x14: opcode = makeOpcode("INR", "D"); break;
-		case 0x15: opcode = makeOpcode("DCR", "D"); break;
-		case 0x16: opcode = makeOpcode2b("MVI", "D, #", code[pc + 1]); break;
-		case 0x17: opcode = {"RAL", 1}; break;
-
-		case 0x18: opcode = opcodeNotFound(); break;
-		case 0x19: opcode = makeOpcode("DAD", "D"); break;
-		case 0x1A: opcode = makeOpcode("LDAX", "D"); break;
-		case 0x1B: opcode = makeOpcode("DCX", "D"); break;
-		case 0x1C: opcode = makeOpcode("INR", "E"); break;
-		case 0x1D: opcode = makeOpcode("DCR", "E"); break;
-		case 0x1E: opcode = makeOpcode2b("MVI", "E, #", code[pc + 1]); break;
-		case 0x1F: opcode = {"RAR", 1}; break;
-
-		case 0x20: opcode = opcodeNotFound(); break;
-		case 0x21: opcode = makeOpcode4b("LXI", "H, #", code[pc + 2], code[pc + 1]); break;
-		case 0x22: opcode = makeOpcode4b("SHLD", "", code[pc + 2], code[pc + 1]); break;
-		case 0x23: opcode = makeOpcode("INX", "H"); break;
-		case 0x24: opcode = makeOpcode("INR", "H"); break;
-		case 0x25: opcode = makeOpcode("DCR", "H"); break;
-		case 0x26: opcode = makeOpcode2b("MVI", "H, #", code[pc + 1]); break;
-		case 0x27: opcode = {"DAA", 1}; break;
-
-		case 0x28: opcode = opcodeNotFound(); break;
-		case 0x29: opcode = makeOpcode("DAD", "H"); break;
-		case 0x2A: opcode = makeOpcode4b("LHLD", "", code[pc + 2], code[pc + 1]); break;
-		case 0x2B: opcode = makeOpcode("DCX", "H"); break;
-		case 0x2C: opcode = makeOpcode("INR", "L"); break;
-		case 0x2D: opcode = makeOpcode("DCR", "L"); break;
-		case 0x2E: opcode = makeOpcode2b("MVI", "L, #", code[pc + 1]); break;
-		case 0x2F: opcode = {"CMA", 1}; break;
-
-		case 0x30: opcode = opcodeNotFound(); break;
-		case 0x31: opcode = makeOpcode4b("LXI","SP, #", code[pc + 2], code[pc + 1]); break;
-		case 0x32: opcode = makeOpcode4b("STA", "", code[pc + 2], code[pc + 1]); break;
-		case 0x33: opcode = makeOpcode("INX", "SP"); break;
-		case 0x34: opcode = makeOpcode("INR", "M"); break;
-		case 0x35: opcode = makeOpcode("DCR", "M"); break;
-		case 0x36: opcode = makeOpcode2b("MVI","M, #", code[pc + 1]); break;
-		case 0x37: opcode = {"STC", 1}; break;
-
-		case 0x38: opcode = opcodeNotFound(); break;
-		case 0x39: opcode = makeOpcode("DAD", "SP"); break;
-		case 0x3A: opcode = makeOpcode4b("LDA", "", code[pc + 2], code[pc + 1]); break;
-		case 0x3B: opcode = makeOpcode("DCX", "SP"); break;
-		case 0x3C: opcode = makeOpcode("INR", "A"); break;
-		case 0x3D: opcode = makeOpcode("DCR", "A"); break;
-		case 0x3E: opcode = makeOpcode2b("MVI", "A, #", code[pc + 1]); break;
-		case 0x3F: opcode = {"CMC", 1}; break;
-
-		case 0x40: opcode = makeOpcode("MOV", "B, B"); break;
-		case 0x41: opcode = makeOpcode("MOV", "B, C"); break;
-		case 0x42: opcode = makeOpcode("MOV", "B, D"); break;
-		case 0x43: opcode = makeOpcode("MOV", "B, E"); break;
-		case 0x44: opcode = makeOpcode("MOV", "B, H"); break;
-		case 0x45: opcode = makeOpcode("MOV", "B, L"); break;
-		case 0x46: opcode = makeOpcode("MOV", "B, M"); break;
-		case 0x47: opcode = makeOpcode("MOV", "B, A"); break;
-
-		case 0x48: opcode = makeOpcode("MOV", "C, B"); break;
-		case 0x49: opcode = makeOpcode("MOV", "C, C"); break;
-		case 0x4A: opcode = makeOpcode("MOV", "C, D"); break;
-		case 0x4B: opcode = makeOpcode("MOV", "C, E"); break;
-		case 0x4C: opcode = makeOpcode("MOV", "C, H"); break;
-		case 0x4D: opcode = makeOpcode("MOV", "C, L"); break;
-		case 0x4E: opcode = makeOpcode("MOV", "C, M"); break;
-		case 0x4F: opcode = makeOpcode("MOV", "C, A"); break;
-
-		case 0x50: opcode = makeOpcode("MOV", "D, B"); break;
-		case 0x51: opcode = makeOpcode("MOV", "D, C"); break;
-		case 0x52: opcode = makeOpcode("MOV", "D, D"); break;
-		case 0x53: opcode = makeOpcode("MOV", "D, E"); break;
-		case 0x54: opcode = makeOpcode("MOV", "D, H"); break;
-		case 0x55: opcode = makeOpcode("MOV", "D, L"); break;
-		case 0x56: opcode = makeOpcode("MOV", "D, M"); break;
-		case 0x57: opcode = makeOpcode("MOV", "D, A"); break;
-		
-		case 0x58: opcode = makeOpcode("MOV", "E, B"); break;
-		case 0x59: opcode = makeOpcode("MOV", "E, C"); break;
-		case 0x5A: opcode = makeOpcode("MOV", "E, D"); break;
-		case 0x5B: opcode = makeOpcode("MOV", "E, E"); break;
-		case 0x5C: opcode = makeOpcode("MOV", "E, H"); break;
-		case 0x5D: opcode = makeOpcode("MOV", "E, L"); break;
-		case 0x5E: opcode = makeOpcode("MOV", "E, M"); break;
-		case 0x5F: opcode = makeOpcode("MOV", "E, A"); break;
-
-		case 0x60: opcode = makeOpcode("MOV", "H, B"); break;
-		case 0x61: opcode = makeOpcode("MOV", "H, C"); break;
-		case 0x62: opcode = makeOpcode("MOV", "H, D"); break;
-		case 0x63: opcode = makeOpcode("MOV", "H, E"); break;
-		case 0x64: opcode = makeOpcode("MOV", "H, H"); break;
-		case 0x65: opcode = makeOpcode("MOV", "H, L"); break;
-		case 0x66: opcode = makeOpcode("MOV", "H, M"); break;
-		case 0x67: opcode = makeOpcode("MOV", "H, A"); break;
-		
-		case 0x68: opcode = makeOpcode("MOV", "L, B"); break;
-		case 0x69: opcode = makeOpcode("MOV", "L, C"); break;
-		case 0x6A: opcode = makeOpcode("MOV", "L, D"); break;
-		case 0x6B: opcode = makeOpcode("MOV", "L, E"); break;
-		case 0x6C: opcode = makeOpcode("MOV", "L, H"); break;
-		case 0x6D: opcode = makeOpcode("MOV", "L, L"); break;
-		case 0x6E: opcode = makeOpcode("MOV", "L, M"); break;
-		case 0x6F: opcode = makeOpcode("MOV", "L, A"); break;
-
-		case 0x70: opcode = makeOpcode("MOV", "M, B"); break;
-		case 0x71: opcode = makeOpcode("MOV", "M, C"); break;
-		case 0x72: opcode = makeOpcode("MOV", "M, D"); break;
-		case 0x73: opcode = makeOpcode("MOV", "M, E"); break;
-		case 0x74: opcode = makeOpcode("MOV", "M, H"); break;
-		case 0x75: opcode = makeOpcode("MOV", "M, L"); break;
-		case 0x76: opcode = {"HLT", 1}; break;
-		case 0x77: opcode = makeOpcode("MOV", "M, A"); break;
-		
-		case 0x78: opcode = makeOpcode("MOV", "A, B"); break;
-		case 0x79: opcode = makeOpcode("MOV", "A, C"); break;
-		case 0x7A: opcode = makeOpcode("MOV", "A, D"); break;
-		case 0x7B: opcode = makeOpcode("MOV", "A, E"); break;
-		case 0x7C: opcode = makeOpcode("MOV", "A, H"); break;
-		case 0x7D: opcode = makeOpcode("MOV", "A, L"); break;
-		case 0x7E: opcode = makeOpcode("MOV", "A, M"); break;
-		case 0x7F: opcode = makeOpcode("MOV", "A, A"); break;
-
-		case 0x80: opcode = makeOpcode("ADD", "B"); break;
-		case 0x81: opcode = makeOpcode("ADD", "C"); break;
-		case 0x82: opcode = makeOpcode("ADD", "D"); break;
-		case 0x83: opcode = makeOpcode("ADD", "E"); break;
-		case 0x84: opcode = makeOpcode("ADD", "H"); break;
-		case 0x85: opcode = makeOpcode("ADD", "L"); break;
-		case 0x86: opcode = makeOpcode("ADD", "M"); break;
-		case 0x87: opcode = makeOpcode("ADD", "A"); break;
-		
-		case 0x88: opcode = makeOpcode("ADC", "B"); break;
-		case 0x89: opcode = makeOpcode("ADC", "C"); break;
-		case 0x8A: opcode = makeOpcode("ADC", "D"); break;
-		case 0x8B: opcode = makeOpcode("ADC", "E"); break;
-		case 0x8C: opcode = makeOpcode("ADC", "H"); break;
-		case 0x8D: opcode = makeOpcode("ADC", "L"); break;
-		case 0x8E: opcode = makeOpcode("ADC", "M"); break;
-		case 0x8F: opcode = makeOpcode("ADC", "A"); break;
-
-		case 0x90: opcode = makeOpcode("SUB", "B"); break;
-		case 0x91: opcode = makeOpcode("SUB", "C"); break;
-		case 0x92: opcode = makeOpcode("SUB", "D"); break;
-		case 0x93: opcode = makeOpcode("SUB", "E"); break;
-		case 0x94: opcode = makeOpcode("SUB", "H"); break;
-		case 0x95: opcode = makeOpcode("SUB", "L"); break;
-		case 0x96: opcode = makeOpcode("SUB", "M"); break;
-		case 0x97: opcode = makeOpcode("SUB", "A"); break;
-		
-		case 0x98: opcode = makeOpcode("SBB", "B"); break;
-		case 0x99: opcode = makeOpcode("SBB", "C"); break;
-		case 0x9A: opcode = makeOpcode("SBB", "D"); break;
-		case 0x9B: opcode = makeOpcode("SBB", "E"); break;
-		case 0x9C: opcode = makeOpcode("SBB", "H"); break;
-		case 0x9D: opcode = makeOpcode("SBB", "L"); break;
-		case 0x9E: opcode = makeOpcode("SBB", "M"); break;
-		case 0x9F: opcode = makeOpcode("SBB", "A"); break;
-
-		case 0xA0: opcode = makeOpcode("ANA", "B"); break;
-		case 0xA1: opcode = makeOpcode("ANA", "C"); break;
-		case 0xA2: opcode = makeOpcode("ANA", "D"); break;
-		case 0xA3: opcode = makeOpcode("ANA", "E"); break;
-		case 0xA4: opcode = makeOpcode("ANA", "H"); break;
-		case 0xA5: opcode = makeOpcode("ANA", "L"); break;
-		case 0xA6: opcode = makeOpcode("ANA", "M"); break;
-		case 0xA7: opcode = makeOpcode("ANA", "A"); break;
-		
-		case 0xA8: opcode = makeOpcode("XRA", "B"); break;
-		case 0xA9: opcode = makeOpcode("XRA", "C"); break;
-		case 0xAA: opcode = makeOpcode("XRA", "D"); break;
-		case 0xAB: opcode = makeOpcode("XRA", "E"); break;
-		case 0xAC: opcode = makeOpcode("XRA", "H"); break;
-		case 0xAD: opcode = makeOpcode("XRA", "L"); break;
-		case 0xAE: opcode = makeOpcode("XRA", "M"); break;
-		case 0xAF: opcode = makeOpcode("XRA", "A"); break;
-
-		case 0xB0: opcode = makeOpcode("ORA", "B"); break;
-		case 0xB1: opcode = makeOpcode("ORA", "C"); break;
-		case 0xB2: opcode = makeOpcode("ORA", "D"); break;
-		case 0xB3: opcode = makeOpcode("ORA", "E"); break;
-		case 0xB4: opcode = makeOpcode("ORA", "H"); break;
-		case 0xB5: opcode = makeOpcode("ORA", "L"); break;
-		case 0xB6: opcode = makeOpcode("ORA", "M"); break;
-		case 0xB7: opcode = makeOpcode("ORA", "A"); break;
-		
-		case 0xB8: opcode = makeOpcode("CMP", "B"); break;
-		case 0xB9: opcode = makeOpcode("CMP", "C"); break;
-		case 0xBA: opcode = makeOpcode("CMP", "D"); break;
-		case 0xBB: opcode = makeOpcode("CMP", "E"); break;
-		case 0xBC: opcode = makeOpcode("CMP", "H"); break;
-		case 0xBD: opcode = makeOpcode("CMP", "L"); break;
-		case 0xBE: opcode = makeOpcode("CMP", "M"); break;
-		case 0xBF: opcode = makeOpcode("CMP", "A"); break;
-
-		case 0xC0: opcode = {"RNZ", 1}; break;
-		case 0xC1: opcode = makeOpcode("POP", "B"); break;
-		case 0xC2: opcode = makeOpcode4b("JNZ", "", code[pc + 2], code[pc + 1]); break;
-		case 0xC3: opcode = makeOpcode4b("JMP", "", code[pc + 2], code[pc + 1]); break;
-		case 0xC4: opcode = makeOpcode4b("CNZ", "", code[pc + 2], code[pc + 1]); break;
-		case 0xC5: opcode = makeOpcode("PUSH", "B"); break;
-		case 0xC6: opcode = makeOpcode2b("ADI", "#", code[pc + 1]); break;
-		case 0xC7: opcode = makeOpcode("RST", "0"); break;
-
-		case 0xC8: opcode = {"RZ", 1}; break;
-		case 0xC9: opcode = {"RET", 1}; break;
-		case 0xCA: opcode = makeOpcode4b("JZ", "", code[pc + 2], code[pc + 1]); break;
-		case 0xCB: opcode = opcodeNotFound(); break;
-		case 0xCC: opcode = makeOpcode4b("CZ", "", code[pc + 2], code[pc + 1]); break;
-		case 0xCD: opcode = makeOpcode4b("CALL", "", code[pc + 2], code[pc + 1]); break;
-		case 0xCE: opcode = makeOpcode2b("ACI", "#", code[pc + 1]); break;
-		case 0xCF: opcode = makeOpcode("RST", "1"); break;
-
-		case 0xD0: opcode = {"RNC", 1}; break;
-		case 0xD1: opcode = makeOpcode("POP", "D"); break;
-		case 0xD2: opcode = makeOpcode4b("JNC", "", code[pc + 2], code[pc + 1]); break;
-		case 0xD3: opcode = makeOpcode2b("OUT", "#", code[pc + 1]); break;
-		case 0xD4: opcode = makeOpcode4b("CNC", "", code[pc + 2], code[pc + 1]); break;
-		case 0xD5: opcode = makeOpcode("PUSH", "D"); break;
-		case 0xD6: opcode = makeOpcode2b("SUI", "#", code[pc + 1]); break;
-		case 0xD7: opcode = makeOpcode("RST", "2"); break;
-		
-		case 0xD8: opcode = {"RC", 1}; break;
-		case 0xD9: opcode = opcodeNotFound(); break;
-		case 0xDA: opcode = makeOpcode4b("JC", "", code[pc + 2], code[pc + 1]); break;
-		case 0xDB: opcode = makeOpcode2b("IN", "#", code[pc + 1]); break;
-		case 0xDC: opcode = makeOpcode4b("CC", "", code[pc + 2], code[pc + 1]); break;
-		case 0xDD: opcode = opcodeNotFound(); break;
-		case 0xDE: opcode = makeOpcode2b("SBI", "#", code[pc + 1]); break;
-		case 0xDF: opcode = makeOpcode("RST", "3"); break;
+size_t dissasemble::listing(const uint8_t* code, size_t size, std::string& out, size_t origin)
+{
+	// sized exactly first, it's only table lookups
+	const size_t starts[1] = {0};
+	Walk walks[1];
+	walk(code, size, origin, starts, walks);
+	size_t start = out.size();
+	out.resize(start + walks[0].bytes);
+	listRange(code, size, 0, size, origin, &out[0] + start, &out[0] + out.size());
+	return walks[0].instructions;
+}
 
-		case 0xE0: opcode = {"RPO", 1}; break;
-		case 0xE1: opcode = makeOpcode("POP", "H"); break;
-		case 0xE2: opcode = makeOpcode4b("JPO", "", code[pc + 2], code[pc + 1]); break;
-		case 0xE3: opcode = {"XTHL", 1}; break;
-		case 0xE4: opcode = makeOpcode4b("CPO", "", code[pc + 2], code[pc + 1]); break;
-		case 0xE5: opcode = makeOpcode("PUSH", "H"); break;
-		case 0xE6: opcode = makeOpcode2b("ANI", "#", code[pc + 1]); break;
-		case 0xE7: opcode = makeOpcode("RST", "4"); break;
-		
-		case 0xE8: opcode = {"RPE", 1}; break;
-		case 0xE9: opcode = {"PCHL", 1}; break;
-		case 0xEA: opcode = makeOpcode4b("JPE", "", code[pc + 2], code[pc + 1]); break;
-		case 0xEB: opcode = {"XCHG", 1}; break;
-		case 0xEC: opcode = makeOpcode4b("CPE", "", code[pc + 2], code[pc + 1]); break;
-		case 0xED: opcode = opcodeNotFound(); break;
-		case 0xEE: opcode = makeOpcode2b("XRI", "#", code[pc + 1]); break;
-		case 0xEF: opcode = makeOpcode("RST", "5"); break;
+size_t dissasemble::listing(p8080::ThreadPool& pool, const uint8_t* code, size_t size, std::string& out,
+	size_t origin, size_t chunkSize)
+{
+	// a walk leaves a chunk at most 2 bytes past its end, that has to land
+	// in the next chunk
+	chunkSize = std::max<size_t>(chunkSize, 3);
+	if (size <= chunkSize || pool.size() < 2) {
+		return listing(code, size, out, origin);
+	}
+	size_t chunks = (size + chunkSize - 1) / chunkSize;
+
+	// where walks from the first 3 bytes of every chunk leave it, and what
+	// they'd come to
+	std::vector<std::array<Walk, 3>> walks(chunks);
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		pool.submit([&, chunk] {
+			size_t begin = chunk * chunkSize;
+			const size_t starts[3] = {begin, begin + 1, begin + 2};
+			Walk phases[3];
+			walk(code, std::min(size, begin + chunkSize), origin, starts, phases);
+			std::copy(phases, phases + 3, walks[chunk].begin());
+		});
+	}
+	pool.wait();
+
+	// chained from the first chunk, where every chunk starts in the image
+	// and in the listing
+	std::vector<size_t> starts(chunks + 1);
+	std::vector<size_t> offsets(chunks + 1);
+	offsets[0] = out.size();
+	size_t instructions = 0;
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		const Walk& taken = walks[chunk][starts[chunk] - chunk * chunkSize];
+		starts[chunk + 1] = taken.exit;
+		offsets[chunk + 1] = offsets[chunk] + taken.bytes;
+		instructions += taken.instructions;
+	}
 
-		case 0xF0: opcode = {"RP", 1}; break;
-		case 0xF1: opcode = makeOpcode("POP", "PSW"); break;
-		case 0xF2: opcode = makeOpcode4b("JP", "", code[pc + 2], code[pc + 1]); break;
-		case 0xF3: opcode = {"DI", 1}; break;
-		case 0xF4: opcode = makeOpcode4b("CP", "", code[pc + 2], code[pc + 1]); break;
-		case 0xF5: opcode = makeOpcode("PUSH", "PSW"); break;
-		case 0xF6: opcode = makeOpcode2b("ORI", "#", code[pc + 1]); break;
-		case 0xF7: opcode = makeOpcode("RST", "6"); break;
-		
-		case 0xF8: opcode = {"RM", 1}; break;
-		case 0xF9: opcode = {"SPHL", 1}; break;
-		case 0xFA: opcode = makeOpcode4b("JM", "", code[pc + 2], code[pc + 1]); break;
-		case 0xFB: opcode = {"EI", 1}; break;
-		case 0xFC: opcode = makeOpcode4b("CM", "", code[pc + 2], code[pc + 1]); break;
-		case 0xFD: opcode = opcodeNotFound(); break;
-		case 0xFE: opcode = makeOpcode2b("CPI", "#", code[pc + 1]); break;
-		case 0xFF: opcode = makeOpcode("RST", "7"); break;
+	out.resize(offsets[chunks]);
+	char* listing = &out[0];
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		pool.submit([&, chunk, listing] {
+			size_t end = std::min(size, (chunk + 1) * chunkSize);
+			listRange(code, size, starts[chunk], end, origin, listing + offsets[chunk], listing + offsets[chunk + 1]);
+		});
+	}
+	pool.wait();
+	return instructions;
+}
 
-		default  : opcode = opcodeNotFound();
+OpcodeData dissasemble::dissasemble(std::vector<uint8_t>& code, int pc)
+{
+	Instruction instruction = decode(code.data(), code.size(), static_cast<size_t>(pc));
+#ifdef THROW_ON_UNSUPPORTED_OPCODE
+	if (!MNEMONICS[instruction.opcode].documented) {
+		throw std::runtime_error("unsupported opcode");
 	}
+#endif
+	char text[TEXT_SIZE];
+	size_t length = format(instruction, text);
 
-	// quick and dirty debug print may fix it may not
-	#if defined DEBUG || defined _DEBUG
-		std::cout << std::hex << std::setw(4) << std::setfill('0') << pc;
-		// std::cout << std::dec << " | ";
-		// for (int i=0; i < opcode.size; i++) {
-		// 	std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)code[pc + i] << " ";
-		// }
-		// for (int i=opcode.size; i < 3; i++) {
-		// 	std::cout << std::setw(3) << std::setfill(' ') << "";
-		// }
-		// std::cout << "|";
-		std::cout << " " << opcode.symbol << std::endl;
-	#endif
-	
-	return opcode;
-}
\ No newline at end of file
+	return {std::string(text, length), instruction.size};
+}
@@ -1,13 +1,382 @@
 #pragma once
-
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
+namespace p8080 {
+	class ThreadPool;
+}
+
 struct OpcodeData {
 	std::string symbol;
 	uint16_t size;
 };
 
 namespace dissasemble {
+	// what comes after the opcode
+	enum class Operand : uint8_t {
+		None,
+		Byte,
+		Word,
+	};
+
+	struct Mnemonic {
+		const char* name;
+		// registers, with a # in front of where the operand goes
+		const char* args;
+		Operand operand;
+		// the undocumented ones all show up as NOP
+		bool documented;
+	};
+
+	constexpr Mnemonic MNEMONICS[256] = {
+		{"NOP", "", Operand::None, true}, // 0x00
+		{"LXI", "B, #", Operand::Word, true}, // 0x01
+		{"STAX", "B", Operand::None, true}, // 0x02
+		{"INX", "B", Operand::None, true}, // 0x03
+		{"INR", "B", Operand::None, true}, // 0x04
+		{"DCR", "B", Operand::None, true}, // 0x05
+		{"MVI", "B, #", Operand::Byte, true}, // 0x06
+		{"RLC", "", Operand::None, true}, // 0x07
+
+		{"NOP", "", Operand::None, false}, // 0x08
+		{"DAD", "B", Operand::None, true}, // 0x09
+		{"LDAX", "B", Operand::None, true}, // 0x0A
+		{"DCX", "B", Operand::None, true}, // 0x0B
+		{"INR", "C", Operand::None, true}, // 0x0C
+		{"DCR", "C", Operand::None, true}, // 0x0D
+		{"MVI", "C, #", Operand::Byte, true}, // 0x0E
+		{"RRC", "", Operand::None, true}, // 0x0F
+
+		{"NOP", "", Operand::None, false}, // 0x10
+		{"LXI", "D, #", Operand::Word, true}, // 0x11
+		{"STAX", "D", Operand::None, true}, // 0x12
+		{"INX", "D", Operand::None, true}, // 0x13
+		{"INR", "D", Operand::None, true}, // 0x14
+		{"DCR", "D", Operand::None, true}, // 0x15
+		{"MVI", "D, #", Operand::Byte, true}, // 0x16
+		{"RAL", "", Operand::None, true}, // 0x17
+
+		{"NOP", "", Operand::None, false}, // 0x18
+		{"DAD", "D", Operand::None, true}, // 0x19
+		{"LDAX", "D", Operand::None, true}, // 0x1A
+		{"DCX", "D", Operand::None, true}, // 0x1B
+		{"INR", "E", Operand::None, true}, // 0x1C
+		{"DCR", "E", Operand::None, true}, // 0x1D
+		{"MVI", "E, #", Operand::Byte, true}, // 0x1E
+		{"RAR", "", Operand::None, true}, // 0x1F
+
+		{"NOP", "", Operand::None, false}, // 0x20
+		{"LXI", "H, #", Operand::Word, true}, // 0x21
+		{"SHLD", "", Operand::Word, true}, // 0x22
+		{"INX", "H", Operand::None, true}, // 0x23
+		{"INR", "H", Operand::None, true}, // 0x24
+		{"DCR", "H", Operand::None, true}, // 0x25
+		{"MVI", "H, #", Operand::Byte, true}, // 0x26
+		{"DAA", "", Operand::None, true}, // 0x27
+
+		{"NOP", "", Operand::None, false}, // 0x28
+		{"DAD", "H", Operand::None, true}, // 0x29
+		{"LHLD", "", Operand::Word, true}, // 0x2A
+		{"DCX", "H", Operand::None, true}, // 0x2B
+		{"INR", "L", Operand::None, true}, // 0x2C
+		{"DCR", "L", Operand::None, true}, // 0x2D
+		{"MVI", "L, #", Operand::Byte, true}, // 0x2E
+		{"CMA", "", Operand::None, true}, // 0x2F
+
+		{"NOP", "", Operand::None, false}, // 0x30
+		{"LXI", "SP, #", Operand::Word, true}, // 0x31
+		{"STA", "", Operand::Word, true}, // 0x32
+		{"INX", "SP", Operand::None, true}, // 0x33
+		{"INR", "M", Operand::None, true}, // 0x34
+		{"DCR", "M", Operand::None, true}, // 0x35
+		{"MVI", "M, #", Operand::Byte, true}, // 0x36
+		{"STC", "", Operand::None, true}, // 0x37
+
+		{"NOP", "", Operand::None, false}, // 0x38
+		{"DAD", "SP", Operand::None, true}, // 0x39
+		{"LDA", "", Operand::Word, true}, // 0x3A
+		{"DCX", "SP", Operand::None, true}, // 0x3B
+		{"INR", "A", Operand::None, true}, // 0x3C
+		{"DCR", "A", Operand::None, true}, // 0x3D
+		{"MVI", "A, #", Operand::Byte, true}, // 0x3E
+		{"CMC", "", Operand::None, true}, // 0x3F
+
+		{"MOV", "B, B", Operand::None, true}, // 0x40
+		{"MOV", "B, C", Operand::None, true}, // 0x41
+		{"MOV", "B, D", Operand::None, true}, // 0x42
+		{"MOV", "B, E", Operand::None, true}, // 0x43
+		{"MOV", "B, H", Operand::None, true}, // 0x44
+		{"MOV", "B, L", Operand::None, true}, // 0x45
+		{"MOV", "B, M", Operand::None, true}, // 0x46
+		{"MOV", "B, A", Operand::None, true}, // 0x47
+
+		{"MOV", "C, B", Operand::None, true}, // 0x48
+		{"MOV", "C, C", Operand::None, true}, // 0x49
+		{"MOV", "C, D", Operand::None, true}, // 0x4A
+		{"MOV", "C, E", Operand::None, true}, // 0x4B
+		{"MOV", "C, H", Operand::None, true}, // 0x4C
+		{"MOV", "C, L", Operand::None, true}, // 0x4D
+		{"MOV", "C, M", Operand::None, true}, // 0x4E
+		{"MOV", "C, A", Operand::None, true}, // 0x4F
+
+		{"MOV", "D, B", Operand::None, true}, // 0x50
+		{"MOV", "D, C", Operand::None, true}, // 0x51
+		{"MOV", "D, D", Operand::None, true}, // 0x52
+		{"MOV", "D, E", Operand::None, true}, // 0x53
+		{"MOV", "D, H", Operand::None, true}, // 0x54
+		{"MOV", "D, L", Operand::None, true}, // 0x55
+		{"MOV", "D, M", Operand::None, true}, // 0x56
+		{"MOV", "D, A", Operand::None, true}, // 0x57
+
+		{"MOV", "E, B", Operand::None, true}, // 0x58
+		{"MOV", "E, C", Operand::None, true}, // 0x59
+		{"MOV", "E, D", Operand::None, true}, // 0x5A
+		{"MOV", "E, E", Operand::None, true}, // 0x5B
+		{"MOV", "E, H", Operand::None, true}, // 0x5C
+		{"MOV", "E, L", Operand::None, true}, // 0x5D
+		{"MOV", "E, M", Operand::None, true}, // 0x5E
+		{"MOV", "E, A", Operand::None, true}, // 0x5F
+
+		{"MOV", "H, B", Operand::None, true}, // 0x60
+		{"MOV", "H, C", Operand::None, true}, // 0x61
+		{"MOV", "H, D", Operand::None, true}, // 0x62
+		{"MOV", "H, E", Operand::None, true}, // 0x63
+		{"MOV", "H, H", Operand::None, true}, // 0x64
+		{"MOV", "H, L", Operand::None, true}, // 0x65
+		{"MOV", "H, M", Operand::None, true}, // 0x66
+		{"MOV", "H, A", Operand::None, true}, // 0x67
+
+		{"MOV", "L, B", Operand::None, true}, // 0x68
+		{"MOV", "L, C", Operand::None, true}, // 0x69
+		{"MOV", "L, D", Operand::None, true}, // 0x6A
+		{"MOV", "L, E", Operand::None, true}, // 0x6B
+		{"MOV", "L, H", Operand::None, true}, // 0x6C
+		{"MOV", "L, L", Operand::None, true}, // 0x6D
+		{"MOV", "L, M", Operand::None, true}, // 0x6E
+		{"MOV", "L, A", Operand::None, true}, // 0x6F
+
+		{"MOV", "M, B", Operand::None, true}, // 0x70
+		{"MOV", "M, C", Operand::None, true}, // 0x71
+		{"MOV", "M, D", Operand::None, true}, // 0x72
+		{"MOV", "M, E", Operand::None, true}, // 0x73
+		{"MOV", "M, H", Operand::None, true}, // 0x74
+		{"MOV", "M, L", Operand::None, true}, // 0x75
+		{"HLT", "", Operand::None, true}, // 0x76
+		{"MOV", "M, A", Operand::None, true}, // 0x77
+
+		{"MOV", "A, B", Operand::None, true}, // 0x78
+		{"MOV", "A, C", Operand::None, true}, // 0x79
+		{"MOV", "A, D", Operand::None, true}, // 0x7A
+		{"MOV", "A, E", Operand::None, true}, // 0x7B
+		{"MOV", "A, H", Operand::None, true}, // 0x7C
+		{"MOV", "A, L", Operand::None, true}, // 0x7D
+		{"MOV", "A, M", Operand::None, true}, // 0x7E
+		{"MOV", "A, A", Operand::None, true}, // 0x7F
+
+		{"ADD", "B", Operand::None, true}, // 0x80
+		{"ADD", "C", Operand::None, true}, // 0x81
+		{"ADD", "D", Operand::None, true}, // 0x82
+		{"ADD", "E", Operand::None, true}, // 0x83
+		{"ADD", "H", Operand::None, true}, // 0x84
+		{"ADD", "L", Operand::None, true}, // 0x85
+		{"ADD", "M", Operand::None, true}, // 0x86
+		{"ADD", "A", Operand::None, true}, // 0x87
+
+		{"ADC", "B", Operand::None, true}, // 0x88
+		{"ADC", "C", Operand::None, true}, // 0x89
+		{"ADC", "D", Operand::None, true}, // 0x8A
+		{"ADC", "E", Operand::None, true}, // 0x8B
+		{"ADC", "H", Operand::None, true}, // 0x8C
+		{"ADC", "L", Operand::None, true}, // 0x8D
+		{"ADC", "M", Operand::None, true}, // 0x8E
+		{"ADC", "A", Operand::None, true}, // 0x8F
+
+		{"SUB", "B", Operand::None, true}, // 0x90
+		{"SUB", "C", Operand::None, true}, // 0x91
+		{"SUB", "D", Operand::None, true}, // 0x92
+		{"SUB", "E", Operand::None, true}, // 0x93
+		{"SUB", "H", Operand::None, true}, // 0x94
+		{"SUB", "L", Operand::None, true}, // 0x95
+		{"SUB", "M", Operand::None, true}, // 0x96
+		{"SUB", "A", Operand::None, true}, // 0x97
+
+		{"SBB", "B", Operand::None, true}, // 0x98
+		{"SBB", "C", Operand::None, true}, // 0x99
+		{"SBB", "D", Operand::None, true}, // 0x9A
+		{"SBB", "E", Operand::None, true}, // 0x9B
+		{"SBB", "H", Operand::None, true}, // 0x9C
+		{"SBB", "L", Operand::None, true}, // 0x9D
+		{"SBB", "M", Operand::None, true}, // 0x9E
+		{"SBB", "A", Operand::None, true}, // 0x9F
+
+		{"ANA", "B", Operand::None, true}, // 0xA0
+		{"ANA", "C", Operand::None, true}, // 0xA1
+		{"ANA", "D", Operand::None, true}, // 0xA2
+		{"ANA", "E", Operand::None, true}, // 0xA3
+		{"ANA", "H", Operand::None, true}, // 0xA4
+		{"ANA", "L", Operand::None, true}, // 0xA5
+		{"ANA", "M", Operand::None, true}, // 0xA6
+		{"ANA", "A", Operand::None, true}, // 0xA7
+
+		{"XRA", "B", Operand::None, true}, // 0xA8
+		{"XRA", "C", Operand::None, true}, // 0xA9
+		{"XRA", "D", Operand::None, true}, // 0xAA
+		{"XRA", "E", Operand::None, true}, // 0xAB
+		{"XRA", "H", Operand::None, true}, // 0xAC
+		{"XRA", "L", Operand::None, true}, // 0xAD
+		{"XRA", "M", Operand::None, true}, // 0xAE
+		{"XRA", "A", Operand::None, true}, // 0xAF
+
+		{"ORA", "B", Operand::None, true}, // 0xB0
+		{"ORA", "C", Operand::None, true}, // 0xB1
+		{"ORA", "D", Operand::None, true}, // 0xB2
+		{"ORA", "E", Operand::None, true}, // 0xB3
+		{"ORA", "H", Operand::None, true}, // 0xB4
+		{"ORA", "L", Operand::None, true}, // 0xB5
+		{"ORA", "M", Operand::None, true}, // 0xB6
+		{"ORA", "A", Operand::None, true}, // 0xB7
+
+		{"CMP", "B", Operand::None, true}, // 0xB8
+		{"CMP", "C", Operand::None, true}, // 0xB9
+		{"CMP", "D", Operand::None, true}, // 0xBA
+		{"CMP", "E", Operand::None, true}, // 0xBB
+		{"CMP", "H", Operand::None, true}, // 0xBC
+		{"CMP", "L", Operand::None, true}, // 0xBD
+		{"CMP", "M", Operand::None, true}, // 0xBE
+		{"CMP", "A", Operand::None, true}, // 0xBF
+
+		{"RNZ", "", Operand::None, true}, // 0xC0
+		{"POP", "B", Operand::None, true}, // 0xC1
+		{"JNZ", "", Operand::Word, true}, // 0xC2
+		{"JMP", "", Operand::Word, true}, // 0xC3
+		{"CNZ", "", Operand::Word, true}, // 0xC4
+		{"PUSH", "B", Operand::None, true}, // 0xC5
+		{"ADI", "#", Operand::Byte, true}, // 0xC6
+		{"RST", "0", Operand::None, true}, // 0xC7
+
+		{"RZ", "", Operand::None, true}, // 0xC8
+		{"RET", "", Operand::None, true}, // 0xC9
+		{"JZ", "", Operand::Word, true}, // 0xCA
+		{"NOP", "", Operand::None, false}, // 0xCB
+		{"CZ", "", Operand::Word, true}, // 0xCC
+		{"CALL", "", Operand::Word, true}, // 0xCD
+		{"ACI", "#", Operand::Byte, true}, // 0xCE
+		{"RST", "1", Operand::None, true}, // 0xCF
+
+		{"RNC", "", Operand::None, true}, // 0xD0
+		{"POP", "D", Operand::None, true}, // 0xD1
+		{"JNC", "", Operand::Word, true}, // 0xD2
+		{"OUT", "#", Operand::Byte, true}, // 0xD3
+		{"CNC", "", Operand::Word, true}, // 0xD4
+		{"PUSH", "D", Operand::None, true}, // 0xD5
+		{"SUI", "#", Operand::Byte, true}, // 0xD6
+		{"RST", "2", Operand::None, true}, // 0xD7
+
+		{"RC", "", Operand::None, true}, // 0xD8
+		{"NOP", "", Operand::None, false}, // 0xD9
+		{"JC", "", Operand::Word, true}, // 0xDA
+		{"IN", "#", Operand::Byte, true}, // 0xDB
+		{"CC", "", Operand::Word, true}, // 0xDC
+		{"NOP", "", Operand::None, false}, // 0xDD
+		{"SBI", "#", Operand::Byte, true}, // 0xDE
+		{"RST", "3", Operand::None, true}, // 0xDF
+
+		{"RPO", "", Operand::None, true}, // 0xE0
+		{"POP", "H", Operand::None, true}, // 0xE1
+		{"JPO", "", Operand::Word, true}, // 0xE2
+		{"XTHL", "", Operand::None, true}, // 0xE3
+		{"CPO", "", Operand::Word, true}, // 0xE4
+		{"PUSH", "H", Operand::None, true}, // 0xE5
+		{"ANI", "#", Operand::Byte, true}, // 0xE6
+		{"RST", "4", Operand::None, true}, // 0xE7
+
+		{"RPE", "", Operand::None, true}, // 0xE8
+		{"PCHL", "", Operand::None, true}, // 0xE9
+		{"JPE", "", Operand::Word, true}, // 0xEA
+		{"XCHG", "", Operand::None, true}, // 0xEB
+		{"CPE", "", Operand::Word, true}, // 0xEC
+		{"NOP", "", Operand::None, false}, // 0xED
+		{"XRI", "#", Operand::Byte, true}, // 0xEE
+		{"RST", "5", Operand::None, true}, // 0xEF
+
+		{"RP", "", Operand::None, true}, // 0xF0
+		{"POP", "PSW", Operand::None, true}, // 0xF1
+		{"JP", "", Operand::Word, true}, // 0xF2
+		{"DI", "", Operand::None, true}, // 0xF3
+		{"CP", "", Operand::Word, true}, // 0xF4
+		{"PUSH", "PSW", Operand::None, true}, // 0xF5
+		{"ORI", "#", Operand::Byte, true}, // 0xF6
+		{"RST", "6", Operand::None, true}, // 0xF7
+
+		{"RM", "", Operand::None, true}, // 0xF8
+		{"SPHL", "", Operand::None, true}, // 0xF9
+		{"JM", "", Operand::Word, true}, // 0xFA
+		{"EI", "", Operand::None, true}, // 0xFB
+		{"CM", "", Operand::Word, true}, // 0xFC
+		{"NOP", "", Operand::None, false}, // 0xFD
+		{"CPI", "#", Operand::Byte, true}, // 0xFE
+		{"RST", "7", Operand::None, true}, // 0xFF
+	};
+
+	// one instruction, decoded but not turned into text yet, plain data
+	struct Instruction {
+		uint8_t opcode;
+		uint8_t size;
+		Operand operand;
+		uint16_t immediate;
+	};
+
+	// room format() needs, terminator included, the longest is LXI SP
+	constexpr size_t TEXT_SIZE = 24;
+
+	// bytes in the instruction, operands included
+	constexpr uint8_t length(uint8_t opcode)
+	{
+		Operand operand = MNEMONICS[opcode].operand;
+		return operand == Operand::Word ? 3 : operand == Operand::Byte ? 2 : 1;
+	}
+
+	// the instruction at pc, operand bytes past size read as 0
+	constexpr Instruction decode(const uint8_t* code, size_t size, size_t pc)
+	{
+		uint8_t opcode = code[pc];
+		Operand operand = MNEMONICS[opcode].operand;
+		uint8_t length = dissasemble::length(opcode);
+		uint16_t immediate = 0;
+		for (size_t i = length - 1; i > 0; i--) {
+			immediate = static_cast<uint16_t>(immediate << 8 | (pc + i < size ? code[pc + i] : 0));
+		}
+		return {opcode, length, operand, immediate};
+	}
+
+	// text for instruction into out, which needs TEXT_SIZE bytes, null
+	// terminated, returns the length without the terminator
+	size_t format(const Instruction& instruction, char* out);
+
+	// hands the text to sink as a std::string_view, only good during the call
+	template<typename Sink>
+	void print(const Instruction& instruction, Sink&& sink)
+	{
+		char text[TEXT_SIZE];
+		sink(std::string_view(text, format(instruction, text)));
+	}
+
+	// the whole of code as one "address text" line per instruction, with
+	// origin as the address of the first byte, appended to out with a
+	// single allocation. returns how many instructions there were
+	size_t listing(const uint8_t* code, size_t size, std::string& out, size_t origin = 0);
+	// the same listing, byte for byte, made chunkSize bytes at a time on
+	// pool. a chunk can only start on 3 instruction boundaries, the one at
+	// its first byte or one of the next two, so every chunk first finds
+	// where a walk from each of them leaves it, using nothing but the
+	// opcode sizes. chaining those from the first chunk gives where each
+	// one really starts, then they're all listed at once and joined
+	size_t listing(p8080::ThreadPool& pool, const uint8_t* code, size_t size, std::string& out,
+		size_t origin = 0, size_t chunkSize = 1 << 14);
+
+	// decode() and format() into a string, allocates for it
 	OpcodeData dissasemble(std::vector<uint8_t>& codeBuffer, int pc);
-}
\ No newline at end of file
+}
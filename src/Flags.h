@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+
+namespace p8080 {
+
+// flag bits, same layout as the low byte of the PSW
+// S Z 0 AC 0 P 1 CY
+constexpr uint8_t FLAG_CY =  0b00000001;
+constexpr uint8_t FLAG_P  =  0b00000100;
+constexpr uint8_t FLAG_AC =  0b00010000;
+constexpr uint8_t FLAG_Z  =  0b01000000;
+constexpr uint8_t FLAG_S  =  0b10000000;
+constexpr uint8_t FLAG_ALL=	 0b11010101;
+// bit 1 always reads as set when the PSW is pushed
+constexpr uint8_t FLAG_PSW_SET = 0b00000010;
+
+// flags precomputed at compile time, index with the result of the operation
+struct FlagTables {
+	// Z, S and P of a byte
+	uint8_t szp[256];
+	// Z, S, P and CY of a 9 bit result, bit 8 being the carry (or borrow)
+	uint8_t szpc[512];
+	// Z, S, P and AC after INR, AC is set when the low nibble wrapped to 0
+	uint8_t inr[256];
+	// Z, S, P and AC after DCR, AC is set unless the low nibble wrapped to 0xf
+	uint8_t dcr[256];
+};
+
+constexpr FlagTables makeFlagTables()
+{
+	FlagTables t{};
+	for (int i = 0; i < 256; i++) {
+		int bits = 0;
+		for (int b = i; b != 0; b >>= 1) {
+			bits += b & 1;
+		}
+		uint8_t f = 0;
+		if (i == 0)          f |= FLAG_Z;
+		if (i & 0x80)        f |= FLAG_S;
+		if ((bits & 1) == 0) f |= FLAG_P;
+
+		t.szp[i] = f;
+		t.szpc[i] = f;
+		t.szpc[i | 0x100] = f | FLAG_CY;
+		t.inr[i] = f | ((i & 0xf) == 0x0 ? FLAG_AC : 0);
+		t.dcr[i] = f | ((i & 0xf) != 0xf ? FLAG_AC : 0);
+	}
+	return t;
+}
+
+constexpr FlagTables FLAG_TABLES = makeFlagTables();
+
+// flag setting ALU operations, so flags can be worked out after the fact
+enum FlagOp : uint8_t {
+	FLAGOP_NONE,
+	FLAGOP_ADD,		// ADD ADC ADI ACI
+	FLAGOP_SUB,		// SUB SBB SUI SBI CMP CPI
+	FLAGOP_ANA,		// ANA ANI
+	FLAGOP_LOGIC,	// ORA ORI XRA XRI
+	FLAGOP_INR,
+	FLAGOP_DCR,
+};
+
+// flags after op, a and b being the operands and res the 9 bit result
+// cy is the carry from before, only INR and DCR keep it
+constexpr uint8_t computeFlags(uint8_t op, uint8_t a, uint8_t b, uint16_t res, uint8_t cy)
+{
+	switch (op) {
+		// AC, carry out of bit 3 shows up as a flipped bit 4
+		case FLAGOP_ADD:   return FLAG_TABLES.szpc[res] | ((a ^ b ^ res) & FLAG_AC);
+		// the 8080 adds the complement, so AC is the inverse of a borrow into bit 4
+		case FLAGOP_SUB:   return FLAG_TABLES.szpc[res] | (~(a ^ b ^ res) & FLAG_AC);
+		// data book says CY is zeroed, AC ends up as the OR of bit 3 of both operands
+		case FLAGOP_ANA:   return FLAG_TABLES.szp[res] | (((a | b) << 1) & FLAG_AC);
+		// data book says CY and AC are zeroed
+		case FLAGOP_LOGIC: return FLAG_TABLES.szp[res];
+		case FLAGOP_INR:   return FLAG_TABLES.inr[res & 0xff] | cy;
+		case FLAGOP_DCR:   return FLAG_TABLES.dcr[res & 0xff] | cy;
+		default:           return cy;
+	}
+}
+
+}
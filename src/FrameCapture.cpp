@@ -0,0 +1,351 @@
+#include "FrameCapture.h"
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include "RomSet.h"
+
+namespace p8080 {
+
+namespace {
+	uint32_t adler32(const uint8_t* data, size_t size)
+	{
+		uint32_t a = 1, b = 0;
+		for (size_t i = 0; i < size; i++) {
+			a = (a + data[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		return b << 16 | a;
+	}
+
+	void putBigEndian(std::string& out, uint32_t value)
+	{
+		for (int shift = 24; shift >= 0; shift -= 8) {
+			out.push_back(static_cast<char>(value >> shift));
+		}
+	}
+
+	// deflate wants everything least significant bit first, except the
+	// huffman codes themselves
+	class BitWriter {
+	public:
+		explicit BitWriter(std::string& out) : out(out) {}
+
+		void put(uint32_t value, unsigned count)
+		{
+			bits |= value << used;
+			used += count;
+			while (used >= 8) {
+				out.push_back(static_cast<char>(bits));
+				bits >>= 8;
+				used -= 8;
+			}
+		}
+
+		void putCode(uint32_t code, unsigned count)
+		{
+			uint32_t reversed = 0;
+			for (unsigned i = 0; i < count; i++) {
+				reversed = reversed << 1 | ((code >> i) & 1);
+			}
+			put(reversed, count);
+		}
+
+		void flush()
+		{
+			if (used) {
+				out.push_back(static_cast<char>(bits));
+			}
+			bits = 0;
+			used = 0;
+		}
+
+	private:
+		std::string& out;
+		uint32_t bits = 0;
+		unsigned used = 0;
+	};
+
+	// the fixed literal/length codes from RFC 1951 3.2.6
+	void putSymbol(BitWriter& bits, unsigned symbol)
+	{
+		if (symbol < 144) {
+			bits.putCode(0x30 + symbol, 8);
+		} else if (symbol < 256) {
+			bits.putCode(0x190 + symbol - 144, 9);
+		} else if (symbol < 280) {
+			bits.putCode(symbol - 256, 7);
+		} else {
+			bits.putCode(0xc0 + symbol - 280, 8);
+		}
+	}
+
+	// one block with the fixed codes and the only match ever being a run of
+	// the byte before it. a real LZ77 search isn't worth it for a screen
+	// that's mostly black, runs already get it down to a few K
+	void deflateRuns(const uint8_t* data, size_t size, std::string& out)
+	{
+		static const uint16_t lengthBase[29] = {
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+		static const uint8_t lengthExtra[29] = {
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+		BitWriter bits(out);
+		// last block, fixed codes
+		bits.put(1, 1);
+		bits.put(1, 2);
+		size_t i = 0;
+		while (i < size) {
+			size_t run = 0;
+			if (i > 0) {
+				while (run < 258 && i + run < size && data[i + run] == data[i - 1]) {
+					run++;
+				}
+			}
+			if (run < 3) {
+				putSymbol(bits, data[i]);
+				i++;
+				continue;
+			}
+			unsigned code = 28;
+			while (lengthBase[code] > run) {
+				code--;
+			}
+			putSymbol(bits, 257 + code);
+			bits.put(static_cast<uint32_t>(run - lengthBase[code]), lengthExtra[code]);
+			// distance 1 is code 0 with no extra bits
+			bits.putCode(0, 5);
+			i += run;
+		}
+		putSymbol(bits, 256);
+		bits.flush();
+	}
+
+	void putChunk(std::string& out, const char* type, const std::string& data)
+	{
+		putBigEndian(out, static_cast<uint32_t>(data.size()));
+		size_t start = out.size();
+		out.append(type, 4);
+		out += data;
+		putBigEndian(out, crc32(reinterpret_cast<const uint8_t*>(out.data() + start), out.size() - start));
+	}
+
+	// BT.601 studio range, what Y4M readers assume when nothing says otherwise
+	void toYuv(const uint8_t* rgb, uint8_t* yuv)
+	{
+		int r = rgb[0], g = rgb[1], b = rgb[2];
+		yuv[0] = static_cast<uint8_t>(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+		// 128 folded in before the shift so it never sees a negative number
+		yuv[1] = static_cast<uint8_t>((-38 * r - 74 * g + 112 * b + 128 + (128 << 8)) >> 8);
+		yuv[2] = static_cast<uint8_t>((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8);
+	}
+}
+
+FrameCapture::FrameCapture(const std::string& path, CaptureFormat format, size_t poolSize, bool lossless,
+	PixelFormat rawFormat, bool overlay)
+	: format(format), path(path), lossless(lossless),
+	  renderer(format == CaptureFormat::Raw ? rawFormat : PixelFormat::Indexed8, overlay),
+	  queued(poolSize), spare(poolSize)
+{
+	if (poolSize == 0) {
+		throw std::runtime_error("capture needs at least one buffer");
+	}
+	if (format == CaptureFormat::Png) {
+		if (path.find('#') == std::string::npos) {
+			throw std::runtime_error("PNG capture needs a # in the file name for the frame number");
+		}
+	} else {
+		stream.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+		if (!stream) {
+			throw std::runtime_error("can't open " + path);
+		}
+		if (format == CaptureFormat::Y4m) {
+			stream << "YUV4MPEG2 W" << SCREEN_WIDTH << " H" << SCREEN_HEIGHT << " F60:1 Ip A1:1 C444\n";
+		}
+	}
+
+	pool.reset(new Frame[poolSize]);
+	for (size_t i = 0; i < poolSize; i++) {
+		spare.push(&pool[i]);
+	}
+	writer = std::thread(&FrameCapture::write, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+	try {
+		finish();
+	} catch (...) {
+	}
+}
+
+bool FrameCapture::submit(const Bus& bus, uint64_t number)
+{
+	Frame* frame;
+	bool got = writer.joinable() && spare.pop(frame);
+	while (!got && lossless && writer.joinable()) {
+		// same as the writer's sleep, the timeout covers a missed notify
+		std::unique_lock<std::mutex> guard(spareLock);
+		freed.wait_for(guard, std::chrono::milliseconds(1), [this] { return !spare.empty(); });
+		got = spare.pop(frame);
+	}
+	if (!got) {
+		framesDropped++;
+		return false;
+	}
+	frame->number = number;
+	for (unsigned offset = 0; offset < INVADERS_VRAM_SIZE; offset += PAGE_SIZE) {
+		uint16_t address = static_cast<uint16_t>(INVADERS_VRAM_START + offset);
+		const uint8_t* page = bus.readPage(static_cast<uint8_t>(address >> 8));
+		if (page) {
+			std::memcpy(frame->vram + offset, page, PAGE_SIZE);
+		} else {
+			for (unsigned i = 0; i < PAGE_SIZE; i++) {
+				frame->vram[offset + i] = bus.read(static_cast<uint16_t>(address + i));
+			}
+		}
+	}
+	queued.push(frame);
+	wake.notify_one();
+	return true;
+}
+
+void FrameCapture::finish()
+{
+	if (writer.joinable()) {
+		stopping.store(true);
+		wake.notify_one();
+		writer.join();
+		if (stream.is_open()) {
+			stream.close();
+			if (!stream && !error) {
+				error = std::make_exception_ptr(std::runtime_error("can't write " + path));
+			}
+		}
+	}
+	if (error) {
+		std::exception_ptr e = error;
+		error = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+
+void FrameCapture::write()
+{
+	for (;;) {
+		// anything pushed before stopping was set is still drained below
+		bool stop = stopping.load();
+		Frame* frame;
+		while (queued.pop(frame)) {
+			// after an error buffers still go back so submit() keeps going
+			if (!error) {
+				try {
+					encode(*frame);
+					framesWritten.fetch_add(1, std::memory_order_relaxed);
+				} catch (...) {
+					error = std::current_exception();
+				}
+			}
+			spare.push(frame);
+			freed.notify_one();
+		}
+		if (stop) {
+			return;
+		}
+		// submit() doesn't take the lock, so a wakeup can slip in between
+		// the check and the wait, the timeout catches that
+		std::unique_lock<std::mutex> guard(sleepLock);
+		wake.wait_for(guard, std::chrono::milliseconds(1), [this] {
+			return !queued.empty() || stopping.load();
+		});
+	}
+}
+
+void FrameCapture::encode(const Frame& frame)
+{
+	renderer.render(frame.vram);
+	switch (format) {
+		case CaptureFormat::Raw:
+			stream.write(reinterpret_cast<const char*>(renderer.pixels()), static_cast<std::streamsize>(renderer.size()));
+			break;
+		case CaptureFormat::Png:
+			writePng(frame.number);
+			return;
+		case CaptureFormat::Y4m:
+			writeY4m();
+			break;
+	}
+	if (!stream) {
+		throw std::runtime_error("can't write " + path);
+	}
+}
+
+void FrameCapture::writePng(uint64_t number)
+{
+	// the run of # becomes the frame number
+	std::string name = path;
+	size_t first = name.find('#');
+	size_t count = name.find_first_not_of('#', first);
+	count = (count == std::string::npos ? name.size() : count) - first;
+	std::string digits = std::to_string(number);
+	if (digits.size() < count) {
+		digits.insert(0, count - digits.size(), '0');
+	}
+	name.replace(first, count, digits);
+
+	// filter type 0 in front of every row
+	rows.resize((SCREEN_WIDTH + 1) * SCREEN_HEIGHT);
+	for (unsigned y = 0; y < SCREEN_HEIGHT; y++) {
+		rows[y * (SCREEN_WIDTH + 1)] = 0;
+		std::memcpy(&rows[y * (SCREEN_WIDTH + 1) + 1], renderer.pixels() + y * renderer.pitch(), SCREEN_WIDTH);
+	}
+
+	encoded.assign("\x89PNG\r\n\x1a\n", 8);
+	std::string chunk;
+	putBigEndian(chunk, SCREEN_WIDTH);
+	putBigEndian(chunk, SCREEN_HEIGHT);
+	// 8 bit, palette, deflate, no filtering tricks, not interlaced
+	chunk.append("\x08\x03\x00\x00\x00", 5);
+	putChunk(encoded, "IHDR", chunk);
+	chunk.clear();
+	for (const uint8_t* colour : PALETTE) {
+		chunk.append(reinterpret_cast<const char*>(colour), 3);
+	}
+	putChunk(encoded, "PLTE", chunk);
+	// zlib, deflate with a 32K window, fastest level, no dictionary
+	chunk.assign("\x78\x01", 2);
+	deflateRuns(rows.data(), rows.size(), chunk);
+	putBigEndian(chunk, adler32(rows.data(), rows.size()));
+	putChunk(encoded, "IDAT", chunk);
+	putChunk(encoded, "IEND", std::string());
+
+	std::ofstream file(name, std::ios::binary | std::ios::out | std::ios::trunc);
+	file.write(encoded.data(), static_cast<std::streamsize>(encoded.size()));
+	if (!file) {
+		throw std::runtime_error("can't write " + name);
+	}
+}
+
+void FrameCapture::writeY4m()
+{
+	uint8_t yuv[4][3];
+	for (unsigned i = 0; i < 4; i++) {
+		toYuv(PALETTE[i], yuv[i]);
+	}
+	const size_t plane = SCREEN_WIDTH * SCREEN_HEIGHT;
+	encoded.assign("FRAME\n");
+	size_t start = encoded.size();
+	encoded.resize(start + plane * 3);
+	const uint8_t* pixels = renderer.pixels();
+	for (size_t i = 0; i < plane; i++) {
+		const uint8_t* colour = yuv[pixels[i]];
+		encoded[start + i] = static_cast<char>(colour[0]);
+		encoded[start + plane + i] = static_cast<char>(colour[1]);
+		encoded[start + plane * 2 + i] = static_cast<char>(colour[2]);
+	}
+	stream.write(encoded.data(), static_cast<std::streamsize>(encoded.size()));
+}
+
+}
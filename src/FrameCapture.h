@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "InvadersMachine.h"
+#include "InvadersRenderer.h"
+#include "SpscQueue.h"
+
+namespace p8080 {
+
+enum class CaptureFormat {
+	// frames back to back in one file, pixels as the renderer gives them
+	Raw,
+	// a palette PNG per frame
+	Png,
+	// one YUV4MPEG2 stream, 4:4:4 at 60 fps, ffmpeg and most players take it
+	Y4m,
+};
+
+// writes every frame handed to it to disk without holding up the emulation
+//
+// submit() only copies video RAM into a buffer from a pool and pushes it
+// on a queue, a writer thread renders it and does the encoding and the
+// I/O, then hands the buffer back on a second queue. the writer never
+// waits on submit(). when every buffer is in use a lossless capture waits
+// for the writer to hand one back, otherwise the frame is dropped and
+// counted. either way memory is poolSize * 7K plus one picture no matter
+// how far behind the disk gets, and the emulation never touches the disk
+class FrameCapture {
+public:
+	// path is the file for Raw and Y4m. for Png it's a name with a run of
+	// # in it, which the frame number replaces, zero padded to as many digits
+	// as there are #. rawFormat only matters for Raw, the others are always
+	// indexed. lossless makes submit() wait for a buffer instead of
+	// dropping the frame, so every frame ends up on disk
+	FrameCapture(const std::string& path, CaptureFormat format, size_t poolSize = 16, bool lossless = false,
+		PixelFormat rawFormat = PixelFormat::Rgba32, bool overlay = true);
+	// finish(), but anything the writer threw is lost
+	~FrameCapture();
+	FrameCapture(const FrameCapture&) = delete;
+	FrameCapture& operator=(const FrameCapture&) = delete;
+
+	// queue the screen as it is now as frame number frame, false if the
+	// frame had to be dropped, which a lossless capture only does after
+	// finish()
+	bool submit(const Bus& bus, uint64_t frame);
+	bool submit(const InvadersMachine& machine) { return submit(machine.cpu.bus, machine.screen.frames); }
+
+	// wait for everything queued to be written and stop the writer, rethrows
+	// the first error it ran into. nothing can be submitted after it
+	void finish();
+
+	uint64_t written() const { return framesWritten.load(std::memory_order_relaxed); }
+	uint64_t dropped() const { return framesDropped; }
+
+private:
+	struct Frame {
+		uint64_t number;
+		uint8_t vram[INVADERS_VRAM_SIZE];
+	};
+
+	void write();
+	void encode(const Frame& frame);
+	void writePng(uint64_t number);
+	void writeY4m();
+
+	CaptureFormat format;
+	std::string path;
+	bool lossless;
+	InvadersRenderer renderer;
+	std::ofstream stream;
+
+	std::unique_ptr<Frame[]> pool;
+	// full ones going to the writer and empty ones coming back
+	SpscQueue<Frame*> queued;
+	SpscQueue<Frame*> spare;
+
+	std::thread writer;
+	// only for the writer to sleep on, submit() never takes it
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	// and for submit() to sleep on in a lossless capture, the writer never
+	// takes it
+	std::mutex spareLock;
+	std::condition_variable freed;
+	std::atomic<bool> stopping{false};
+	std::atomic<uint64_t> framesWritten{0};
+	uint64_t framesDropped = 0;
+	std::exception_ptr error;
+	// what the encoders build a frame in before it's written
+	std::vector<uint8_t> rows;
+	std::string encoded;
+};
+
+}
@@ -0,0 +1,108 @@
+#include "InvadersIO.h"
+#include <algorithm>
+
+namespace p8080 {
+
+void InvadersIO::attach(Ports& ports)
+{
+	ports.mapIn<InvadersIO, &InvadersIO::readInput>(0, this);
+	ports.mapIn<InvadersIO, &InvadersIO::readInput>(1, this);
+	ports.mapIn<InvadersIO, &InvadersIO::readInput>(2, this);
+	ports.mapIn<InvadersIO, &InvadersIO::readShift>(3, this);
+
+	ports.mapOut<InvadersIO, &InvadersIO::writeShiftAmount>(2, this);
+	ports.mapOut<InvadersIO, &InvadersIO::writeSound>(3, this);
+	ports.mapOut<InvadersIO, &InvadersIO::writeShiftData>(4, this);
+	ports.mapOut<InvadersIO, &InvadersIO::writeSound>(5, this);
+	ports.mapOut<InvadersIO, &InvadersIO::writeWatchdog>(6, this);
+}
+
+InvadersIO::State InvadersIO::save() const
+{
+	State state;
+	std::copy(inputs, inputs + 3, state.inputs);
+	std::copy(sound, sound + 2, state.sound);
+	state.shiftAmount = shiftAmount;
+	state.shift = shift;
+	return state;
+}
+
+void InvadersIO::load(const State& state)
+{
+	std::copy(state.inputs, state.inputs + 3, inputs);
+	std::copy(state.sound, state.sound + 2, sound);
+	shiftAmount = state.shiftAmount;
+	shift = state.shift;
+}
+
+uint8_t InvadersIO::readInput(uint8_t port)
+{
+	return inputs[port];
+}
+
+uint8_t InvadersIO::readShift(uint8_t)
+{
+	return static_cast<uint8_t>(shift >> (8 - shiftAmount));
+}
+
+void InvadersIO::writeShiftAmount(uint8_t, uint8_t value)
+{
+	shiftAmount = value & 0x7;
+}
+
+void InvadersIO::writeShiftData(uint8_t, uint8_t value)
+{
+	// new byte goes in on top, the old top byte moves down
+	shift = static_cast<uint16_t>((value << 8) | (shift >> 8));
+}
+
+void InvadersIO::writeSound(uint8_t port, uint8_t value)
+{
+	sound[port == 3 ? 0 : 1] = value;
+}
+
+void InvadersIO::writeWatchdog(uint8_t, uint8_t)
+{
+	// nothing to reset, the emulator doesn't hang
+}
+
+
+void InvadersScreen::attach(State8080& state)
+{
+	cpu = &state;
+	cpu->scheduler.schedule(cpu->cycles + INVADERS_FRAME_CYCLES / 2, &InvadersScreen::midScreen, this);
+	nextEnd = cpu->cycles + INVADERS_FRAME_CYCLES;
+	cpu->scheduler.schedule(nextEnd, &InvadersScreen::endOfScreen, this);
+}
+
+void InvadersScreen::restore(uint64_t count, uint64_t frameEnd)
+{
+	frames = count;
+	nextEnd = frameEnd;
+	// mid screen is half a frame after the last end, if it's still due this frame
+	uint64_t mid = nextEnd - INVADERS_FRAME_CYCLES + INVADERS_FRAME_CYCLES / 2;
+	if (mid <= cpu->cycles) {
+		mid += INVADERS_FRAME_CYCLES;
+	}
+	cpu->scheduler.clear();
+	cpu->scheduler.schedule(mid, &InvadersScreen::midScreen, this);
+	cpu->scheduler.schedule(nextEnd, &InvadersScreen::endOfScreen, this);
+}
+
+void InvadersScreen::midScreen(void* ctx, uint64_t when)
+{
+	InvadersScreen* screen = static_cast<InvadersScreen*>(ctx);
+	screen->cpu->interrupt(1);
+	screen->cpu->scheduler.schedule(when + INVADERS_FRAME_CYCLES, &InvadersScreen::midScreen, screen);
+}
+
+void InvadersScreen::endOfScreen(void* ctx, uint64_t when)
+{
+	InvadersScreen* screen = static_cast<InvadersScreen*>(ctx);
+	screen->frames++;
+	screen->cpu->interrupt(2);
+	screen->nextEnd = when + INVADERS_FRAME_CYCLES;
+	screen->cpu->scheduler.schedule(screen->nextEnd, &InvadersScreen::endOfScreen, screen);
+}
+
+}
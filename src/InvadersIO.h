@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+
+#include "8080.h"
+#include "Ports.h"
+
+namespace p8080 {
+
+// 2 MHz cpu, 60 Hz screen
+constexpr uint64_t INVADERS_CLOCK_HZ = 2000000;
+constexpr uint64_t INVADERS_FRAME_CYCLES = INVADERS_CLOCK_HZ / 60;
+
+// input port 1
+constexpr uint8_t INPUT_CREDIT   = 0b00000001;
+constexpr uint8_t INPUT_P2_START = 0b00000010;
+constexpr uint8_t INPUT_P1_START = 0b00000100;
+constexpr uint8_t INPUT_P1_SHOT  = 0b00010000;
+constexpr uint8_t INPUT_P1_LEFT  = 0b00100000;
+constexpr uint8_t INPUT_P1_RIGHT = 0b01000000;
+// input port 2
+constexpr uint8_t INPUT_DIP_SHIPS = 0b00000011;
+constexpr uint8_t INPUT_TILT      = 0b00000100;
+constexpr uint8_t INPUT_DIP_BONUS = 0b00001000;
+constexpr uint8_t INPUT_P2_SHOT   = 0b00010000;
+constexpr uint8_t INPUT_P2_LEFT   = 0b00100000;
+constexpr uint8_t INPUT_P2_RIGHT  = 0b01000000;
+constexpr uint8_t INPUT_DIP_COIN  = 0b10000000;
+
+// Space Invaders cabinet I/O
+//  IN  0-2  inputs
+//  IN  3    shift register result
+//  OUT 2    shift amount
+//  OUT 3,5  sound
+//  OUT 4    shift data
+//  OUT 6    watchdog
+class InvadersIO {
+public:
+	// everything the board latches, for save states
+	struct State {
+		uint8_t inputs[3];
+		uint8_t sound[2];
+		uint8_t shiftAmount;
+		uint16_t shift;
+	};
+
+	// raw input ports 0-2, bits as the hardware sees them, 1 is pressed
+	uint8_t inputs[3] = {0b00001110, 0b00001000, 0b00000000};
+	// last values written to sound ports 3 and 5
+	uint8_t sound[2] = {0, 0};
+
+	void attach(Ports& ports);
+	State save() const;
+	void load(const State& state);
+
+	uint8_t readInput(uint8_t port);
+	uint8_t readShift(uint8_t port);
+	void writeShiftAmount(uint8_t port, uint8_t value);
+	void writeShiftData(uint8_t port, uint8_t value);
+	void writeSound(uint8_t port, uint8_t value);
+	void writeWatchdog(uint8_t port, uint8_t value);
+
+private:
+	// the game shifts 16 bit values one byte at a time to draw sprites
+	// at any x, since the 8080 has no barrel shifter
+	uint16_t shift = 0;
+	uint8_t shiftAmount = 0;
+};
+
+// video timing, RST 1 when the beam is halfway down the screen and RST 2
+// when it reaches the end, the game redraws the half the beam is not on
+class InvadersScreen {
+public:
+	// frames since attach, counted at the end of screen interrupt
+	uint64_t frames = 0;
+
+	void attach(State8080& cpu);
+	// cycle the current frame ends on
+	uint64_t frameEnd() const { return nextEnd; }
+	// pick the timing back up from a save state, replaces every event the
+	// cpu had scheduled
+	void restore(uint64_t frames, uint64_t frameEnd);
+
+private:
+	static void midScreen(void* ctx, uint64_t when);
+	static void endOfScreen(void* ctx, uint64_t when);
+
+	State8080* cpu = nullptr;
+	uint64_t nextEnd = 0;
+};
+
+}
@@ -0,0 +1,187 @@
+#include "InvadersMachine.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "RomSet.h"
+
+namespace p8080 {
+
+namespace {
+	// the Midway set, as MAME has it
+	const std::vector<RomFile> ROM_SET = {
+		{"invaders.h", 0x0000, 0x800, 0x734f5ad8},
+		{"invaders.g", 0x0800, 0x800, 0x6bfaca4a},
+		{"invaders.f", 0x1000, 0x800, 0x0ccead96},
+		{"invaders.e", 0x1800, 0x800, 0x14e538b0},
+	};
+
+	// a single image gets checked a chip at a time
+	void verifyImage(const std::string& path, const std::vector<uint8_t>& image)
+	{
+		for (const RomFile& rom : ROM_SET) {
+			if (crc32(image.data() + rom.address, rom.size) != rom.crc) {
+				throw std::runtime_error(path + " doesn't match " + rom.name + " of the Midway set");
+			}
+		}
+	}
+
+	// power on RAM, every machine starts out reading this
+	const SharedImage& blankRam()
+	{
+		static const SharedImage blank = std::make_shared<const std::vector<uint8_t>>(INVADERS_RAM_SIZE);
+		return blank;
+	}
+}
+
+InvadersMachine::InvadersMachine()
+	: InvadersMachine(std::make_shared<const std::vector<uint8_t>>(INVADERS_ROM_SIZE))
+{
+}
+
+InvadersMachine::InvadersMachine(SharedImage rom)
+	: cpu(0), ram(cpu.bus)
+{
+	setRom(std::move(rom));
+	mapRam(blankRam());
+	// only A0-A12 and A13 for ROM/RAM are decoded, so past 0x4000 it's RAM over and over
+	for (unsigned page = 0x40; page < PAGE_COUNT; page += INVADERS_RAM_SIZE / PAGE_SIZE) {
+		cpu.bus.mapMirror(static_cast<uint8_t>(page), INVADERS_RAM_SIZE / PAGE_SIZE, INVADERS_RAM_START >> 8);
+	}
+
+	io.attach(cpu.ports);
+	screen.attach(cpu);
+	// nothing is watching, so the wait for the next interrupt can be skipped
+	cpu.skipIdle = true;
+}
+
+void InvadersMachine::loadRom(const std::vector<uint8_t>& image)
+{
+	setRom(std::make_shared<const std::vector<uint8_t>>(image));
+}
+
+void InvadersMachine::loadRomSet(const std::string& directory)
+{
+	setRom(readRomSet(directory, ROM_SET, INVADERS_ROM_SIZE));
+}
+
+void InvadersMachine::loadRomFile(const std::string& path)
+{
+	setRom(std::make_shared<const std::vector<uint8_t>>(readFile(path)));
+}
+
+void InvadersMachine::setRom(SharedImage image)
+{
+	if (!image || image->size() != INVADERS_ROM_SIZE) {
+		throw std::runtime_error("ROM image has to be 8K");
+	}
+	romImage = std::move(image);
+	// writes to ROM go nowhere, same as on the board
+	cpu.bus.mapRom(0x00, INVADERS_ROM_SIZE / PAGE_SIZE, romImage->data());
+}
+
+SharedImage InvadersMachine::readRom(const std::string& path, bool verify)
+{
+	if (FILE* probe = std::fopen((path + "/" + ROM_SET[0].name).c_str(), "rb")) {
+		std::fclose(probe);
+		return readRomSet(path, ROM_SET, INVADERS_ROM_SIZE, verify);
+	}
+	std::vector<uint8_t> image = readFile(path);
+	if (image.size() != INVADERS_ROM_SIZE) {
+		throw std::runtime_error("ROM image has to be 8K");
+	}
+	if (verify) {
+		verifyImage(path, image);
+	}
+	return std::make_shared<const std::vector<uint8_t>>(std::move(image));
+}
+
+void InvadersMachine::runFrames(uint64_t n)
+{
+	uint64_t target = screen.frames + n;
+	while (screen.frames < target && cpu.status != Status::Error) {
+		// the end of screen event is the deadline, so this stops right on it
+		uint64_t end = screen.frameEnd();
+		cpu.runCycles(end > cpu.cycles ? end - cpu.cycles : 1);
+	}
+}
+
+void InvadersMachine::mapRam(SharedImage image)
+{
+	ramImage = std::move(image);
+	ram.map(INVADERS_RAM_START >> 8, INVADERS_RAM_SIZE / PAGE_SIZE, ramImage);
+}
+
+uint32_t InvadersMachine::dirtyRam() const
+{
+	static_assert(INVADERS_RAM_START == 0x2000 && INVADERS_RAM_SIZE == 0x2000, "folding assumes 32 page RAM mirrored every 32 pages");
+	// 0x2000-0x3fff is the top half of the first word, the rest is all mirrors
+	const uint64_t* mask = cpu.bus.dirtyMask();
+	uint64_t dirty = mask[0] >> 32;
+	for (unsigned i = 1; i < PAGE_COUNT / 64; i++) {
+		dirty |= mask[i] | (mask[i] >> 32);
+	}
+	return static_cast<uint32_t>(dirty);
+}
+
+SnapshotHeader InvadersMachine::saveHeader()
+{
+	SnapshotHeader header = {};
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.cpu = cpu.save();
+	header.io = io.save();
+	header.frames = screen.frames;
+	header.frameEnd = screen.frameEnd();
+	return header;
+}
+
+Snapshot InvadersMachine::save()
+{
+	static_assert(SNAPSHOT_RAM_PAGES == INVADERS_RAM_SIZE / PAGE_SIZE, "snapshot RAM has to match the board");
+
+	Snapshot snapshot;
+	snapshot.header = saveHeader();
+	snapshot.base = ramImage;
+
+	// a page that was never copied still matches the base
+	snapshot.pages.reserve(ram.copied() * PAGE_SIZE);
+	for (unsigned i = 0; i < SNAPSHOT_RAM_PAGES; i++) {
+		uint8_t page = static_cast<uint8_t>((INVADERS_RAM_START >> 8) + i);
+		if (ram.isCopied(page)) {
+			snapshot.header.dirty |= 1u << i;
+			const uint8_t* data = cpu.bus.readPage(page);
+			snapshot.pages.insert(snapshot.pages.end(), data, data + PAGE_SIZE);
+		}
+	}
+	return snapshot;
+}
+
+void InvadersMachine::load(const Snapshot& snapshot)
+{
+	if (snapshot.base && snapshot.base != ramImage) {
+		mapRam(snapshot.base);
+	}
+	// copies already there get written over instead of made again
+	for (unsigned i = 0; i < SNAPSHOT_RAM_PAGES; i++) {
+		uint8_t page = static_cast<uint8_t>((INVADERS_RAM_START >> 8) + i);
+		if (snapshot.header.dirty & (1u << i)) {
+			std::memcpy(ram.own(page), snapshot.ramPage(i), PAGE_SIZE);
+		} else {
+			ram.drop(page);
+		}
+	}
+
+	cpu.load(snapshot.header.cpu);
+	io.load(snapshot.header.io);
+	screen.restore(snapshot.header.frames, snapshot.header.frameEnd);
+}
+
+void InvadersMachine::readVideoRam(uint8_t* out) const
+{
+	for (unsigned offset = 0; offset < INVADERS_VRAM_SIZE; offset += PAGE_SIZE) {
+		std::memcpy(out + offset, cpu.bus.readPage(static_cast<uint8_t>((INVADERS_VRAM_START + offset) >> 8)), PAGE_SIZE);
+	}
+}
+
+}
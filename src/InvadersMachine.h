@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "8080.h"
+#include "CowMemory.h"
+#include "InvadersIO.h"
+#include "Snapshot.h"
+
+namespace p8080 {
+
+// memory map, same as the emulator101 guide
+//  0x0000-0x1fff  ROM, invaders.h g f e
+//  0x2000-0x23ff  work RAM
+//  0x2400-0x3fff  video RAM, 1 bit per pixel, rotated
+//  0x4000-        RAM mirror
+constexpr uint16_t INVADERS_ROM_SIZE   = 0x2000;
+constexpr uint16_t INVADERS_RAM_START  = 0x2000;
+constexpr uint16_t INVADERS_RAM_SIZE   = 0x2000;
+constexpr uint16_t INVADERS_VRAM_START = 0x2400;
+constexpr uint16_t INVADERS_VRAM_SIZE  = 0x1c00;
+
+// the whole cabinet, cpu, ROM, RAM, I/O and video timing, with nothing
+// tying it to real time or a display
+//
+// the ROM is a SharedImage that every machine loaded from the same one
+// points at, RAM starts out shared too and pages get copied on the first
+// write, so a fresh machine costs a few hundred bytes plus the RAM it uses
+class InvadersMachine {
+public:
+	State8080 cpu;
+	InvadersIO io;
+	InvadersScreen screen;
+
+	// no ROM, everything reads 0 until one is loaded
+	InvadersMachine();
+	explicit InvadersMachine(SharedImage rom);
+	// devices point back into the machine
+	InvadersMachine(const InvadersMachine&) = delete;
+	InvadersMachine& operator=(const InvadersMachine&) = delete;
+
+	// 8K image of the four ROMs back to back
+	void loadRom(const std::vector<uint8_t>& image);
+	// invaders.h, invaders.g, invaders.f and invaders.e from a directory
+	void loadRomSet(const std::string& directory);
+	// a single file with the whole 8K image
+	void loadRomFile(const std::string& path);
+	// share an image someone else loaded, has to be 8K
+	void setRom(SharedImage image);
+	const SharedImage& rom() const { return romImage; }
+
+	// read image from a file or a directory with the ROM set, for handing
+	// the same ROM to a lot of machines. verify checks it against the CRCs
+	// of the Midway set, chip by chip
+	static SharedImage readRom(const std::string& path, bool verify = false);
+
+	// run n frames as fast as the host allows, stops early if the cpu
+	// ends up in Status::Error
+	void runFrames(uint64_t n);
+	// run whole frames until done(*this) returns true or maxFrames went by,
+	// returns how many frames were run
+	template<class Predicate>
+	uint64_t runUntil(Predicate done, uint64_t maxFrames = UINT64_MAX)
+	{
+		uint64_t ran = 0;
+		while (ran < maxFrames && !done(*this)) {
+			runFrames(1);
+			ran++;
+		}
+		return ran;
+	}
+
+	// RAM pages only exist once written, so video RAM is copied out,
+	// out needs INVADERS_VRAM_SIZE bytes
+	void readVideoRam(uint8_t* out) const;
+	// RAM pages this machine has its own copy of
+	unsigned ramPages() const { return ram.copied(); }
+	// bit per RAM page written since the last trackRam(), through any mirror
+	uint32_t dirtyRam() const;
+	// start over tracking writes, see Bus::protect()
+	void trackRam() { cpu.bus.protect(); }
+
+	// everything but RAM and ROM, dirty is left 0
+	SnapshotHeader saveHeader();
+	// everything but the ROM, RAM as the pages written since the last load
+	// against the image that load mapped
+	Snapshot save();
+	// RAM goes back to sharing the snapshot's base with only its dirty pages
+	// copied in, so restoring a flattened snapshot copies nothing
+	void load(const Snapshot& snapshot);
+
+private:
+	void mapRam(SharedImage image);
+
+	SharedImage romImage;
+	// what RAM pages read from until they're written
+	SharedImage ramImage;
+	CowMemory ram;
+};
+
+}
@@ -0,0 +1,381 @@
+#include "InvadersRenderer.h"
+#include <cstring>
+
+#if defined __SSE2__ || defined _M_X64
+	#define P8080_RENDER_SSE2
+	#include <emmintrin.h>
+#endif
+// AVX2 gets compiled in either way and picked at runtime
+#if defined P8080_RENDER_SSE2 && defined __GNUC__
+	#define P8080_RENDER_AVX2
+	#define P8080_TARGET_AVX2 __attribute__((target("avx2")))
+	#include <immintrin.h>
+#endif
+
+namespace p8080 {
+
+const uint8_t PALETTE[4][4] = {
+	{0x00, 0x00, 0x00, 0xff},
+	{0xff, 0xff, 0xff, 0xff},
+	{0xff, 0x20, 0x20, 0xff},
+	{0x20, 0xff, 0x20, 0xff},
+};
+
+namespace {
+	// the strips on the cabinet, red where the saucer flies and green over
+	// the bases, the player and the ships left but not the credit count
+	uint8_t overlayColour(unsigned x, unsigned y)
+	{
+		if (y >= 32 && y < 64) {
+			return COLOUR_RED;
+		}
+		if ((y >= 184 && y < 240) || (y >= 240 && x >= 16 && x < 134)) {
+			return COLOUR_GREEN;
+		}
+		return COLOUR_WHITE;
+	}
+
+	// byte i of the result has bit j set if byte j of x has bit i set
+	uint64_t transpose8x8(uint64_t x)
+	{
+		uint64_t t;
+		t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaull;
+		x ^= t ^ (t << 7);
+		t = (x ^ (x >> 14)) & 0x0000cccc0000ccccull;
+		x ^= t ^ (t << 14);
+		t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ull;
+		x ^= t ^ (t << 28);
+		return x;
+	}
+
+	// out gets fg where a bit is set and bg where it isn't, bit 0 of the
+	// first byte is the leftmost pixel
+	template<unsigned BPP>
+	void expandScalar(const uint8_t* bits, unsigned bytes, const uint8_t* fg, const uint8_t* bg, uint8_t* out)
+	{
+		for (unsigned i = 0; i < bytes * 8; i++) {
+			const uint8_t* from = (bits[i >> 3] >> (i & 7)) & 1 ? fg : bg;
+			std::memcpy(out + i * BPP, from + i * BPP, BPP);
+		}
+	}
+
+#ifdef P8080_RENDER_SSE2
+	__m128i blend(__m128i mask, const uint8_t* fg, const uint8_t* bg)
+	{
+		__m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(fg));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bg));
+		return _mm_or_si128(_mm_and_si128(mask, f), _mm_andnot_si128(mask, b));
+	}
+
+	// a byte at a time, 8 pixels are two registers
+	void expandRgbaSse2(const uint8_t* bits, unsigned bytes, const uint8_t* fg, const uint8_t* bg, uint8_t* out)
+	{
+		const __m128i low = _mm_setr_epi32(1, 2, 4, 8);
+		const __m128i high = _mm_setr_epi32(16, 32, 64, 128);
+		for (unsigned i = 0; i < bytes; i++) {
+			__m128i v = _mm_set1_epi32(bits[i]);
+			__m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(v, low), low);
+			__m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(v, high), high);
+			unsigned at = i * 32;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + at), blend(m0, fg + at, bg + at));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + at + 16), blend(m1, fg + at + 16, bg + at + 16));
+		}
+	}
+
+	// two bytes at a time, 16 pixels fill a register
+	void expandIndexedSse2(const uint8_t* bits, unsigned bytes, const uint8_t* fg, const uint8_t* bg, uint8_t* out)
+	{
+		const __m128i select = _mm_set1_epi64x(static_cast<int64_t>(0x8040201008040201ull));
+		unsigned i = 0;
+		for (; i + 2 <= bytes; i += 2) {
+			__m128i v = _mm_unpacklo_epi64(_mm_set1_epi8(static_cast<char>(bits[i])), _mm_set1_epi8(static_cast<char>(bits[i + 1])));
+			__m128i m = _mm_cmpeq_epi8(_mm_and_si128(v, select), select);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 8), blend(m, fg + i * 8, bg + i * 8));
+		}
+		expandScalar<1>(bits + i, bytes - i, fg + i * 8, bg + i * 8, out + i * 8);
+	}
+
+	// xor of every line of 32 bytes against the copy, folded into one line
+	// so byte k says whether group k changed, and the copy brought up to date
+	uint32_t changedSse2(const uint8_t* const* pages, uint8_t* last, unsigned count)
+	{
+		__m128i d0 = _mm_setzero_si128();
+		__m128i d1 = _mm_setzero_si128();
+		for (unsigned c = 0; c < count; c++) {
+			for (unsigned at = 0; at < PAGE_SIZE; at += 32) {
+				__m128i* copy = reinterpret_cast<__m128i*>(last + c * PAGE_SIZE + at);
+				__m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pages[c] + at));
+				__m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pages[c] + at + 16));
+				d0 = _mm_or_si128(d0, _mm_xor_si128(a0, _mm_loadu_si128(copy)));
+				d1 = _mm_or_si128(d1, _mm_xor_si128(a1, _mm_loadu_si128(copy + 1)));
+				_mm_storeu_si128(copy, a0);
+				_mm_storeu_si128(copy + 1, a1);
+			}
+		}
+		__m128i zero = _mm_setzero_si128();
+		uint32_t same = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(d0, zero)))
+			| static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(d1, zero))) << 16;
+		return ~same;
+	}
+
+	// the same thing transpose8x8() does, for all 32 groups of a page at once.
+	// unpacking the 8 lines of the page together leaves the 8 bytes of a
+	// group next to each other, two groups to a register, and movemask then
+	// picks one bit out of each, which is a row of the picture. groups not
+	// in the mask are left alone
+	void transposeSse2(const uint8_t* page, unsigned c, uint32_t groups, uint8_t (*rows)[28])
+	{
+		for (unsigned half = 0; half < 2; half++) {
+			if (!(groups >> (half * 16) & 0xffff)) {
+				continue;
+			}
+			__m128i l[8];
+			for (unsigned j = 0; j < 8; j++) {
+				l[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(page + j * 32 + half * 16));
+			}
+			__m128i a[8], b[8], pairs[8];
+			for (unsigned j = 0; j < 4; j++) {
+				a[j] = _mm_unpacklo_epi8(l[j * 2], l[j * 2 + 1]);
+				a[j + 4] = _mm_unpackhi_epi8(l[j * 2], l[j * 2 + 1]);
+			}
+			for (unsigned j = 0; j < 2; j++) {
+				b[j] = _mm_unpacklo_epi16(a[j * 2], a[j * 2 + 1]);
+				b[j + 2] = _mm_unpackhi_epi16(a[j * 2], a[j * 2 + 1]);
+				b[j + 4] = _mm_unpacklo_epi16(a[j * 2 + 4], a[j * 2 + 5]);
+				b[j + 6] = _mm_unpackhi_epi16(a[j * 2 + 4], a[j * 2 + 5]);
+			}
+			for (unsigned j = 0; j < 4; j++) {
+				pairs[j * 2] = _mm_unpacklo_epi32(b[j * 2], b[j * 2 + 1]);
+				pairs[j * 2 + 1] = _mm_unpackhi_epi32(b[j * 2], b[j * 2 + 1]);
+			}
+			// pairs[i] is groups 2i and 2i+1 of this half
+			for (unsigned i = 0; i < 8; i++) {
+				unsigned group = half * 16 + i * 2;
+				if (!(groups >> group & 3)) {
+					continue;
+				}
+				__m128i v = pairs[i];
+				for (int bit = 7; bit >= 0; bit--) {
+					unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(v));
+					rows[SCREEN_HEIGHT - 1 - (group * 8 + bit)][c] = static_cast<uint8_t>(mask);
+					rows[SCREEN_HEIGHT - 1 - ((group + 1) * 8 + bit)][c] = static_cast<uint8_t>(mask >> 8);
+					v = _mm_add_epi8(v, v);
+				}
+			}
+		}
+	}
+#endif
+
+#ifdef P8080_RENDER_AVX2
+	P8080_TARGET_AVX2 __m256i blend256(__m256i mask, const uint8_t* fg, const uint8_t* bg)
+	{
+		__m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(fg));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bg));
+		return _mm256_blendv_epi8(b, f, mask);
+	}
+
+	// a byte at a time, 8 pixels are one register
+	P8080_TARGET_AVX2 void expandRgbaAvx2(const uint8_t* bits, unsigned bytes, const uint8_t* fg, const uint8_t* bg, uint8_t* out)
+	{
+		const __m256i select = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+		for (unsigned i = 0; i < bytes; i++) {
+			__m256i v = _mm256_set1_epi32(bits[i]);
+			__m256i m = _mm256_cmpeq_epi32(_mm256_and_si256(v, select), select);
+			unsigned at = i * 32;
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + at), blend256(m, fg + at, bg + at));
+		}
+	}
+
+	// four bytes at a time, each one copied into the 8 lanes it covers
+	P8080_TARGET_AVX2 void expandIndexedAvx2(const uint8_t* bits, unsigned bytes, const uint8_t* fg, const uint8_t* bg, uint8_t* out)
+	{
+		const __m256i spread = _mm256_setr_epi8(
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+			2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+		const __m256i select = _mm256_set1_epi64x(static_cast<int64_t>(0x8040201008040201ull));
+		unsigned i = 0;
+		for (; i + 4 <= bytes; i += 4) {
+			uint32_t word;
+			std::memcpy(&word, bits + i, 4);
+			__m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32(static_cast<int>(word)), spread);
+			__m256i m = _mm256_cmpeq_epi8(_mm256_and_si256(v, select), select);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 8), blend256(m, fg + i * 8, bg + i * 8));
+		}
+		expandScalar<1>(bits + i, bytes - i, fg + i * 8, bg + i * 8, out + i * 8);
+	}
+#endif
+}
+
+InvadersRenderer::InvadersRenderer(PixelFormat format, bool overlay, RenderKernel kernel)
+	: pixelFormat(format), kernel(kernel)
+{
+	// asking for more than the cpu has gets the best it has
+	if (kernel > bestKernel()) {
+		this->kernel = bestKernel();
+	}
+	bytesPerPixel = format == PixelFormat::Rgba32 ? 4 : 1;
+	frame.reset(new uint8_t[size()]);
+	background.reset(new uint8_t[pitch()]);
+
+	// every row is one of these four
+	const unsigned rowsAt[] = {0, 32, 184, 240};
+	const unsigned kinds = sizeof(rowsAt) / sizeof(rowsAt[0]);
+	foreground.reset(new uint8_t[pitch() * kinds]);
+	for (unsigned kind = 0; kind < kinds; kind++) {
+		uint8_t* row = foreground.get() + kind * pitch();
+		for (unsigned x = 0; x < SCREEN_WIDTH; x++) {
+			uint8_t colour = overlay ? overlayColour(x, rowsAt[kind]) : COLOUR_WHITE;
+			if (format == PixelFormat::Rgba32) {
+				std::memcpy(row + x * 4, PALETTE[colour], 4);
+			} else {
+				row[x] = colour;
+			}
+		}
+	}
+	for (unsigned y = 0; y < SCREEN_HEIGHT; y++) {
+		// same bands as overlayColour()
+		unsigned kind = y >= 240 ? 3 : y >= 184 ? 2 : y >= 32 && y < 64 ? 1 : 0;
+		rowForeground[y] = foreground.get() + kind * pitch();
+	}
+	for (unsigned x = 0; x < SCREEN_WIDTH; x++) {
+		if (format == PixelFormat::Rgba32) {
+			std::memcpy(background.get() + x * 4, PALETTE[COLOUR_BLACK], 4);
+		} else {
+			background[x] = COLOUR_BLACK;
+		}
+	}
+}
+
+RenderKernel InvadersRenderer::bestKernel()
+{
+#ifdef P8080_RENDER_AVX2
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	if (avx2) {
+		return RenderKernel::Avx2;
+	}
+#endif
+#ifdef P8080_RENDER_SSE2
+	return RenderKernel::Sse2;
+#else
+	return RenderKernel::Scalar;
+#endif
+}
+
+unsigned InvadersRenderer::render(const Bus& bus)
+{
+	const uint8_t* pages[ROW_BYTES];
+	// handler pages have to be read a byte at a time
+	uint8_t slow[ROW_BYTES][PAGE_SIZE];
+	for (unsigned c = 0; c < ROW_BYTES; c++) {
+		uint8_t page = static_cast<uint8_t>(0x24 + c);
+		pages[c] = bus.readPage(page);
+		if (!pages[c]) {
+			for (unsigned i = 0; i < PAGE_SIZE; i++) {
+				slow[c][i] = bus.read(static_cast<uint16_t>(page << 8 | i));
+			}
+			pages[c] = slow[c];
+		}
+	}
+	return render(pages);
+}
+
+unsigned InvadersRenderer::render(const uint8_t* vram)
+{
+	const uint8_t* pages[ROW_BYTES];
+	for (unsigned c = 0; c < ROW_BYTES; c++) {
+		pages[c] = vram + c * PAGE_SIZE;
+	}
+	return render(pages);
+}
+
+unsigned InvadersRenderer::render(const uint8_t* const* pages)
+{
+	uint32_t groups = changedGroups(pages);
+	if (!valid) {
+		groups = 0xffffffff;
+		valid = true;
+	}
+	transpose(pages, groups);
+	drawn = 0;
+	for (unsigned group = 0; group < COLUMN_BYTES; group++) {
+		if (groups & (1u << group)) {
+			for (unsigned b = 0; b < 8; b++) {
+				unsigned y = SCREEN_HEIGHT - 1 - (group * 8 + b);
+				expandRow(bits[y], y);
+			}
+			drawn += 8;
+		}
+	}
+	return drawn;
+}
+
+uint32_t InvadersRenderer::changedGroups(const uint8_t* const* pages)
+{
+#ifdef P8080_RENDER_SSE2
+	if (kernel != RenderKernel::Scalar) {
+		return changedSse2(pages, last, ROW_BYTES);
+	}
+#endif
+	uint32_t groups = 0;
+	for (unsigned c = 0; c < ROW_BYTES; c++) {
+		uint8_t* copy = last + c * PAGE_SIZE;
+		for (unsigned i = 0; i < PAGE_SIZE; i++) {
+			if (pages[c][i] != copy[i]) {
+				groups |= 1u << (i % COLUMN_BYTES);
+				copy[i] = pages[c][i];
+			}
+		}
+	}
+	return groups;
+}
+
+// group g is bits 8g to 8g+7 of every column, which is rows 255-8g going up
+void InvadersRenderer::transpose(const uint8_t* const* pages, uint32_t groups)
+{
+	for (unsigned c = 0; c < ROW_BYTES; c++) {
+#ifdef P8080_RENDER_SSE2
+		if (kernel != RenderKernel::Scalar) {
+			transposeSse2(pages[c], c, groups, bits);
+			continue;
+		}
+#endif
+		for (unsigned group = 0; group < COLUMN_BYTES; group++) {
+			if (!(groups & (1u << group))) {
+				continue;
+			}
+			uint64_t columns = 0;
+			for (unsigned j = 0; j < 8; j++) {
+				columns |= static_cast<uint64_t>(pages[c][j * COLUMN_BYTES + group]) << (j * 8);
+			}
+			uint64_t rows = transpose8x8(columns);
+			for (unsigned b = 0; b < 8; b++) {
+				bits[SCREEN_HEIGHT - 1 - (group * 8 + b)][c] = static_cast<uint8_t>(rows >> (b * 8));
+			}
+		}
+	}
+}
+
+void InvadersRenderer::expandRow(const uint8_t* bits, unsigned y)
+{
+	uint8_t* out = frame.get() + y * pitch();
+	const uint8_t* fg = rowForeground[y];
+	const uint8_t* bg = background.get();
+	bool rgba = pixelFormat == PixelFormat::Rgba32;
+	switch (kernel) {
+#ifdef P8080_RENDER_AVX2
+		case RenderKernel::Avx2:
+			rgba ? expandRgbaAvx2(bits, ROW_BYTES, fg, bg, out) : expandIndexedAvx2(bits, ROW_BYTES, fg, bg, out);
+			return;
+#endif
+#ifdef P8080_RENDER_SSE2
+		case RenderKernel::Sse2:
+			rgba ? expandRgbaSse2(bits, ROW_BYTES, fg, bg, out) : expandIndexedSse2(bits, ROW_BYTES, fg, bg, out);
+			return;
+#endif
+		default:
+			rgba ? expandScalar<4>(bits, ROW_BYTES, fg, bg, out) : expandScalar<1>(bits, ROW_BYTES, fg, bg, out);
+			return;
+	}
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+
+#include "Bus.h"
+
+namespace p8080 {
+
+// the monitor is mounted turned 90 degrees, so the picture is 224 wide and
+// 256 tall while video RAM has 224 lines of 256 pixels
+constexpr unsigned SCREEN_WIDTH  = 224;
+constexpr unsigned SCREEN_HEIGHT = 256;
+
+enum class PixelFormat {
+	// 4 bytes per pixel, R G B A in memory order
+	Rgba32,
+	// 1 byte per pixel, one of the COLOUR_ values
+	Indexed8,
+};
+
+// Indexed8 pixels, RGBA for each one is in PALETTE
+constexpr uint8_t COLOUR_BLACK = 0;
+constexpr uint8_t COLOUR_WHITE = 1;
+constexpr uint8_t COLOUR_RED   = 2;
+constexpr uint8_t COLOUR_GREEN = 3;
+extern const uint8_t PALETTE[4][4];
+
+// which bit expansion code render() uses, they all give the same pixels
+enum class RenderKernel {
+	Scalar,
+	Sse2,
+	Avx2,
+};
+
+// turns video RAM into a framebuffer the right way up, with the coloured
+// cellophane strips the cabinet has over the monitor if overlay is set
+//
+// every byte of video RAM is 8 pixels of one column, so 8 columns next to
+// each other are a 8x8 bit transpose away from 8 rows of the picture. a
+// page of video RAM is exactly 8 columns, which keeps the gathering inside
+// one page. render() keeps a copy of what it drew last and only redraws the
+// groups of 8 rows where some byte changed
+class InvadersRenderer {
+public:
+	explicit InvadersRenderer(PixelFormat format = PixelFormat::Rgba32, bool overlay = true,
+		RenderKernel kernel = bestKernel());
+
+	// straight out of the bus pages 0x24-0x3f, no copy needed
+	unsigned render(const Bus& bus);
+	// INVADERS_VRAM_SIZE bytes laid out like video RAM, like readVideoRam() gives
+	unsigned render(const uint8_t* vram);
+	// next render() draws every row
+	void invalidate() { valid = false; }
+
+	// SCREEN_HEIGHT rows of pitch() bytes, top row first
+	const uint8_t* pixels() const { return frame.get(); }
+	size_t pitch() const { return SCREEN_WIDTH * bytesPerPixel; }
+	size_t size() const { return pitch() * SCREEN_HEIGHT; }
+	PixelFormat format() const { return pixelFormat; }
+	// rows the last render() drew
+	unsigned rowsDrawn() const { return drawn; }
+
+	// fastest one this cpu runs
+	static RenderKernel bestKernel();
+
+private:
+	// SCREEN_WIDTH / 8
+	static constexpr unsigned ROW_BYTES = 28;
+	// a page of video RAM, 8 columns of 32 bytes
+	static constexpr unsigned COLUMN_BYTES = 32;
+
+	unsigned render(const uint8_t* const* pages);
+	uint32_t changedGroups(const uint8_t* const* pages);
+	// picture rows of the groups set in groups into bits
+	void transpose(const uint8_t* const* pages, uint32_t groups);
+	void expandRow(const uint8_t* bits, unsigned y);
+
+	PixelFormat pixelFormat;
+	RenderKernel kernel;
+	unsigned bytesPerPixel;
+	std::unique_ptr<uint8_t[]> frame;
+	// foreground pixels per distinct overlay row, and which one each row uses
+	std::unique_ptr<uint8_t[]> foreground;
+	const uint8_t* rowForeground[SCREEN_HEIGHT] = {};
+	// a row of black, for the SIMD kernels to blend against
+	std::unique_ptr<uint8_t[]> background;
+	// the picture at 1 bit per pixel, bit 0 of the first byte on the left
+	uint8_t bits[SCREEN_HEIGHT][ROW_BYTES] = {};
+	// video RAM as of the last render(), page after page
+	uint8_t last[ROW_BYTES * PAGE_SIZE] = {};
+	bool valid = false;
+	unsigned drawn = 0;
+};
+
+}
@@ -0,0 +1,1217 @@
+#include "Jit.h"
+#include "8080.h"
+
+#ifdef P8080_JIT
+
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+#endif
+
+namespace p8080 {
+
+namespace {
+	enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+	// byte registers, only ever used without a REX prefix
+	enum ByteReg { AL, CL, DL, BL, AH };
+
+	enum Cond { CC_O, CC_NO, CC_B, CC_AE, CC_Z, CC_NZ, CC_BE, CC_A };
+	// /digit of the 0x80 group, also opcode >> 3 of the register forms
+	enum Alu { ALU_ADD, ALU_OR, ALU_ADC, ALU_SBB, ALU_AND, ALU_SUB, ALU_XOR, ALU_CMP };
+	enum Shift { SH_ROL, SH_ROR, SH_RCL, SH_RCR, SH_SHL, SH_SHR };
+
+#ifdef _WIN32
+	constexpr int ARG0 = RCX, ARG1 = RDX, ARG2 = R8;
+#else
+	constexpr int ARG0 = RDI, ARG1 = RSI, ARG2 = RDX;
+#endif
+	// home space for callees on win64 and a slot for RET and POP
+	constexpr int FRAME = 48;
+	constexpr int SCRATCH = 32;
+
+	// most instructions in a block, and the most code one can take, cold
+	// paths included
+	constexpr unsigned MAX_INSTRUCTIONS = 64;
+	constexpr size_t MAX_BLOCK_BYTES = 16 << 10;
+
+	// just enough of an x86-64 assembler, registers are numbered as above
+	// and memory operands are always [base + disp]
+	class Asm {
+	public:
+		uint8_t* p;
+
+		explicit Asm(uint8_t* at) : p(at) {}
+
+		void byte(unsigned b) { *p++ = static_cast<uint8_t>(b); }
+		void dword(uint32_t v) { std::memcpy(p, &v, 4); p += 4; }
+		void qword(uint64_t v) { std::memcpy(p, &v, 8); p += 8; }
+
+		void rex(bool w, int reg, int index, int base)
+		{
+			unsigned r = 0x40 | (w ? 8 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+			if (r != 0x40) {
+				byte(r);
+			}
+		}
+		void modrm(int mod, int reg, int rm) { byte((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+		void mem(int reg, int base, int32_t disp)
+		{
+			bool short8 = disp >= -128 && disp < 128;
+			modrm(short8 ? 1 : 2, reg, base);
+			if ((base & 7) == RSP) {
+				byte(0x24);
+			}
+			if (short8) {
+				byte(static_cast<uint8_t>(disp));
+			} else {
+				dword(static_cast<uint32_t>(disp));
+			}
+		}
+		// [base + index * scale]
+		void sib(int reg, int base, int index, int scale)
+		{
+			int ss = scale == 8 ? 3 : 0;
+			if ((base & 7) == RBP) {
+				modrm(1, reg, 4);
+				byte((ss << 6) | ((index & 7) << 3) | (base & 7));
+				byte(0);
+			} else {
+				modrm(0, reg, 4);
+				byte((ss << 6) | ((index & 7) << 3) | (base & 7));
+			}
+		}
+
+		// loads and stores
+		void movzxb(int dst, int base, int32_t disp) { rex(false, dst, 0, base); byte(0x0f); byte(0xb6); mem(dst, base, disp); }
+		void movzxw(int dst, int base, int32_t disp) { rex(false, dst, 0, base); byte(0x0f); byte(0xb7); mem(dst, base, disp); }
+		void loadd(int dst, int base, int32_t disp) { rex(false, dst, 0, base); byte(0x8b); mem(dst, base, disp); }
+		void loadq(int dst, int base, int32_t disp) { rex(true, dst, 0, base); byte(0x8b); mem(dst, base, disp); }
+		void storeb(int base, int32_t disp, int src) { rex(false, src, 0, base); byte(0x88); mem(src, base, disp); }
+		void storew(int base, int32_t disp, int src) { byte(0x66); rex(false, src, 0, base); byte(0x89); mem(src, base, disp); }
+		void stored(int base, int32_t disp, int src) { rex(false, src, 0, base); byte(0x89); mem(src, base, disp); }
+		void storebi(int base, int32_t disp, uint8_t imm) { rex(false, 0, 0, base); byte(0xc6); mem(0, base, disp); byte(imm); }
+		void storewi(int base, int32_t disp, uint16_t imm)
+		{
+			byte(0x66);
+			rex(false, 0, 0, base);
+			byte(0xc7);
+			mem(0, base, disp);
+			byte(imm & 0xff);
+			byte(imm >> 8);
+		}
+		void leaq(int dst, int base, int32_t disp) { rex(true, dst, 0, base); byte(0x8d); mem(dst, base, disp); }
+		// mov reg, [base + index * 8]
+		void loadqsib(int dst, int base, int index) { rex(true, dst, index, base); byte(0x8b); sib(dst, base, index, 8); }
+		// movzx reg, byte [base + index]
+		void movzxbsib(int dst, int base, int index) { rex(false, dst, index, base); byte(0x0f); byte(0xb6); sib(dst, base, index, 1); }
+		// mov byte [base + index], reg
+		void storebsib(int base, int index, int src) { rex(false, src, index, base); byte(0x88); sib(src, base, index, 1); }
+
+		// register moves
+		void movdri(int dst, uint32_t imm) { rex(false, 0, 0, dst); byte(0xb8 + (dst & 7)); dword(imm); }
+		void movqri(int dst, uint64_t imm) { rex(true, 0, 0, dst); byte(0xb8 + (dst & 7)); qword(imm); }
+		void movdrr(int dst, int src) { rex(false, src, 0, dst); byte(0x89); modrm(3, src, dst); }
+		void movqrr(int dst, int src) { rex(true, src, 0, dst); byte(0x89); modrm(3, src, dst); }
+		void movzxbrr(int dst, int src) { rex(false, dst, 0, src); byte(0x0f); byte(0xb6); modrm(3, dst, src); }
+
+		// arithmetic
+		void alubrr(int op, int dst, int src) { byte(op << 3); modrm(3, src, dst); }
+		void alubri(int op, int dst, uint8_t imm) { byte(0x80); modrm(3, op, dst); byte(imm); }
+		void aludrr(int op, int dst, int src) { rex(false, src, 0, dst); byte((op << 3) | 1); modrm(3, src, dst); }
+		void aluwrr(int op, int dst, int src) { byte(0x66); aludrr(op, dst, src); }
+		void aludri(int op, int dst, int32_t imm) { rex(false, 0, 0, dst); byte(0x81); modrm(3, op, dst); dword(static_cast<uint32_t>(imm)); }
+		void aluqri(int op, int dst, int32_t imm) { rex(true, 0, 0, dst); byte(0x81); modrm(3, op, dst); dword(static_cast<uint32_t>(imm)); }
+		void alubmi(int op, int base, int32_t disp, uint8_t imm) { rex(false, 0, 0, base); byte(0x80); mem(op, base, disp); byte(imm); }
+		void alubmr(int op, int base, int32_t disp, int src) { rex(false, src, 0, base); byte(op << 3); mem(src, base, disp); }
+		void aluwmi(int op, int base, int32_t disp, int8_t imm)
+		{
+			byte(0x66);
+			rex(false, 0, 0, base);
+			byte(0x83);
+			mem(op, base, disp);
+			byte(static_cast<uint8_t>(imm));
+		}
+		void aluqmi(int op, int base, int32_t disp, int32_t imm) { rex(true, 0, 0, base); byte(0x81); mem(op, base, disp); dword(static_cast<uint32_t>(imm)); }
+		void cmpqrm(int reg, int base, int32_t disp) { rex(true, reg, 0, base); byte(0x3b); mem(reg, base, disp); }
+		void ordrm(int reg, int base, int32_t disp) { rex(false, reg, 0, base); byte(0x0b); mem(reg, base, disp); }
+		void incbr(int reg) { byte(0xfe); modrm(3, 0, reg); }
+		void decbr(int reg) { byte(0xfe); modrm(3, 1, reg); }
+		void incbm(int base, int32_t disp) { rex(false, 0, 0, base); byte(0xfe); mem(0, base, disp); }
+		void decbm(int base, int32_t disp) { rex(false, 0, 0, base); byte(0xfe); mem(1, base, disp); }
+		void notbm(int base, int32_t disp) { rex(false, 0, 0, base); byte(0xf6); mem(2, base, disp); }
+		void incwm(int base, int32_t disp) { byte(0x66); rex(false, 0, 0, base); byte(0xff); mem(0, base, disp); }
+		void decwm(int base, int32_t disp) { byte(0x66); rex(false, 0, 0, base); byte(0xff); mem(1, base, disp); }
+		void shiftbr1(int op, int reg) { byte(0xd0); modrm(3, op, reg); }
+		void shiftbm1(int op, int base, int32_t disp) { rex(false, 0, 0, base); byte(0xd0); mem(op, base, disp); }
+		void shiftdri(int op, int reg, uint8_t n) { rex(false, 0, 0, reg); byte(0xc1); modrm(3, op, reg); byte(n); }
+		void shiftwri(int op, int reg, uint8_t n) { byte(0x66); shiftdri(op, reg, n); }
+		void testbmi(int base, int32_t disp, uint8_t imm) { rex(false, 0, 0, base); byte(0xf6); mem(0, base, disp); byte(imm); }
+		void testdrr(int a, int b) { rex(false, b, 0, a); byte(0x85); modrm(3, b, a); }
+		void testqrr(int a, int b) { rex(true, b, 0, a); byte(0x85); modrm(3, b, a); }
+		void setcc(int cc, int reg) { byte(0x0f); byte(0x90 + cc); modrm(3, 0, reg); }
+		void lahf() { byte(0x9f); }
+
+		// control flow
+		void push(int reg) { rex(false, 0, 0, reg); byte(0x50 + (reg & 7)); }
+		void pop(int reg) { rex(false, 0, 0, reg); byte(0x58 + (reg & 7)); }
+		void ret() { byte(0xc3); }
+		void jmpr(int reg) { rex(false, 0, 0, reg); byte(0xff); modrm(3, 4, reg); }
+		void callr(int reg) { rex(false, 0, 0, reg); byte(0xff); modrm(3, 2, reg); }
+		void call(const void* fn) { movqri(RAX, reinterpret_cast<uint64_t>(fn)); callr(RAX); }
+		// forward jumps, return where the rel32 goes for patch()
+		uint8_t* jcc(int cc) { byte(0x0f); byte(0x80 + cc); dword(0); return p - 4; }
+		uint8_t* jmp() { byte(0xe9); dword(0); return p - 4; }
+		void jcc(int cc, const uint8_t* to) { patch(jcc(cc), to); }
+		void jmp(const uint8_t* to) { patch(jmp(), to); }
+
+		static void patch(uint8_t* at, const uint8_t* to)
+		{
+			int32_t rel = static_cast<int32_t>(to - (at + 4));
+			std::memcpy(at, &rel, 4);
+		}
+	};
+
+	int32_t offsetOf(const State8080& cpu, const void* field)
+	{
+		return static_cast<int32_t>(static_cast<const uint8_t*>(field) - reinterpret_cast<const uint8_t*>(&cpu));
+	}
+
+	// where a block has to stop
+	bool endsBlock(uint8_t op)
+	{
+		return op == 0xC3 || op == 0xCD || op == 0xC9 || op == 0xE9	// JMP CALL RET PCHL
+			|| (op & 0xC7) == 0xC2 || (op & 0xC7) == 0xC4			// Jcc Ccc
+			|| (op & 0xC7) == 0xC0 || (op & 0xC7) == 0xC7;			// Rcc RST
+	}
+
+	// left to the interpreter, HLT has to stop the run loop, DAA and XTHL
+	// are rare enough not to bother
+	bool interpretOnly(uint8_t op)
+	{
+		return op == 0x76 || op == 0x27 || op == 0xE3;
+	}
+
+	// flag bit a condition code tests, NZ Z NC C PO PE P M
+	constexpr uint8_t CONDITION_FLAG[4] = {FLAG_Z, FLAG_CY, FLAG_P, FLAG_S};
+}
+
+// turns one block into code at a given spot, cold paths (slow memory
+// access, early exits) go after the hot code so the common case falls
+// straight through
+class Jit::Translator {
+public:
+	// linkable if other blocks may jump straight into this one
+	Translator(Jit& jit, State8080& cpu, uint8_t* at, bool linkable)
+		: jit(jit), cpu(cpu), L(jit.layout), a(at), linkable(linkable)
+	{
+	}
+
+	uint8_t* end() const { return a.p; }
+
+	// nullptr if not even the first instruction can be done here
+	const uint8_t* block(uint16_t pc, const uint8_t* page)
+	{
+		struct Instruction {
+			uint16_t pc;
+			uint8_t op;
+			uint8_t b1;
+			uint8_t b2;
+		};
+		first = pc;
+		Instruction list[MAX_INSTRUCTIONS];
+		unsigned count = 0;
+		unsigned offset = pc & 0xff;
+		while (count < MAX_INSTRUCTIONS) {
+			uint8_t op = page[offset];
+			unsigned len = LENGTH[op];
+			if (offset + len > PAGE_SIZE || interpretOnly(op)) {
+				break;
+			}
+			Instruction& in = list[count++];
+			in.pc = static_cast<uint16_t>((pc & 0xff00) | offset);
+			in.op = op;
+			in.b1 = len > 1 ? page[offset + 1] : 0;
+			in.b2 = len > 2 ? page[offset + 2] : 0;
+			offset += len;
+			if (endsBlock(op) || offset == PAGE_SIZE) {
+				break;
+			}
+		}
+		if (count == 0) {
+			return nullptr;
+		}
+
+		total = 0;
+		for (unsigned i = 0; i < count; i++) {
+			total += CYCLES[list[i].op];
+		}
+		const Instruction& last = list[count - 1];
+		uint16_t end = static_cast<uint16_t>(last.pc + LENGTH[last.op]);
+		uint32_t iteration;
+		uint8_t reads;
+		idleLoop = cpu.skipIdle && cpu.idleBody(pc, end, iteration, reads);
+		if (idleLoop) {
+			jit.idleLoops[pc] = end;
+		}
+		// every way in has eax = pc, and a write that threw blocks away
+		// may have been on the way here
+		const uint8_t* start = a.p;
+		a.storew(RBX, L.pc, RAX);
+		a.testdrr(RBP, RBP);
+		a.jcc(CC_NZ, jit.exitMiss);
+		// the last instruction may finish past the deadline, same as the interpreter
+		a.loadq(RAX, RBX, L.cycles);
+		a.aluqri(ALU_ADD, RAX, static_cast<int32_t>(total - CYCLES[list[count - 1].op]));
+		a.cmpqrm(RAX, RBX, L.deadline);
+		a.jcc(CC_AE, jit.exitDeadline);
+
+		done = 0;
+		for (unsigned i = 0; i < count; i++) {
+			const Instruction& in = list[i];
+			done += CYCLES[in.op];
+			wrote = false;
+			next = static_cast<uint16_t>(in.pc + LENGTH[in.op]);
+			instruction(in.op, in.b1, in.b2);
+			if (wrote && !endsBlock(in.op) && i + 1 < count) {
+				// the write may have been to this very block
+				a.testdrr(RBP, RBP);
+				exitIf(CC_NZ, next, done);
+			}
+		}
+		if (!endsBlock(list[count - 1].op)) {
+			a.aluqmi(ALU_ADD, RBX, L.cycles, static_cast<int32_t>(total));
+			dispatchTo(next);
+		}
+		for (uint8_t* site : loops) {
+			Asm::patch(site, start);
+		}
+
+		for (auto& emit : cold) {
+			emit();
+		}
+		return start;
+	}
+
+private:
+	Jit& jit;
+	State8080& cpu;
+	const Layout& L;
+	Asm a;
+	std::vector<std::function<void()>> cold;
+	// jumps back to the start of this block, patched once it's done
+	std::vector<uint8_t*> loops;
+	uint16_t first = 0;
+	bool linkable = false;
+	// the block is a loop the cpu could skip, the jump back goes to C++
+	bool idleLoop = false;
+	// cycles for the whole block, and up to the end of the current instruction
+	uint32_t total = 0;
+	uint32_t done = 0;
+	uint16_t next = 0;
+	bool wrote = false;
+
+	int32_t reg(unsigned r) const { return L.reg[r]; }
+	// high half of BC DE HL, the low half follows it
+	int32_t pair(unsigned p) const { return L.reg[p * 2]; }
+
+	void addCycles(uint32_t n)
+	{
+		if (n) {
+			a.aluqmi(ALU_ADD, RBX, L.cycles, static_cast<int32_t>(n));
+		}
+	}
+	void subCycles(uint32_t n)
+	{
+		if (n) {
+			a.aluqmi(ALU_SUB, RBX, L.cycles, static_cast<int32_t>(n));
+		}
+	}
+
+	// leave with pc at exitPc and the cycles it took to get there
+	void exitIf(int cc, uint16_t exitPc, uint32_t cycles)
+	{
+		uint8_t* jump = a.jcc(cc);
+		cold.push_back([this, jump, exitPc, cycles] {
+			Asm::patch(jump, a.p);
+			addCycles(cycles);
+			a.storewi(RBX, L.pc, exitPc);
+			a.movdri(RAX, EXIT_MISS);
+			a.jmp(jit.exit);
+		});
+	}
+
+	// BC DE HL into dst
+	void loadPair(int dst, unsigned p)
+	{
+		a.movzxw(dst, RBX, pair(p));
+		a.shiftwri(SH_ROL, dst, 8);
+	}
+	void storePair(unsigned p, int src)
+	{
+		a.shiftwri(SH_ROL, src, 8);
+		a.storew(RBX, pair(p), src);
+	}
+
+	// eax = [eax]
+	void read()
+	{
+		a.movdrr(RDX, RAX);
+		a.shiftdri(SH_SHR, RDX, 8);
+		a.loadqsib(RDX, R14, RDX);
+		a.testqrr(RDX, RDX);
+		uint8_t* slow = a.jcc(CC_Z);
+		a.movzxbrr(RAX, AL);
+		a.movzxbsib(RAX, RDX, RAX);
+		const uint8_t* back = a.p;
+		uint32_t cycles = done;
+		cold.push_back([this, slow, back, cycles] {
+			Asm::patch(slow, a.p);
+			addCycles(cycles);
+			a.movdrr(ARG1, RAX);
+			a.movqrr(ARG0, RBX);
+			a.call(reinterpret_cast<const void*>(&Jit::busRead));
+			subCycles(cycles);
+			a.jmp(back);
+		});
+	}
+
+	// [eax] = cl
+	void write()
+	{
+		a.movdrr(RDX, RAX);
+		a.shiftdri(SH_SHR, RDX, 8);
+		a.loadqsib(RDX, R13, RDX);
+		a.testqrr(RDX, RDX);
+		uint8_t* slow = a.jcc(CC_Z);
+		a.movzxbrr(RAX, AL);
+		a.storebsib(RDX, RAX, CL);
+		const uint8_t* back = a.p;
+		uint32_t cycles = done;
+		cold.push_back([this, slow, back, cycles] {
+			Asm::patch(slow, a.p);
+			addCycles(cycles);
+			a.movdrr(ARG2, RCX);
+			a.movdrr(ARG1, RAX);
+			a.movqrr(ARG0, RBX);
+			a.call(reinterpret_cast<const void*>(&Jit::busWrite));
+			subCycles(cycles);
+			a.aludrr(ALU_OR, RBP, RAX);
+			a.jmp(back);
+		});
+		wrote = true;
+	}
+
+	// eax = [HL]
+	void readHL()
+	{
+		loadPair(RAX, 2);
+		read();
+	}
+	// [HL] = cl
+	void writeHL()
+	{
+		loadPair(RAX, 2);
+		write();
+	}
+
+	// push cl, then dl was pushed first
+	void pushByte(int offset)
+	{
+		a.movzxw(RAX, RBX, L.sp);
+		a.aludri(ALU_SUB, RAX, offset);
+		a.aludri(ALU_AND, RAX, 0xffff);
+		write();
+	}
+	void pushWord(uint16_t value)
+	{
+		a.movdri(RCX, value >> 8);
+		pushByte(1);
+		a.movdri(RCX, value & 0xff);
+		pushByte(2);
+		a.aluwmi(ALU_SUB, RBX, L.sp, 2);
+	}
+	// pops into eax
+	void popWord()
+	{
+		a.movzxw(RAX, RBX, L.sp);
+		read();
+		a.stored(RSP, SCRATCH, RAX);
+		a.movzxw(RAX, RBX, L.sp);
+		a.aludri(ALU_ADD, RAX, 1);
+		a.aludri(ALU_AND, RAX, 0xffff);
+		read();
+		a.shiftdri(SH_SHL, RAX, 8);
+		a.ordrm(RAX, RSP, SCRATCH);
+		a.aluwmi(ALU_ADD, RBX, L.sp, 2);
+	}
+
+	// cc = ah masked, with the old carry kept, for INR and DCR
+	void keepCarry()
+	{
+		a.alubri(ALU_AND, AH, FLAG_ALL & ~FLAG_CY);
+		a.movzxb(RDX, RBX, L.cc);
+		a.alubri(ALU_AND, DL, FLAG_CY);
+		a.alubrr(ALU_OR, AH, DL);
+		a.storeb(RBX, L.cc, AH);
+	}
+	// CY from the host carry, everything else stays
+	void carryOnly()
+	{
+		a.setcc(CC_B, DL);
+		a.alubmi(ALU_AND, RBX, L.cc, static_cast<uint8_t>(~FLAG_CY));
+		a.alubmr(ALU_OR, RBX, L.cc, DL);
+	}
+	// host carry = CY
+	void loadCarry()
+	{
+		a.movzxb(RDX, RBX, L.cc);
+		a.shiftbr1(SH_SHR, DL);
+	}
+
+	// A op= cl, x86 and 8080 flags sit in the same bits so lahf does most of it
+	void alu(unsigned op)
+	{
+		a.movzxb(RAX, RBX, reg(7));
+		switch (op) {
+			case 0: // ADD
+				a.alubrr(ALU_ADD, AL, CL);
+				a.lahf();
+				a.alubri(ALU_AND, AH, FLAG_ALL);
+				break;
+			case 1: // ADC
+				loadCarry();
+				a.alubrr(ALU_ADC, AL, CL);
+				a.lahf();
+				a.alubri(ALU_AND, AH, FLAG_ALL);
+				break;
+			case 2: // SUB
+			case 7: // CMP
+				a.alubrr(ALU_SUB, AL, CL);
+				a.lahf();
+				// AC is the inverse of the borrow, see computeFlags
+				a.alubri(ALU_XOR, AH, FLAG_AC);
+				a.alubri(ALU_AND, AH, FLAG_ALL);
+				break;
+			case 3: // SBB
+				loadCarry();
+				a.alubrr(ALU_SBB, AL, CL);
+				a.lahf();
+				a.alubri(ALU_XOR, AH, FLAG_AC);
+				a.alubri(ALU_AND, AH, FLAG_ALL);
+				break;
+			case 4: // ANA
+				a.movdrr(RDX, RAX);
+				a.alubrr(ALU_OR, DL, CL);
+				a.alubrr(ALU_AND, AL, CL);
+				a.lahf();
+				a.alubri(ALU_AND, AH, FLAG_S | FLAG_Z | FLAG_P);
+				// AC is bit 3 of either operand
+				a.shiftbr1(SH_SHL, DL);
+				a.alubri(ALU_AND, DL, FLAG_AC);
+				a.alubrr(ALU_OR, AH, DL);
+				break;
+			case 5: // XRA
+			case 6: // ORA
+				a.alubrr(op == 5 ? ALU_XOR : ALU_OR, AL, CL);
+				a.lahf();
+				a.alubri(ALU_AND, AH, FLAG_S | FLAG_Z | FLAG_P);
+				break;
+		}
+		if (op != 7) {
+			a.storeb(RBX, reg(7), AL);
+		}
+		a.storeb(RBX, L.cc, AH);
+	}
+
+	// cl = register or [HL]
+	void source(unsigned r)
+	{
+		if (r == 6) {
+			readHL();
+			a.movdrr(RCX, RAX);
+		} else {
+			a.movzxb(RCX, RBX, reg(r));
+		}
+	}
+
+	void dispatch()
+	{
+		a.jmp(jit.dispatcher);
+	}
+	// known target, jumps straight to its block once there is one
+	void dispatchTo(uint16_t address)
+	{
+		a.movdri(RAX, address);
+		if (address == first && idleLoop) {
+			a.jmp(jit.exitIdle);
+			return;
+		}
+		uint8_t* site = a.jmp();
+		Asm::patch(site, jit.dispatcher);
+		if (address == first && linkable) {
+			loops.push_back(site);
+		} else {
+			jit.link(address, site);
+		}
+	}
+	// jump to taken if the condition in bits 3-5 of op holds
+	uint8_t* branchIf(uint8_t op)
+	{
+		unsigned condition = (op >> 3) & 7;
+		a.testbmi(RBX, L.cc, CONDITION_FLAG[condition >> 1]);
+		return a.jcc(condition & 1 ? CC_NZ : CC_Z);
+	}
+
+	void instruction(uint8_t op, uint8_t b1, uint8_t b2)
+	{
+		uint16_t address = static_cast<uint16_t>(b1 | (b2 << 8));
+		unsigned dst = (op >> 3) & 7;
+		unsigned src = op & 7;
+
+		if (op >= 0x40 && op < 0x80) { // MOV
+			if (dst == 6) {
+				a.movzxb(RCX, RBX, reg(src));
+				writeHL();
+			} else if (src == 6) {
+				readHL();
+				a.storeb(RBX, reg(dst), AL);
+			} else if (dst != src) {
+				a.movzxb(RAX, RBX, reg(src));
+				a.storeb(RBX, reg(dst), AL);
+			}
+			return;
+		}
+		if (op >= 0x80 && op < 0xC0) { // ADD ADC SUB SBB ANA XRA ORA CMP
+			source(src);
+			alu(dst);
+			return;
+		}
+
+		switch (op) {
+			case 0x01: case 0x11: case 0x21: // LXI
+				a.storewi(RBX, pair(op >> 4), static_cast<uint16_t>(b2 | (b1 << 8)));
+				break;
+			case 0x31: // LXI SP
+				a.storewi(RBX, L.sp, address);
+				break;
+			case 0x02: case 0x12: // STAX
+				a.movzxb(RCX, RBX, reg(7));
+				loadPair(RAX, op >> 4);
+				write();
+				break;
+			case 0x0A: case 0x1A: // LDAX
+				loadPair(RAX, op >> 4);
+				read();
+				a.storeb(RBX, reg(7), AL);
+				break;
+			case 0x03: case 0x13: case 0x23: // INX
+				loadPair(RAX, op >> 4);
+				a.aludri(ALU_ADD, RAX, 1);
+				storePair(op >> 4, RAX);
+				break;
+			case 0x33: // INX SP
+				a.incwm(RBX, L.sp);
+				break;
+			case 0x0B: case 0x1B: case 0x2B: // DCX
+				loadPair(RAX, op >> 4);
+				a.aludri(ALU_SUB, RAX, 1);
+				storePair(op >> 4, RAX);
+				break;
+			case 0x3B: // DCX SP
+				a.decwm(RBX, L.sp);
+				break;
+			case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: // INR
+				a.incbm(RBX, reg(dst));
+				a.lahf();
+				keepCarry();
+				break;
+			case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: // DCR
+				a.decbm(RBX, reg(dst));
+				a.lahf();
+				a.alubri(ALU_XOR, AH, FLAG_AC);
+				keepCarry();
+				break;
+			case 0x34: // INR M
+			case 0x35: // DCR M
+				readHL();
+				a.movdrr(RCX, RAX);
+				if (op == 0x34) {
+					a.incbr(CL);
+					a.lahf();
+				} else {
+					a.decbr(CL);
+					a.lahf();
+					a.alubri(ALU_XOR, AH, FLAG_AC);
+				}
+				keepCarry();
+				writeHL();
+				break;
+			case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // MVI
+				a.storebi(RBX, reg(dst), b1);
+				break;
+			case 0x36: // MVI M
+				a.movdri(RCX, b1);
+				writeHL();
+				break;
+			case 0x07: // RLC
+				a.shiftbm1(SH_ROL, RBX, reg(7));
+				carryOnly();
+				break;
+			case 0x0F: // RRC
+				a.shiftbm1(SH_ROR, RBX, reg(7));
+				carryOnly();
+				break;
+			case 0x17: // RAL
+				loadCarry();
+				a.shiftbm1(SH_RCL, RBX, reg(7));
+				carryOnly();
+				break;
+			case 0x1F: // RAR
+				loadCarry();
+				a.shiftbm1(SH_RCR, RBX, reg(7));
+				carryOnly();
+				break;
+			case 0x09: case 0x19: case 0x29: case 0x39: // DAD
+				loadPair(RAX, 2);
+				if (op == 0x39) {
+					a.movzxw(RCX, RBX, L.sp);
+				} else {
+					loadPair(RCX, op >> 4);
+				}
+				a.aluwrr(ALU_ADD, RAX, RCX);
+				a.setcc(CC_B, DL);
+				storePair(2, RAX);
+				a.alubmi(ALU_AND, RBX, L.cc, static_cast<uint8_t>(~FLAG_CY));
+				a.alubmr(ALU_OR, RBX, L.cc, DL);
+				break;
+			case 0x22: // SHLD
+				a.movzxb(RCX, RBX, reg(5));
+				a.movdri(RAX, address);
+				write();
+				a.movzxb(RCX, RBX, reg(4));
+				a.movdri(RAX, static_cast<uint16_t>(address + 1));
+				write();
+				break;
+			case 0x2A: // LHLD
+				a.movdri(RAX, address);
+				read();
+				a.storeb(RBX, reg(5), AL);
+				a.movdri(RAX, static_cast<uint16_t>(address + 1));
+				read();
+				a.storeb(RBX, reg(4), AL);
+				break;
+			case 0x32: // STA
+				a.movzxb(RCX, RBX, reg(7));
+				a.movdri(RAX, address);
+				write();
+				break;
+			case 0x3A: // LDA
+				a.movdri(RAX, address);
+				read();
+				a.storeb(RBX, reg(7), AL);
+				break;
+			case 0x2F: // CMA
+				a.notbm(RBX, reg(7));
+				break;
+			case 0x37: // STC
+				a.alubmi(ALU_OR, RBX, L.cc, FLAG_CY);
+				break;
+			case 0x3F: // CMC
+				a.alubmi(ALU_XOR, RBX, L.cc, FLAG_CY);
+				break;
+			case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // immediate ALU
+				a.movdri(RCX, b1);
+				alu(dst);
+				break;
+			case 0xC1: case 0xD1: case 0xE1: // POP
+				popWord();
+				storePair(dst >> 1, RAX);
+				break;
+			case 0xF1: // POP PSW
+				popWord();
+				a.storeb(RBX, reg(7), AH);
+				a.alubri(ALU_AND, AL, FLAG_ALL);
+				a.storeb(RBX, L.cc, AL);
+				break;
+			case 0xC5: case 0xD5: case 0xE5: // PUSH
+				a.movzxb(RCX, RBX, pair(dst >> 1));
+				pushByte(1);
+				a.movzxb(RCX, RBX, pair(dst >> 1) + 1);
+				pushByte(2);
+				a.aluwmi(ALU_SUB, RBX, L.sp, 2);
+				break;
+			case 0xF5: // PUSH PSW
+				a.movzxb(RCX, RBX, reg(7));
+				pushByte(1);
+				a.movzxb(RCX, RBX, L.cc);
+				a.alubri(ALU_OR, CL, FLAG_PSW_SET);
+				pushByte(2);
+				a.aluwmi(ALU_SUB, RBX, L.sp, 2);
+				break;
+			case 0xEB: // XCHG
+				a.movzxw(RAX, RBX, pair(1));
+				a.movzxw(RCX, RBX, pair(2));
+				a.storew(RBX, pair(1), RCX);
+				a.storew(RBX, pair(2), RAX);
+				break;
+			case 0xF9: // SPHL
+				loadPair(RAX, 2);
+				a.storew(RBX, L.sp, RAX);
+				break;
+			case 0xF3: // DI
+				a.storebi(RBX, L.intEnable, 0);
+				break;
+			case 0xFB: // EI
+				a.storebi(RBX, L.intEnable, 1);
+				break;
+			case 0xD3: // OUT
+				// devices see the same cycle count they would on the interpreter
+				addCycles(done);
+				a.movzxb(ARG2, RBX, reg(7));
+				a.movdri(ARG1, b1);
+				a.movqrr(ARG0, RBX);
+				a.call(reinterpret_cast<const void*>(&Jit::portOut));
+				subCycles(done);
+				a.aludrr(ALU_OR, RBP, RAX);
+				wrote = true;
+				break;
+			case 0xDB: // IN
+				addCycles(done);
+				a.movdri(ARG1, b1);
+				a.movqrr(ARG0, RBX);
+				a.call(reinterpret_cast<const void*>(&Jit::portIn));
+				subCycles(done);
+				a.storeb(RBX, reg(7), AL);
+				break;
+
+			case 0xC3: // JMP
+				addCycles(total);
+				dispatchTo(address);
+				break;
+			case 0xC2: case 0xCA: case 0xD2: case 0xDA: case 0xE2: case 0xEA: case 0xF2: case 0xFA: { // Jcc
+				addCycles(total);
+				uint8_t* taken = branchIf(op);
+				dispatchTo(next);
+				Asm::patch(taken, a.p);
+				dispatchTo(address);
+				break;
+			}
+			case 0xCD: // CALL, timed as a taken Ccc
+				done += CYCLES_BRANCH_TAKEN;
+				pushWord(next);
+				addCycles(total + CYCLES_BRANCH_TAKEN);
+				dispatchTo(address);
+				break;
+			case 0xC4: case 0xCC: case 0xD4: case 0xDC: case 0xE4: case 0xEC: case 0xF4: case 0xFC: { // Ccc
+				uint8_t* taken = branchIf(op);
+				addCycles(total);
+				dispatchTo(next);
+				Asm::patch(taken, a.p);
+				done += CYCLES_BRANCH_TAKEN;
+				pushWord(next);
+				addCycles(total + CYCLES_BRANCH_TAKEN);
+				dispatchTo(address);
+				break;
+			}
+			case 0xC9: // RET
+				popWord();
+				addCycles(total);
+				dispatch();
+				break;
+			case 0xC0: case 0xC8: case 0xD0: case 0xD8: case 0xE0: case 0xE8: case 0xF0: case 0xF8: { // Rcc
+				uint8_t* taken = branchIf(op);
+				addCycles(total);
+				dispatchTo(next);
+				Asm::patch(taken, a.p);
+				done += CYCLES_BRANCH_TAKEN;
+				popWord();
+				addCycles(total + CYCLES_BRANCH_TAKEN);
+				dispatch();
+				break;
+			}
+			case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // RST
+				pushWord(next);
+				addCycles(total);
+				dispatchTo(op & 0x38);
+				break;
+			case 0xE9: // PCHL
+				loadPair(RAX, 2);
+				addCycles(total);
+				dispatch();
+				break;
+
+			// NOP and the undocumented opcodes that act like one
+			default:
+				break;
+		}
+	}
+};
+
+
+Jit::Jit(size_t codeSize)
+	: codeSize(codeSize)
+{
+#ifdef _WIN32
+	void* memory = VirtualAlloc(nullptr, codeSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+	if (!memory) {
+		throw std::runtime_error("can't allocate JIT code buffer");
+	}
+#else
+	void* memory = mmap(nullptr, codeSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		throw std::runtime_error("can't allocate JIT code buffer");
+	}
+#endif
+	code = static_cast<uint8_t*>(memory);
+}
+
+Jit::~Jit()
+{
+#ifdef _WIN32
+	VirtualFree(code, 0, MEM_RELEASE);
+#else
+	munmap(code, codeSize);
+#endif
+}
+
+void Jit::emitStubs(State8080& cpu)
+{
+	const uint8_t* regs[8] = {&cpu.r.b, &cpu.r.c, &cpu.r.d, &cpu.r.e, &cpu.r.h, &cpu.r.l, nullptr, &cpu.r.a};
+	for (unsigned i = 0; i < 8; i++) {
+		layout.reg[i] = regs[i] ? offsetOf(cpu, regs[i]) : 0;
+	}
+	layout.cc = offsetOf(cpu, &cpu.cc);
+	layout.sp = offsetOf(cpu, &cpu.sp);
+	layout.pc = offsetOf(cpu, &cpu.pc);
+	layout.cycles = offsetOf(cpu, &cpu.cycles);
+	layout.deadline = offsetOf(cpu, &cpu.deadline);
+	layout.intEnable = offsetOf(cpu, &cpu.int_enable);
+	layout.readTable = offsetOf(cpu, cpu.bus.readTable());
+	layout.writeTable = offsetOf(cpu, cpu.bus.writeTable());
+
+	Asm a(code);
+
+	// eax = why, unwinds what entry set up
+	exit = a.p;
+	a.aluqri(ALU_ADD, RSP, FRAME);
+	a.pop(R14);
+	a.pop(R13);
+	a.pop(R12);
+	a.pop(RBP);
+	a.pop(RBX);
+	a.ret();
+
+	// eax = pc for these two, it may not have been stored yet
+	exitMiss = a.p;
+	a.storew(RBX, layout.pc, RAX);
+	a.movdri(RAX, EXIT_MISS);
+	a.jmp(exit);
+	exitInterpret = a.p;
+	a.storew(RBX, layout.pc, RAX);
+	a.movdri(RAX, EXIT_INTERPRET);
+	a.jmp(exit);
+	exitIdle = a.p;
+	a.storew(RBX, layout.pc, RAX);
+	a.movdri(RAX, EXIT_IDLE);
+	a.jmp(exit);
+	exitDeadline = a.p;
+	a.movdri(RAX, EXIT_DEADLINE);
+	a.jmp(exit);
+
+	// uint32_t entry(State8080* cpu, const uint8_t* block)
+	// rbx is the cpu, r12-r14 the block and bus tables, ebp is set once a
+	// write threw blocks away
+	entry = a.p;
+	a.push(RBX);
+	a.push(RBP);
+	a.push(R12);
+	a.push(R13);
+	a.push(R14);
+	a.aluqri(ALU_SUB, RSP, FRAME);
+	a.movqrr(RBX, ARG0);
+	a.movqri(R12, reinterpret_cast<uint64_t>(table));
+	a.leaq(R13, RBX, layout.writeTable);
+	a.leaq(R14, RBX, layout.readTable);
+	a.aludrr(ALU_XOR, RBP, RBP);
+	a.movzxw(RAX, RBX, layout.pc);
+	a.jmpr(ARG1);
+
+	// eax = next pc, blocks store it themselves
+	dispatcher = a.p;
+	a.movdrr(RDX, RAX);
+	a.shiftdri(SH_SHR, RDX, 8);
+	a.loadqsib(RDX, R12, RDX);
+	a.testqrr(RDX, RDX);
+	a.jcc(CC_Z, exitMiss);
+	a.movzxbrr(RCX, AL);
+	a.loadqsib(RCX, RDX, RCX);
+	a.testqrr(RCX, RCX);
+	a.jcc(CC_Z, exitMiss);
+	a.jmpr(RCX);
+
+	used = blocksStart = static_cast<size_t>(a.p - code);
+}
+
+void Jit::run(State8080& cpu, uint64_t target)
+{
+	if (!entry) {
+		emitStubs(cpu);
+	}
+	cpu.deadline = target;
+	while (cpu.cycles < cpu.deadline) {
+		const uint8_t* const* page = table[cpu.pc >> 8];
+		const uint8_t* block = page ? page[cpu.pc & 0xff] : nullptr;
+		if (!block) {
+			block = translate(cpu, cpu.pc);
+		}
+
+		uint32_t why = EXIT_INTERPRET;
+		if (block != exitInterpret) {
+			// generated code works on cc directly
+			cpu.writeFlags(cpu.flags());
+			invalidated = false;
+			why = reinterpret_cast<EntryFn>(const_cast<uint8_t*>(entry))(&cpu, block);
+			cpu.writeFlags(cpu.cc);
+			if (pending) {
+				std::exception_ptr e = pending;
+				pending = nullptr;
+				std::rethrow_exception(e);
+			}
+		}
+		if (why == EXIT_INTERPRET) {
+			cpu.dispatch(1, cpu.deadline);
+		} else if (why == EXIT_IDLE) {
+			auto loop = idleLoops.find(cpu.pc);
+			if (cpu.idleArmed && loop != idleLoops.end()) {
+				cpu.idle(cpu.pc, loop->second);
+			}
+		} else if (why == EXIT_DEADLINE) {
+			// less than a block to go, the interpreter stops right on it
+			cpu.dispatch(UINT64_MAX, cpu.deadline);
+		}
+	}
+}
+
+const uint8_t* Jit::translate(State8080& cpu, uint16_t pc)
+{
+	uint8_t page = static_cast<uint8_t>(pc >> 8);
+	const uint8_t* storage = cpu.bus.readPage(page);
+	if (!storage) {
+		// handler pages can change on every read
+		setBlock(pc, exitInterpret);
+		return exitInterpret;
+	}
+	if (codeSize - used < MAX_BLOCK_BYTES) {
+		flush(cpu.bus);
+	}
+
+	// code in RAM the cpu can write directly is only ever reached through
+	// the dispatcher, so dropping it never leaves a jump pointing at it
+	bool linkable = !cpu.bus.writable(page);
+	Translator translator(*this, cpu, code + used, linkable);
+	const uint8_t* block = translator.block(pc, storage);
+	if (!block) {
+		setBlock(pc, exitInterpret);
+		return exitInterpret;
+	}
+	used = static_cast<size_t>(translator.end() - code);
+	setBlock(pc, block);
+	translated++;
+	if (linkable) {
+		auto waiting = unlinked.equal_range(pc);
+		for (auto it = waiting.first; it != waiting.second; ++it) {
+			Asm::patch(it->second, block);
+		}
+		unlinked.erase(waiting.first, waiting.second);
+	}
+
+	this->storage[page] = storage;
+	if (cpu.bus.writable(page) && !ramCode[page]) {
+		// code in RAM, every page showing it has to be watched, mirrors too
+		ramCode[page] = true;
+		for (unsigned p = 0; p < PAGE_COUNT; p++) {
+			if (cpu.bus.readPage(static_cast<uint8_t>(p)) == storage) {
+				cpu.bus.watch(static_cast<uint8_t>(p));
+			}
+		}
+	}
+	return block;
+}
+
+void Jit::setBlock(uint16_t pc, const uint8_t* block)
+{
+	unsigned page = pc >> 8;
+	if (!blocks[page]) {
+		blocks[page].reset(new const uint8_t*[PAGE_SIZE]());
+		table[page] = blocks[page].get();
+	}
+	table[page][pc & 0xff] = block;
+}
+
+void Jit::link(uint16_t target, uint8_t* site)
+{
+	unsigned page = target >> 8;
+	if (ramCode[page]) {
+		return;
+	}
+	const uint8_t* block = table[page] ? table[page][target & 0xff] : nullptr;
+	if (block && block != exitInterpret) {
+		Asm::patch(site, block);
+	} else if (!block) {
+		unlinked.emplace(target, site);
+	}
+}
+
+void Jit::dropPage(Bus& bus, unsigned page)
+{
+	(void)bus;
+	blocks[page].reset();
+	table[page] = nullptr;
+	storage[page] = nullptr;
+	ramCode[page] = false;
+	invalidated = true;
+}
+
+uint32_t Jit::takeInvalidated()
+{
+	uint32_t was = invalidated;
+	invalidated = false;
+	return was;
+}
+
+void Jit::invalidateRam(Bus& bus)
+{
+	for (unsigned page = 0; page < PAGE_COUNT; page++) {
+		if (ramCode[page]) {
+			dropPage(bus, page);
+		}
+	}
+	for (unsigned page = 0; page < PAGE_COUNT; page++) {
+		if (bus.watched(static_cast<uint8_t>(page))) {
+			bus.unwatch(static_cast<uint8_t>(page));
+		}
+	}
+}
+
+void Jit::flush(Bus& bus)
+{
+	for (unsigned page = 0; page < PAGE_COUNT; page++) {
+		if (table[page]) {
+			dropPage(bus, page);
+		}
+		if (bus.watched(static_cast<uint8_t>(page))) {
+			bus.unwatch(static_cast<uint8_t>(page));
+		}
+	}
+	unlinked.clear();
+	idleLoops.clear();
+	used = blocksStart;
+}
+
+void Jit::pageWritten(Bus& bus, uint8_t page)
+{
+	// whatever page the code was translated from, it's the storage that changed
+	const uint8_t* written = bus.readPage(page);
+	for (unsigned p = 0; p < PAGE_COUNT; p++) {
+		if (ramCode[p] && storage[p] == written) {
+			dropPage(bus, p);
+		}
+	}
+	for (unsigned p = 0; p < PAGE_COUNT; p++) {
+		if (bus.watched(static_cast<uint8_t>(p)) && bus.readPage(static_cast<uint8_t>(p)) == written) {
+			bus.unwatch(static_cast<uint8_t>(p));
+		}
+	}
+}
+
+void Jit::pageMapped(Bus& bus, uint8_t page, unsigned count)
+{
+	for (unsigned p = page; p < page + count; p++) {
+		if (table[p] && !ramCode[p]) {
+			// other blocks may jump straight into these, start over. the
+			// code itself stays put until the next translate, so a block
+			// that's running right now can still finish
+			flush(bus);
+			return;
+		}
+		if (table[p]) {
+			dropPage(bus, p);
+		}
+	}
+	// a new mirror of RAM that holds code needs a watch of its own
+	for (unsigned p = page; p < page + count; p++) {
+		const uint8_t* shows = bus.readPage(static_cast<uint8_t>(p));
+		if (!shows) {
+			continue;
+		}
+		for (unsigned q = 0; q < PAGE_COUNT; q++) {
+			if (ramCode[q] && storage[q] == shows) {
+				bus.watch(static_cast<uint8_t>(p));
+				break;
+			}
+		}
+	}
+}
+
+uint32_t Jit::busRead(State8080* cpu, uint32_t address)
+{
+	try {
+		return cpu->bus.read(static_cast<uint16_t>(address));
+	} catch (...) {
+		fail(cpu);
+		return 0xff;
+	}
+}
+
+uint32_t Jit::busWrite(State8080* cpu, uint32_t address, uint32_t value)
+{
+	try {
+		cpu->bus.write(static_cast<uint16_t>(address), static_cast<uint8_t>(value));
+	} catch (...) {
+		fail(cpu);
+		return 1;
+	}
+	return cpu->jit->takeInvalidated();
+}
+
+uint32_t Jit::portIn(State8080* cpu, uint32_t port)
+{
+	try {
+		return cpu->ports.in(static_cast<uint8_t>(port));
+	} catch (...) {
+		fail(cpu);
+		return 0xff;
+	}
+}
+
+uint32_t Jit::portOut(State8080* cpu, uint32_t port, uint32_t value)
+{
+	try {
+		cpu->ports.out(static_cast<uint8_t>(port), static_cast<uint8_t>(value));
+	} catch (...) {
+		fail(cpu);
+		return 1;
+	}
+	// a device may have remapped memory
+	return cpu->jit->takeInvalidated();
+}
+
+void Jit::fail(State8080* cpu)
+{
+	// can't unwind through generated code, so stop at the next block and
+	// throw from run()
+	cpu->jit->pending = std::current_exception();
+	cpu->deadline = 0;
+}
+
+}
+
+#endif
@@ -0,0 +1,133 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <unordered_map>
+
+#include "Bus.h"
+
+namespace p8080 {
+
+class State8080;
+
+// basic block recompiler to x86-64, only built with -DP8080_JIT
+//
+// straight line runs of 8080 code, up to and including the first jump,
+// call or return and never past the end of a page, become native code that
+// works on the State8080 fields directly, so nothing has to be synced on
+// the way in or out. blocks are found through a table per page keyed on pc
+// and jump to each other without coming back to C++, straight to the
+// target when it's known and through a small dispatcher when it isn't
+// (RET, PCHL, code in RAM). anything the translator doesn't do (HLT, DAA, XTHL, code in
+// handler pages) runs one instruction at a time on the interpreter, same
+// for the last few instructions before the deadline, so timing matches the
+// interpreter exactly
+//
+// blocks from RAM pages get the page watched on the bus, any write to it
+// throws them away, and remapping a page does the same
+class Jit : public BusObserver {
+public:
+	// codeSize bytes of executable memory, everything gets thrown away and
+	// translated again when it fills up
+	explicit Jit(size_t codeSize = 1 << 20);
+	~Jit() override;
+	Jit(const Jit&) = delete;
+	Jit& operator=(const Jit&) = delete;
+
+	// like dispatch(UINT64_MAX, target), runs until cycles reaches target or
+	// something pulls the deadline in
+	void run(State8080& cpu, uint64_t target);
+
+	// drop every block that came from RAM, for when memory changed without
+	// going through the bus, like restoring a save state
+	void invalidateRam(Bus& bus);
+	// drop every block
+	void flush(Bus& bus);
+
+	void pageWritten(Bus& bus, uint8_t page) override;
+	void pageMapped(Bus& bus, uint8_t page, unsigned count) override;
+
+	uint64_t blocksTranslated() const { return translated; }
+
+private:
+	typedef uint32_t (*EntryFn)(State8080* cpu, const uint8_t* code);
+
+	// why generated code came back to C++
+	enum Exit : uint32_t {
+		// no block at pc yet
+		EXIT_MISS,
+		// the block at pc would run past the deadline
+		EXIT_DEADLINE,
+		// the instruction at pc needs the interpreter
+		EXIT_INTERPRET,
+		// the block at pc jumped back to its own start and may be an idle
+		// loop, see State8080::idle()
+		EXIT_IDLE,
+	};
+
+	class Translator;
+
+	// where generated code finds things, offsets from the State8080 in rbx
+	struct Layout {
+		// by 8080 register number, B C D E H L - A
+		int32_t reg[8];
+		int32_t cc;
+		int32_t sp;
+		int32_t pc;
+		int32_t cycles;
+		int32_t deadline;
+		int32_t intEnable;
+		int32_t readTable;
+		int32_t writeTable;
+	};
+
+	void emitStubs(State8080& cpu);
+	const uint8_t* translate(State8080& cpu, uint16_t pc);
+	void setBlock(uint16_t pc, const uint8_t* code);
+	// point the jmp rel32 at site to target's block, now or once it exists
+	void link(uint16_t target, uint8_t* site);
+	void dropPage(Bus& bus, unsigned page);
+	uint32_t takeInvalidated();
+
+	// called from generated code, never throw through it
+	static uint32_t busRead(State8080* cpu, uint32_t address);
+	static uint32_t busWrite(State8080* cpu, uint32_t address, uint32_t value);
+	static uint32_t portIn(State8080* cpu, uint32_t port);
+	static uint32_t portOut(State8080* cpu, uint32_t port, uint32_t value);
+	static void fail(State8080* cpu);
+
+	Layout layout = {};
+	uint8_t* code = nullptr;
+	size_t codeSize;
+	size_t used = 0;
+	// start of the space blocks go in, after the stubs
+	size_t blocksStart = 0;
+
+	const uint8_t* entry = nullptr;
+	const uint8_t* dispatcher = nullptr;
+	const uint8_t* exitMiss = nullptr;
+	const uint8_t* exitDeadline = nullptr;
+	const uint8_t* exitInterpret = nullptr;
+	const uint8_t* exitIdle = nullptr;
+	const uint8_t* exit = nullptr;
+
+	// block per address, generated code walks table so it has to stay put
+	std::unique_ptr<const uint8_t*[]> blocks[PAGE_COUNT];
+	const uint8_t** table[PAGE_COUNT] = {};
+	// what each page with blocks showed when they were translated
+	const uint8_t* storage[PAGE_COUNT] = {};
+	bool ramCode[PAGE_COUNT] = {};
+	// jumps waiting for their target to be translated, only into pages the
+	// cpu can't write, since nothing unlinks them short of a flush
+	std::unordered_multimap<uint16_t, uint8_t*> unlinked;
+	// where the jump back ends for blocks that exit with EXIT_IDLE
+	std::unordered_map<uint16_t, uint16_t> idleLoops;
+
+	bool invalidated = false;
+	// thrown by a device while generated code was running, rethrown after
+	std::exception_ptr pending;
+	uint64_t translated = 0;
+};
+
+}
@@ -0,0 +1,33 @@
+#include "Ports.h"
+
+namespace p8080 {
+
+namespace {
+	uint8_t openIn(void*, uint8_t) { return 0xff; }
+	void openOut(void*, uint8_t, uint8_t) {}
+}
+
+Ports::Ports()
+{
+	for (unsigned i = 0; i < PORT_COUNT; i++) {
+		unmap(static_cast<uint8_t>(i));
+	}
+}
+
+void Ports::mapIn(uint8_t port, PortIn fn, void* device)
+{
+	inPorts[port] = {fn, device};
+}
+
+void Ports::mapOut(uint8_t port, PortOut fn, void* device)
+{
+	outPorts[port] = {fn, device};
+}
+
+void Ports::unmap(uint8_t port)
+{
+	inPorts[port] = {&openIn, nullptr};
+	outPorts[port] = {&openOut, nullptr};
+}
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+
+namespace p8080 {
+
+constexpr unsigned PORT_COUNT = 0x100;
+
+typedef uint8_t (*PortIn)(void* device, uint8_t port);
+typedef void (*PortOut)(void* device, uint8_t port, uint8_t value);
+
+// IN and OUT, one callback per port so an access is a lookup and a call
+class Ports {
+public:
+	Ports();
+
+	uint8_t in(uint8_t port)
+	{
+		return inPorts[port].fn(inPorts[port].device, port);
+	}
+
+	void out(uint8_t port, uint8_t value)
+	{
+		outPorts[port].fn(outPorts[port].device, port, value);
+	}
+
+	void mapIn(uint8_t port, PortIn fn, void* device);
+	void mapOut(uint8_t port, PortOut fn, void* device);
+	// reads return 0xff, writes are dropped
+	void unmap(uint8_t port);
+
+	// member function versions, the call gets inlined into the callback
+	template<class Device, uint8_t (Device::*IN)(uint8_t)>
+	void mapIn(uint8_t port, Device* device)
+	{
+		mapIn(port, [](void* d, uint8_t p) -> uint8_t {
+			return (static_cast<Device*>(d)->*IN)(p);
+		}, device);
+	}
+
+	template<class Device, void (Device::*OUT)(uint8_t, uint8_t)>
+	void mapOut(uint8_t port, Device* device)
+	{
+		mapOut(port, [](void* d, uint8_t p, uint8_t v) {
+			(static_cast<Device*>(d)->*OUT)(p, v);
+		}, device);
+	}
+
+private:
+	struct InPort {
+		PortIn fn;
+		void* device;
+	};
+	struct OutPort {
+		PortOut fn;
+		void* device;
+	};
+
+	InPort inPorts[PORT_COUNT];
+	OutPort outPorts[PORT_COUNT];
+};
+
+}
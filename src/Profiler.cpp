@@ -0,0 +1,306 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "8080.h"
+#include "Dissasembler.h"
+
+namespace p8080 {
+
+namespace {
+	// the whole address space as the cpu sees it, for the disassembler
+	std::vector<uint8_t> image(const Bus& bus)
+	{
+		std::vector<uint8_t> code(0x10000, 0xff);
+		for (unsigned page = 0; page < PAGE_COUNT; page++) {
+			const uint8_t* data = bus.readPage(static_cast<uint8_t>(page));
+			if (data) {
+				std::copy(data, data + PAGE_SIZE, code.begin() + page * PAGE_SIZE);
+			}
+		}
+		return code;
+	}
+
+	std::string instruction(const std::vector<uint8_t>& code, uint32_t address)
+	{
+		char text[dissasemble::TEXT_SIZE];
+		size_t length = dissasemble::format(dissasemble::decode(code.data(), code.size(), address), text);
+		return std::string(text, length);
+	}
+
+	// mnemonic and registers, the operand bytes would be made up
+	std::string opcodeName(uint8_t op)
+	{
+		const dissasemble::Mnemonic& mnemonic = dissasemble::MNEMONICS[op];
+		std::string name = mnemonic.name;
+		std::string args = mnemonic.args;
+		args = args.substr(0, args.find_last_not_of(" ,#") + 1);
+		if (!args.empty()) {
+			name.resize(7, ' ');
+			name += args;
+		}
+		return name;
+	}
+
+	std::string hex(uint32_t value)
+	{
+		char text[8];
+		std::snprintf(text, sizeof(text), "$%04x", static_cast<unsigned>(value & 0xffff));
+		return text;
+	}
+
+	std::string percent(uint64_t part, uint64_t whole)
+	{
+		char text[16];
+		std::snprintf(text, sizeof(text), "%6.2f%%", whole ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0);
+		return text;
+	}
+
+	// indices of the nonzero entries, biggest first, at most top of them
+	template<typename T, typename Key>
+	std::vector<uint32_t> hottest(const std::vector<T>& entries, size_t top, Key key)
+	{
+		std::vector<uint32_t> order;
+		for (uint32_t i = 0; i < entries.size(); i++) {
+			if (key(entries[i])) {
+				order.push_back(i);
+			}
+		}
+		auto hotter = [&](uint32_t a, uint32_t b) {
+			return key(entries[a]) != key(entries[b]) ? key(entries[a]) > key(entries[b]) : a < b;
+		};
+		if (order.size() > top) {
+			std::partial_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(top), order.end(), hotter);
+			order.resize(top);
+		} else {
+			std::sort(order.begin(), order.end(), hotter);
+		}
+		return order;
+	}
+
+	void pad(std::ostream& out, const std::string& text, size_t width)
+	{
+		out << text;
+		for (size_t i = text.size(); i < width; i++) {
+			out << ' ';
+		}
+	}
+}
+
+Profiler::Profiler()
+	: executed(0x10000), opcodes(256), reads(0x10000), writes(0x10000),
+	  routines(0x10000), sites(INTERRUPT + 8)
+{
+}
+
+void Profiler::enter(uint32_t site, uint16_t target, uint16_t sp, uint64_t cycles)
+{
+	// a frame at or under the new return address was left without a RET
+	while (!stack.empty() && stack.back().sp <= sp) {
+		pop(cycles);
+	}
+	Site& from = sites[site];
+	from.calls++;
+	from.caller = stack.empty() ? TOP : stack.back().routine;
+	from.target = target;
+	routines[target].calls++;
+	stack.push_back({target, sp, site, cycles, 0});
+}
+
+void Profiler::leave(uint16_t sp, uint64_t cycles)
+{
+	// deeper frames were jumped out of, and a RET that doesn't match any
+	// frame is a computed jump, like PUSH H then RET
+	while (!stack.empty() && stack.back().sp < sp) {
+		pop(cycles);
+	}
+	if (!stack.empty() && stack.back().sp == sp) {
+		pop(cycles);
+	}
+}
+
+void Profiler::pop(uint64_t cycles)
+{
+	Frame frame = stack.back();
+	stack.pop_back();
+	uint64_t total = cycles - frame.start;
+	Routine& routine = routines[frame.routine];
+	routine.inclusive += total;
+	routine.self += total - std::min(total, frame.children);
+	sites[frame.site].cycles += total;
+	if (!stack.empty()) {
+		stack.back().children += total;
+	}
+}
+
+void Profiler::repeat(const Bus& bus, uint16_t head, uint16_t end, uint64_t iterations)
+{
+	for (uint16_t at = head; at != end;) {
+		const uint8_t* page = bus.readPage(static_cast<uint8_t>(at >> 8));
+		if (!page) {
+			return;
+		}
+		uint8_t op = page[at & 0xff];
+		executed[at] += iterations;
+		opcodes[op] += iterations;
+		at = static_cast<uint16_t>(at + LENGTH[op]);
+	}
+}
+
+void Profiler::clear()
+{
+	std::fill(executed.begin(), executed.end(), 0);
+	std::fill(opcodes.begin(), opcodes.end(), 0);
+	std::fill(reads.begin(), reads.end(), 0);
+	std::fill(writes.begin(), writes.end(), 0);
+	std::fill(routines.begin(), routines.end(), Routine());
+	std::fill(sites.begin(), sites.end(), Site());
+	stack.clear();
+}
+
+void Profiler::report(std::ostream& out, const Bus& bus, uint64_t now, size_t top) const
+{
+	std::vector<uint8_t> code = image(bus);
+
+	// close what's still open on copies, innermost first
+	std::vector<Routine> routines = this->routines;
+	std::vector<Site> sites = this->sites;
+	uint64_t inner = 0;
+	for (size_t i = stack.size(); i-- > 0;) {
+		const Frame& frame = stack[i];
+		uint64_t total = now - frame.start;
+		routines[frame.routine].inclusive += total;
+		routines[frame.routine].self += total - std::min(total, frame.children + inner);
+		sites[frame.site].cycles += total;
+		inner = total;
+	}
+
+	uint64_t instructions = 0;
+	uint64_t cycles = 0;
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		instructions += executed[pc];
+		cycles += executed[pc] * CYCLES[code[pc]];
+	}
+	uint64_t selfTotal = 0;
+	for (const Routine& routine : routines) {
+		selfTotal += routine.self;
+	}
+
+	out << "instructions: " << instructions << "\n";
+	out << "cycles:       " << cycles << " not counting taken conditional CALL and RET\n";
+
+	out << "\nflat profile, by self cycles\n";
+	out << "  self              inclusive    calls        routine\n";
+	for (uint32_t at : hottest(routines, top, [](const Routine& r) { return r.self; })) {
+		const Routine& routine = routines[at];
+		out << percent(routine.self, selfTotal) << ' ';
+		pad(out, std::to_string(routine.self), 10);
+		out << ' ';
+		pad(out, std::to_string(routine.inclusive), 12);
+		out << ' ';
+		pad(out, std::to_string(routine.calls), 12);
+		out << ' ' << hex(at) << "  " << instruction(code, at) << "\n";
+	}
+
+	out << "\nhottest instructions, by cycles\n";
+	out << "  cycles            count        address\n";
+	std::vector<uint64_t> spent(0x10000);
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		spent[pc] = executed[pc] * CYCLES[code[pc]];
+	}
+	for (uint32_t pc : hottest(spent, top, [](uint64_t n) { return n; })) {
+		out << percent(spent[pc], cycles) << ' ';
+		pad(out, std::to_string(spent[pc]), 10);
+		out << ' ';
+		pad(out, std::to_string(executed[pc]), 12);
+		out << ' ' << hex(pc) << "  " << instruction(code, pc) << "\n";
+	}
+
+	out << "\nopcodes, by count\n";
+	for (uint32_t op : hottest(opcodes, top, [](uint64_t n) { return n; })) {
+		out << percent(opcodes[op], instructions) << ' ';
+		pad(out, std::to_string(opcodes[op]), 12);
+		char hexOp[8];
+		std::snprintf(hexOp, sizeof(hexOp), "%02x", op);
+		out << ' ' << hexOp << "  " << opcodeName(static_cast<uint8_t>(op)) << "\n";
+	}
+
+	// gprof style, every routine with who called it above and what it
+	// called below, each call site with its instruction
+	out << "\ncall graph, by inclusive cycles\n";
+	auto name = [](uint32_t routine) { return routine == TOP ? std::string("<top>") : hex(routine); };
+	auto site = [&](uint32_t at) {
+		return at >= INTERRUPT ? "interrupt RST " + std::to_string(at - INTERRUPT) : hex(at) + "  " + instruction(code, at);
+	};
+	for (uint32_t at : hottest(routines, top, [](const Routine& r) { return r.inclusive; })) {
+		const Routine& routine = routines[at];
+		out << "\n";
+		for (uint32_t from = 0; from < sites.size(); from++) {
+			if (sites[from].calls && sites[from].target == at) {
+				out << "        from ";
+				pad(out, name(sites[from].caller), 7);
+				pad(out, std::to_string(sites[from].calls), 10);
+				pad(out, std::to_string(sites[from].cycles), 12);
+				out << site(from) << "\n";
+			}
+		}
+		out << percent(routine.inclusive, cycles) << ' ' << hex(at) << "  inclusive " << routine.inclusive
+			<< ", self " << routine.self << ", " << routine.calls << " calls  " << instruction(code, at) << "\n";
+		for (uint32_t from = 0; from < INTERRUPT; from++) {
+			if (sites[from].calls && sites[from].caller == at) {
+				out << "        to   ";
+				pad(out, name(sites[from].target), 7);
+				pad(out, std::to_string(sites[from].calls), 10);
+				pad(out, std::to_string(sites[from].cycles), 12);
+				out << site(from) << "\n";
+			}
+		}
+	}
+
+	// page by page, then the busiest single addresses
+	out << "\nmemory, by page\n";
+	out << "  page   reads        writes       hottest read      hottest write\n";
+	uint64_t readTotal = 0;
+	uint64_t writeTotal = 0;
+	for (unsigned page = 0; page < PAGE_COUNT; page++) {
+		uint64_t pageReads = 0;
+		uint64_t pageWrites = 0;
+		uint32_t hotRead = page * PAGE_SIZE;
+		uint32_t hotWrite = page * PAGE_SIZE;
+		for (uint32_t at = page * PAGE_SIZE; at < (page + 1) * PAGE_SIZE; at++) {
+			pageReads += reads[at];
+			pageWrites += writes[at];
+			hotRead = reads[at] > reads[hotRead] ? at : hotRead;
+			hotWrite = writes[at] > writes[hotWrite] ? at : hotWrite;
+		}
+		readTotal += pageReads;
+		writeTotal += pageWrites;
+		if (!pageReads && !pageWrites) {
+			continue;
+		}
+		char pageHex[8];
+		std::snprintf(pageHex, sizeof(pageHex), "$%02x", page);
+		out << "  " << pageHex << "    ";
+		pad(out, std::to_string(pageReads), 12);
+		out << ' ';
+		pad(out, std::to_string(pageWrites), 12);
+		out << ' ';
+		pad(out, pageReads ? hex(hotRead) + " " + std::to_string(reads[hotRead]) : "-", 17);
+		out << ' ' << (pageWrites ? hex(hotWrite) + " " + std::to_string(writes[hotWrite]) : "-") << "\n";
+	}
+	out << "\nhottest reads\n";
+	for (uint32_t at : hottest(reads, top, [](uint64_t n) { return n; })) {
+		out << percent(reads[at], readTotal) << ' ';
+		pad(out, std::to_string(reads[at]), 12);
+		out << ' ' << hex(at) << "\n";
+	}
+	out << "\nhottest writes\n";
+	for (uint32_t at : hottest(writes, top, [](uint64_t n) { return n; })) {
+		out << percent(writes[at], writeTotal) << ' ';
+		pad(out, std::to_string(writes[at]), 12);
+		out << ' ' << hex(at) << "\n";
+	}
+}
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "Bus.h"
+
+namespace p8080 {
+
+// where the time goes in the ROM, only built with -DP8080_PROFILE
+//
+// the interpreter bumps the count for the pc and the opcode of every
+// instruction it runs, and load and store bump the heatmaps, that's all
+// that happens per instruction. CALL, RST and interrupts push a frame on
+// a shadow stack and RET pops it, which gives cycles per routine, self and
+// inclusive, and the call graph. frames are matched on sp, so code that
+// drops a return address or resets the stack doesn't leave the shadow
+// stack out of step for long
+//
+// the JIT is left out of profiled builds since translated code can't be
+// counted. loops idle skipping jumps over still get their instructions
+// counted, but not their memory reads. recursive routines count their
+// inclusive cycles once per level
+class Profiler {
+public:
+	struct Routine {
+		uint64_t calls = 0;
+		// from the instruction after the CALL up to and including the RET
+		uint64_t inclusive = 0;
+		// inclusive minus whatever the routines it called took
+		uint64_t self = 0;
+	};
+
+	struct Site {
+		uint64_t calls = 0;
+		uint64_t cycles = 0;
+		// routine the call was made from, TOP if none
+		uint32_t caller = TOP;
+		// last routine it called, only RST and CALL always go to the same one
+		uint16_t target = 0;
+	};
+
+	// caller of whatever runs outside of any routine
+	static constexpr uint32_t TOP = 0x10000;
+	// sites past the address space, one per RST an interrupt can jam in
+	static constexpr uint32_t INTERRUPT = 0x10000;
+
+	Profiler();
+
+	// per instruction
+	void step(uint16_t pc, uint8_t opcode)
+	{
+		executed[pc]++;
+		opcodes[opcode]++;
+	}
+	void read(uint16_t address) { reads[address]++; }
+	void write(uint16_t address) { writes[address]++; }
+
+	// a call from site into target, sp already has the return address on it
+	// and cycles the call's T-states
+	void enter(uint32_t site, uint16_t target, uint16_t sp, uint64_t cycles);
+	// a RET about to pop its return address from sp
+	void leave(uint16_t sp, uint64_t cycles);
+	// iterations more runs of the loop from head up to the jump ending at end
+	void repeat(const Bus& bus, uint16_t head, uint16_t end, uint64_t iterations);
+
+	// everything back to zero and the shadow stack emptied
+	void clear();
+
+	// flat profile, hottest instructions, opcode histogram, call graph and
+	// memory heatmap as text, top entries of each. routines still on the
+	// shadow stack count as if they returned at now. bus is where the
+	// disassembly comes from
+	void report(std::ostream& out, const Bus& bus, uint64_t now, size_t top = 25) const;
+
+	// counts per address and per opcode
+	std::vector<uint64_t> executed;
+	std::vector<uint64_t> opcodes;
+	std::vector<uint64_t> reads;
+	std::vector<uint64_t> writes;
+	// per entry address
+	std::vector<Routine> routines;
+	// per CALL or RST address, then one per interrupt
+	std::vector<Site> sites;
+
+private:
+	struct Frame {
+		uint16_t routine;
+		uint16_t sp;
+		uint32_t site;
+		uint64_t start;
+		// inclusive cycles of the routines it called that returned
+		uint64_t children;
+	};
+
+	void pop(uint64_t cycles);
+
+	std::vector<Frame> stack;
+};
+
+}
@@ -0,0 +1,166 @@
+#include "Rewind.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace p8080 {
+
+namespace {
+	constexpr uint32_t ALL_PAGES = 0xffffffff;
+
+	unsigned popcount(uint32_t mask)
+	{
+		unsigned count = 0;
+		for (; mask; mask &= mask - 1) {
+			count++;
+		}
+		return count;
+	}
+}
+
+Rewind::Rewind(InvadersMachine& machine, size_t count, unsigned keyframeInterval, size_t pageBudget)
+	: machine(&machine), interval(keyframeInterval ? keyframeInterval : 1), frames(count ? count : 1)
+{
+	if (pageBudget == 0) {
+		// keyframes are all of RAM, the game mostly writes a few pages a frame
+		pageBudget = (frames.size() / interval + 2) * SNAPSHOT_RAM_PAGES + frames.size() * 8;
+	}
+	if (pageBudget < SNAPSHOT_RAM_PAGES) {
+		throw std::runtime_error("rewind needs room for at least one keyframe");
+	}
+	poolPages = pageBudget;
+	pool.resize(poolPages * PAGE_SIZE);
+	scratch.header.dirty = ALL_PAGES;
+	scratch.pages.resize(SNAPSHOT_RAM_PAGES * PAGE_SIZE);
+}
+
+void Rewind::record()
+{
+	bool keyframe = count == 0 || sinceKeyframe + 1 >= interval;
+	uint32_t dirty = keyframe ? ALL_PAGES : machine->dirtyRam();
+	unsigned pages = popcount(dirty);
+
+	while (count == frames.size() || poolPages - pagesUsed() < pages) {
+		dropOldest();
+	}
+	// dropping can take the keyframe this one was going to lean on
+	if (count == 0 && !keyframe) {
+		keyframe = true;
+		dirty = ALL_PAGES;
+		pages = SNAPSHOT_RAM_PAGES;
+		while (poolPages - pagesUsed() < pages) {
+			dropOldest();
+		}
+	}
+
+	Frame& slot = frame(count);
+	slot.header = machine->saveHeader();
+	slot.header.dirty = dirty;
+	slot.firstPage = poolEnd;
+	slot.keyframe = keyframe;
+	for (unsigned i = 0; i < SNAPSHOT_RAM_PAGES; i++) {
+		if (dirty & (1u << i)) {
+			std::memcpy(poolPage(poolEnd++), machine->cpu.bus.readPage(static_cast<uint8_t>((INVADERS_RAM_START >> 8) + i)), PAGE_SIZE);
+		}
+	}
+	count++;
+	sinceKeyframe = keyframe ? 0 : sinceKeyframe + 1;
+
+	machine->trackRam();
+}
+
+void Rewind::runFrames(uint64_t n)
+{
+	for (uint64_t i = 0; i < n && machine->cpu.status != Status::Error; i++) {
+		machine->runFrames(1);
+		record();
+	}
+}
+
+void Rewind::dropOldest()
+{
+	// frames past the oldest keyframe can't be rebuilt without it, so they
+	// go along with it
+	do {
+		poolBegin += popcount(frame(0).header.dirty);
+		head = (head + 1) % frames.size();
+		count--;
+	} while (count && !frame(0).keyframe);
+	if (count == 0) {
+		poolBegin = poolEnd;
+	}
+}
+
+bool Rewind::empty() const
+{
+	return count == 0;
+}
+
+uint64_t Rewind::oldest() const
+{
+	return frame(0).header.frames;
+}
+
+uint64_t Rewind::newest() const
+{
+	return frame(count - 1).header.frames;
+}
+
+bool Rewind::seek(uint64_t target)
+{
+	if (count == 0 || target < oldest() || target > newest()) {
+		return false;
+	}
+	// frame numbers only go up, but a caller could have skipped some
+	size_t low = 0;
+	size_t high = count - 1;
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		if (frame(mid).header.frames < target) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (frame(low).header.frames != target) {
+		return false;
+	}
+
+	// the oldest frame is always a keyframe, so this stops
+	size_t key = low;
+	while (!frame(key).keyframe) {
+		key--;
+	}
+	sinceKeyframe = static_cast<unsigned>(low - key);
+
+	// newest copy of every page wins, walking back to the keyframe fills
+	// in the rest
+	uint32_t filled = 0;
+	for (size_t i = low + 1; i-- > key && filled != ALL_PAGES;) {
+		const Frame& from = frame(i);
+		uint64_t page = from.firstPage;
+		for (unsigned p = 0; p < SNAPSHOT_RAM_PAGES; p++) {
+			uint32_t bit = 1u << p;
+			if (!(from.header.dirty & bit)) {
+				continue;
+			}
+			if (!(filled & bit)) {
+				std::memcpy(scratch.pages.data() + p * PAGE_SIZE, poolPage(page), PAGE_SIZE);
+				filled |= bit;
+			}
+			page++;
+		}
+	}
+
+	const Frame& to = frame(low);
+	scratch.header = to.header;
+	scratch.header.dirty = ALL_PAGES;
+	machine->load(scratch);
+
+	// everything after it is gone
+	count = low + 1;
+	poolEnd = to.firstPage + popcount(to.header.dirty);
+	machine->trackRam();
+	return true;
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "InvadersMachine.h"
+#include "Snapshot.h"
+
+namespace p8080 {
+
+// rewind for an InvadersMachine, a ring of the last so many frames where
+// every frame is the register file and board state plus only the RAM pages
+// written during it, with a full keyframe every so often. all the memory is
+// taken up front, when it runs out the oldest frames go
+//
+// RAM writes are found with Bus::protect(), so the cpu pays for one slow
+// write per page per frame and nothing at all for everything else
+class Rewind {
+public:
+	// frames is how far back it can go, keyframeInterval how many frames
+	// a seek has to walk back at most, pageBudget how many RAM pages all
+	// the frames get to share, 0 picks a size that fits the game's usual
+	// handful of pages per frame
+	Rewind(InvadersMachine& machine, size_t frames, unsigned keyframeInterval = 60, size_t pageBudget = 0);
+	Rewind(const Rewind&) = delete;
+	Rewind& operator=(const Rewind&) = delete;
+
+	// remember the frame the machine is at now, call once per frame
+	void record();
+	// runFrames(1) and record() n times
+	void runFrames(uint64_t n);
+
+	// oldest and newest frame numbers a seek can go to, as in screen.frames,
+	// empty() if there is none
+	bool empty() const;
+	uint64_t oldest() const;
+	uint64_t newest() const;
+
+	// put the machine back at a recorded frame, frames after it are dropped
+	// since they're not its future anymore, false if it's out of range
+	bool seek(uint64_t frame);
+
+	// pages in use right now, out of pageBudget
+	size_t pagesUsed() const { return static_cast<size_t>(poolEnd - poolBegin); }
+
+private:
+	struct Frame {
+		SnapshotHeader header;
+		// first page, counted since construction, see poolPage()
+		uint64_t firstPage;
+		bool keyframe;
+	};
+
+	Frame& frame(size_t i) { return frames[(head + i) % frames.size()]; }
+	const Frame& frame(size_t i) const { return frames[(head + i) % frames.size()]; }
+	void dropOldest();
+	uint8_t* poolPage(uint64_t index) { return pool.data() + (index % poolPages) * PAGE_SIZE; }
+
+	InvadersMachine* machine;
+	unsigned interval;
+
+	std::vector<Frame> frames;
+	// frames[head] is the oldest, count of them in use
+	size_t head = 0;
+	size_t count = 0;
+	// frames since the last keyframe
+	unsigned sinceKeyframe = 0;
+
+	// pages of the frames, in the order they were recorded, between
+	// poolBegin and poolEnd
+	std::vector<uint8_t> pool;
+	size_t poolPages;
+	uint64_t poolBegin = 0;
+	uint64_t poolEnd = 0;
+
+	// where seek puts RAM back together, kept around so seeking doesn't allocate
+	Snapshot scratch;
+};
+
+}
@@ -0,0 +1,122 @@
+#include "RomSet.h"
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+
+namespace p8080 {
+
+namespace {
+	constexpr std::array<uint32_t, 256> crcTable()
+	{
+		std::array<uint32_t, 256> table = {};
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++) {
+				crc = crc & 1 ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+			}
+			table[i] = crc;
+		}
+		return table;
+	}
+
+	constexpr std::array<uint32_t, 256> CRC_TABLE = crcTable();
+
+	struct FileCloser {
+		void operator()(FILE* file) const { std::fclose(file); }
+	};
+	typedef std::unique_ptr<FILE, FileCloser> File;
+
+	// unbuffered, so a read of the whole thing goes straight to the caller.
+	// a directory opens fine and has a made up size, so it's turned away here
+	File open(const std::string& path)
+	{
+		File file(std::fopen(path.c_str(), "rb"));
+		if (!file) {
+			throw std::runtime_error("can't open " + path);
+		}
+		std::error_code error;
+		if (!std::filesystem::is_regular_file(path, error)) {
+			throw std::runtime_error("can't read " + path);
+		}
+		std::setvbuf(file.get(), nullptr, _IONBF, 0);
+		return file;
+	}
+
+	std::string hex(uint32_t value)
+	{
+		char text[16];
+		std::snprintf(text, sizeof(text), "%08x", static_cast<unsigned>(value));
+		return text;
+	}
+}
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = CRC_TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+std::vector<uint8_t> readFile(const std::string& path)
+{
+	File file = open(path);
+	long size = -1;
+	if (std::fseek(file.get(), 0, SEEK_END) == 0) {
+		size = std::ftell(file.get());
+	}
+	std::vector<uint8_t> data;
+	if (size < 0 || static_cast<unsigned long>(size) > data.max_size() || std::fseek(file.get(), 0, SEEK_SET) != 0) {
+		throw std::runtime_error("can't read " + path);
+	}
+	data.resize(static_cast<size_t>(size));
+	if (std::fread(data.data(), 1, data.size(), file.get()) != data.size()) {
+		throw std::runtime_error("can't read " + path);
+	}
+	return data;
+}
+
+void readFile(const std::string& path, uint8_t* out, size_t size)
+{
+	File file = open(path);
+	// one byte too many is how a file that's too long shows
+	size_t read = std::fread(out, 1, size, file.get());
+	if (std::ferror(file.get())) {
+		throw std::runtime_error("can't read " + path);
+	}
+	if (read != size || std::fgetc(file.get()) != EOF) {
+		throw std::runtime_error(path + " has to be " + std::to_string(size) + " bytes");
+	}
+}
+
+SharedImage readRomSet(const std::string& directory, const std::vector<RomFile>& files, size_t imageSize, bool verify)
+{
+	std::vector<uint8_t> image(imageSize, 0xff);
+	std::vector<bool> used(imageSize);
+	for (const RomFile& rom : files) {
+		std::string path = directory + "/" + rom.name;
+		if (rom.address > imageSize || rom.size > imageSize - rom.address) {
+			throw std::runtime_error(std::string(rom.name) + " doesn't fit in the image");
+		}
+		for (uint32_t at = rom.address; at < rom.address + rom.size; at++) {
+			if (used[at]) {
+				throw std::runtime_error(std::string(rom.name) + " overlaps another ROM");
+			}
+			used[at] = true;
+		}
+		uint8_t* place = image.data() + rom.address;
+		readFile(path, place, rom.size);
+		if (verify) {
+			uint32_t crc = crc32(place, rom.size);
+			if (crc != rom.crc) {
+				throw std::runtime_error(path + " has CRC " + hex(crc) + ", expected " + hex(rom.crc));
+			}
+		}
+	}
+	return std::make_shared<const std::vector<uint8_t>>(std::move(image));
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CowMemory.h"
+
+namespace p8080 {
+
+// one chip of a ROM set and where it sits in the image
+struct RomFile {
+	const char* name;
+	uint32_t address;
+	uint32_t size;
+	// CRC-32 as MAME lists it, only checked when asked to
+	uint32_t crc;
+};
+
+// CRC-32, the zip and MAME one, continuing from crc
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+// the whole file, with a single read into a buffer sized up front
+std::vector<uint8_t> readFile(const std::string& path);
+// exactly size bytes of file straight into out, throws if the file is
+// any other size
+void readFile(const std::string& path, uint8_t* out, size_t size);
+
+// every file of a set read from directory straight into its place in one
+// image of imageSize bytes, with no copies on the way. sizes always have
+// to match, checksums too if verify is set. bytes no file covers are 0xff,
+// like an empty EPROM socket
+SharedImage readRomSet(const std::string& directory, const std::vector<RomFile>& files, size_t imageSize,
+	bool verify = false);
+
+}
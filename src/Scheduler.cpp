@@ -0,0 +1,29 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <functional>
+
+namespace p8080 {
+
+void Scheduler::schedule(uint64_t when, EventFn fn, void* ctx)
+{
+	heap.push_back({when, seq++, fn, ctx});
+	std::push_heap(heap.begin(), heap.end(), std::greater<Event>());
+}
+
+void Scheduler::clear()
+{
+	heap.clear();
+}
+
+void Scheduler::runDue(uint64_t now)
+{
+	while (!heap.empty() && heap.front().when <= now) {
+		std::pop_heap(heap.begin(), heap.end(), std::greater<Event>());
+		Event event = heap.back();
+		heap.pop_back();
+		// may schedule more events, heap is in a good state by now
+		event.fn(event.ctx, event.when);
+	}
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace p8080 {
+
+// when is the cycle the event was scheduled for, it can fire a bit later
+// since instructions are never split
+typedef void (*EventFn)(void* ctx, uint64_t when);
+
+// events keyed on the cycle counter, kept in a min-heap so the run loop
+// only has to know the next deadline
+class Scheduler {
+public:
+	void schedule(uint64_t when, EventFn fn, void* ctx);
+	void clear();
+
+	// cycle of the next event, UINT64_MAX if there is none
+	uint64_t next() const
+	{
+		return heap.empty() ? UINT64_MAX : heap.front().when;
+	}
+
+	// fire everything due at or before now, in order
+	void runDue(uint64_t now);
+
+private:
+	struct Event {
+		uint64_t when;
+		// ties fire in the order they were scheduled
+		uint64_t seq;
+		EventFn fn;
+		void* ctx;
+
+		bool operator>(const Event& other) const
+		{
+			return when != other.when ? when > other.when : seq > other.seq;
+		}
+	};
+
+	std::vector<Event> heap;
+	uint64_t seq = 0;
+};
+
+}
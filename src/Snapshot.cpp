@@ -0,0 +1,90 @@
+#include "Snapshot.h"
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace p8080 {
+
+namespace {
+	constexpr uint32_t ALL_DIRTY = 0xffffffff;
+
+	unsigned popcount(uint32_t mask)
+	{
+		unsigned count = 0;
+		for (; mask; mask &= mask - 1) {
+			count++;
+		}
+		return count;
+	}
+}
+
+const uint8_t* Snapshot::ramPage(unsigned i) const
+{
+	uint32_t bit = 1u << i;
+	if (header.dirty & bit) {
+		// dirty pages below this one come first
+		return pages.data() + popcount(header.dirty & (bit - 1)) * PAGE_SIZE;
+	}
+	return base->data() + i * PAGE_SIZE;
+}
+
+SharedImage Snapshot::flatten() const
+{
+	std::vector<uint8_t> ram(SNAPSHOT_RAM_PAGES * PAGE_SIZE);
+	for (unsigned i = 0; i < SNAPSHOT_RAM_PAGES; i++) {
+		std::memcpy(ram.data() + i * PAGE_SIZE, ramPage(i), PAGE_SIZE);
+	}
+	return std::make_shared<const std::vector<uint8_t>>(std::move(ram));
+}
+
+Snapshot Snapshot::flattened() const
+{
+	Snapshot flat;
+	flat.header = header;
+	flat.header.dirty = 0;
+	flat.base = flatten();
+	return flat;
+}
+
+std::vector<uint8_t> Snapshot::toBytes(bool full) const
+{
+	SnapshotHeader out = header;
+	out.dirty = full ? ALL_DIRTY : header.dirty;
+
+	std::vector<uint8_t> bytes(sizeof(out) + popcount(out.dirty) * PAGE_SIZE);
+	std::memcpy(bytes.data(), &out, sizeof(out));
+	if (full) {
+		for (unsigned i = 0; i < SNAPSHOT_RAM_PAGES; i++) {
+			std::memcpy(bytes.data() + sizeof(out) + i * PAGE_SIZE, ramPage(i), PAGE_SIZE);
+		}
+	} else if (!pages.empty()) {
+		std::memcpy(bytes.data() + sizeof(out), pages.data(), pages.size());
+	}
+	return bytes;
+}
+
+Snapshot Snapshot::fromBytes(const uint8_t* data, size_t size, SharedImage base)
+{
+	Snapshot snapshot;
+	if (size < sizeof(snapshot.header)) {
+		throw std::runtime_error("snapshot is truncated");
+	}
+	std::memcpy(&snapshot.header, data, sizeof(snapshot.header));
+	if (snapshot.header.magic != SNAPSHOT_MAGIC || snapshot.header.version != SNAPSHOT_VERSION) {
+		throw std::runtime_error("not a snapshot, or from another version");
+	}
+	size_t pageBytes = popcount(snapshot.header.dirty) * PAGE_SIZE;
+	if (size != sizeof(snapshot.header) + pageBytes) {
+		throw std::runtime_error("snapshot is truncated");
+	}
+	if (snapshot.header.dirty != ALL_DIRTY) {
+		if (!base || base->size() < SNAPSHOT_RAM_PAGES * PAGE_SIZE) {
+			throw std::runtime_error("delta snapshot needs the base it was taken against");
+		}
+		snapshot.base = std::move(base);
+	}
+	snapshot.pages.assign(data + sizeof(snapshot.header), data + size);
+	return snapshot;
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "8080.h"
+#include "CowMemory.h"
+#include "InvadersIO.h"
+
+namespace p8080 {
+
+constexpr uint32_t SNAPSHOT_MAGIC = 0x30383038; // "8080"
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr unsigned SNAPSHOT_RAM_PAGES = 0x20;
+
+// fixed size part of a save state, plain bytes
+struct SnapshotHeader {
+	uint32_t magic;
+	uint32_t version;
+	CpuState cpu;
+	InvadersIO::State io;
+	uint64_t frames;
+	uint64_t frameEnd;
+	// bit per RAM page, set if the page is in the snapshot and not the base
+	uint32_t dirty;
+};
+
+// save state of an InvadersMachine. RAM is stored as the pages that differ
+// from a base image, which is usually what the machine's RAM was mapped
+// from, so a snapshot of a machine that only touched a few pages since the
+// last restore is a few pages big
+class Snapshot {
+public:
+	SnapshotHeader header = {};
+	// RAM the pages not marked dirty come from, null if all of them are dirty
+	SharedImage base;
+	// the dirty pages, lowest first, back to back
+	std::vector<uint8_t> pages;
+
+	// RAM page i, from pages or the base
+	const uint8_t* ramPage(unsigned i) const;
+	// all of RAM as one image, cheap to share between every machine that
+	// branches off this state
+	SharedImage flatten() const;
+	// same state with flatten() as the base and nothing dirty
+	Snapshot flattened() const;
+
+	// header then pages, the base isn't included so load it with the same
+	// one, unless full is set and every page gets written
+	std::vector<uint8_t> toBytes(bool full = false) const;
+	static Snapshot fromBytes(const uint8_t* data, size_t size, SharedImage base = nullptr);
+};
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace p8080 {
+
+// bounded ring for exactly one thread pushing and one thread popping, no
+// locks, each side only ever writes its own index
+template<class T>
+class SpscQueue {
+public:
+	// capacity gets rounded up to a power of two
+	explicit SpscQueue(size_t capacity)
+	{
+		size_t size = 1;
+		while (size < capacity) {
+			size <<= 1;
+		}
+		slots.reset(new T[size]);
+		mask = size - 1;
+	}
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	// producer only, false if it's full
+	bool push(T value)
+	{
+		size_t at = tail.load(std::memory_order_relaxed);
+		if (at - head.load(std::memory_order_acquire) > mask) {
+			return false;
+		}
+		slots[at & mask] = std::move(value);
+		tail.store(at + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer only, false if it's empty
+	bool pop(T& value)
+	{
+		size_t at = head.load(std::memory_order_relaxed);
+		if (at == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		value = std::move(slots[at & mask]);
+		head.store(at + 1, std::memory_order_release);
+		return true;
+	}
+
+	// only a hint when the other side is busy
+	bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+private:
+	std::unique_ptr<T[]> slots;
+	size_t mask = 0;
+	// own cache lines so the two sides don't bounce one between them
+	alignas(64) std::atomic<size_t> head{0};
+	alignas(64) std::atomic<size_t> tail{0};
+};
+
+}
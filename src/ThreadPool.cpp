@@ -0,0 +1,125 @@
+#include "ThreadPool.h"
+
+namespace p8080 {
+
+namespace {
+	// which pool and queue the current thread works for, if any
+	thread_local const ThreadPool* currentPool = nullptr;
+	thread_local size_t currentIndex = 0;
+}
+
+ThreadPool::ThreadPool(size_t threads)
+{
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+	}
+	if (threads == 0) {
+		threads = 1;
+	}
+	for (size_t i = 0; i < threads; i++) {
+		queues.emplace_back(new Queue);
+	}
+	for (size_t i = 0; i < threads; i++) {
+		workers.emplace_back(&ThreadPool::work, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	wait();
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::submit(Task task)
+{
+	size_t index = currentPool == this
+		? currentIndex
+		: nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+	pending.fetch_add(1, std::memory_order_relaxed);
+	// counted before it's pushed so a worker that grabs it right away
+	// can't take queued below 0
+	bool wasEmpty = queued.fetch_add(1) == 0;
+	{
+		std::lock_guard<std::mutex> guard(queues[index]->lock);
+		queues[index]->tasks.push_back(std::move(task));
+	}
+	if (wasEmpty) {
+		// somebody may be asleep, take the lock so the wakeup can't slip in
+		// between their check and their wait
+		std::lock_guard<std::mutex> guard(sleepLock);
+		wake.notify_all();
+	}
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> guard(sleepLock);
+	idle.wait(guard, [this] { return pending.load() == 0; });
+}
+
+bool ThreadPool::pop(size_t index, Task& task)
+{
+	Queue& queue = *queues[index];
+	std::lock_guard<std::mutex> guard(queue.lock);
+	if (queue.tasks.empty()) {
+		return false;
+	}
+	task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	return true;
+}
+
+bool ThreadPool::steal(size_t index, Task& task)
+{
+	for (size_t i = 1; i < queues.size(); i++) {
+		Queue& queue = *queues[(index + i) % queues.size()];
+		std::unique_lock<std::mutex> guard(queue.lock, std::try_to_lock);
+		if (!guard || queue.tasks.empty()) {
+			continue;
+		}
+		task = std::move(queue.tasks.front());
+		queue.tasks.pop_front();
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::work(size_t index)
+{
+	currentPool = this;
+	currentIndex = index;
+
+	Task task;
+	for (;;) {
+		if (pop(index, task) || steal(index, task)) {
+			queued.fetch_sub(1);
+			task();
+			task = nullptr;
+			if (pending.fetch_sub(1) == 1) {
+				std::lock_guard<std::mutex> guard(sleepLock);
+				idle.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard(sleepLock);
+		if (stopping) {
+			return;
+		}
+		// try_to_lock steals can miss work, so only sleep when nothing is queued
+		wake.wait(guard, [this] { return stopping || queued.load() != 0; });
+		if (stopping && queued.load() == 0) {
+			return;
+		}
+	}
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace p8080 {
+
+// work stealing pool, every worker has its own deque, takes work from the
+// back of it and steals from the front of the others when it runs dry,
+// so tasks that spawn more tasks mostly stay on the same core
+class ThreadPool {
+public:
+	typedef std::function<void()> Task;
+
+	// 0 means one worker per hardware thread
+	explicit ThreadPool(size_t threads = 0);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// from inside a task this goes on the calling worker's own queue,
+	// from anywhere else the queues take turns
+	void submit(Task task);
+	// blocks until every task, including ones submitted by tasks, is done
+	void wait();
+
+	size_t size() const { return workers.size(); }
+
+private:
+	// one per cache line so workers don't fight over the locks
+	struct alignas(64) Queue {
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	void work(size_t index);
+	bool pop(size_t index, Task& task);
+	bool steal(size_t index, Task& task);
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+
+	// sleeping and waking only happens when queued hits 0, so the locks
+	// below stay out of the way while there's work
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::atomic<size_t> queued{0};
+	std::atomic<size_t> pending{0};
+	std::atomic<size_t> nextQueue{0};
+	bool stopping = false;
+};
+
+}
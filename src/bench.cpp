@@ -0,0 +1,606 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "8080.h"
+#include "Dissasembler.h"
+#include "InvadersMachine.h"
+#include "ThreadPool.h"
+
+// throughput of the cpu core and the disassembler, as JSON so runs from two
+// builds can be diffed or fed to a script that fails on a regression
+//
+// every number is the best of a few repeats, the slowest runs are the ones
+// that got interrupted by something else on the machine
+namespace {
+	using namespace p8080;
+
+	struct Options {
+		uint64_t opcodeInstructions = 2000000;
+		uint64_t mixCycles = 40000000;
+		uint64_t frames = 3000;
+		unsigned repeats = 5;
+	};
+
+	// where the generated code and its data go, away from the RST vectors
+	constexpr uint16_t CODE = 0x1000;
+	constexpr uint16_t DATA = 0x8000;
+	constexpr uint16_t STACK = 0xf000;
+	// copies of the opcode per trip round the loop
+	constexpr unsigned COPIES = 256;
+
+	// setup runs before every repeat and isn't timed
+	double bestOf(unsigned repeats, const std::function<void()>& body,
+		const std::function<void()>& setup = [] {})
+	{
+		double best = 0;
+		for (unsigned i = 0; i < repeats; i++) {
+			setup();
+			auto start = std::chrono::steady_clock::now();
+			body();
+			auto end = std::chrono::steady_clock::now();
+			double seconds = std::chrono::duration<double>(end - start).count();
+			if (i == 0 || seconds < best) {
+				best = seconds;
+			}
+		}
+		return best;
+	}
+
+	class Json {
+	public:
+		explicit Json(std::ostream& out) : out(out) {}
+
+		void open(const char* key, char bracket)
+		{
+			item(key);
+			out << bracket;
+			first = true;
+			depth++;
+		}
+		void close(char bracket)
+		{
+			depth--;
+			out << "\n" << std::string(depth, '\t') << bracket;
+			first = false;
+		}
+		void value(const char* key, double number)
+		{
+			item(key);
+			out << number;
+		}
+		void value(const char* key, uint64_t number)
+		{
+			item(key);
+			out << number;
+		}
+		void value(const char* key, bool flag)
+		{
+			item(key);
+			out << (flag ? "true" : "false");
+		}
+		void value(const char* key, const std::string& text)
+		{
+			item(key);
+			out << '"';
+			for (char c : text) {
+				if (c == '"' || c == '\\') {
+					out << '\\';
+				}
+				out << c;
+			}
+			out << '"';
+		}
+
+	private:
+		void item(const char* key)
+		{
+			if (depth > 0) {
+				out << (first ? "\n" : ",\n") << std::string(depth, '\t');
+			}
+			if (key) {
+				out << '"' << key << "\": ";
+			}
+			first = false;
+		}
+
+		std::ostream& out;
+		unsigned depth = 0;
+		bool first = true;
+	};
+
+	void rates(Json& json, uint64_t instructions, uint64_t cycles, double seconds)
+	{
+		json.value("instructions", instructions);
+		json.value("cycles", cycles);
+		json.value("seconds", seconds);
+		json.value("mips", instructions / seconds / 1e6);
+		json.value("ns_per_instruction", seconds * 1e9 / instructions);
+		json.value("cycles_per_host_second", cycles / seconds);
+	}
+
+	void put16(std::vector<uint8_t>& code, uint16_t value)
+	{
+		code.push_back(static_cast<uint8_t>(value));
+		code.push_back(static_cast<uint8_t>(value >> 8));
+	}
+
+	bool isRst(uint8_t op) { return (op & 0xc7) == 0xc7; }
+	// RET and the conditional ones
+	bool isRet(uint8_t op) { return op == 0xc9 || (op & 0xc7) == 0xc0; }
+	// JMP, CALL and their conditional versions
+	bool isJump(uint8_t op) { return op == 0xc3 || op == 0xcd || (op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4; }
+
+	// COPIES of op in a loop that puts SP back every time round, operands
+	// point at DATA, jumps and calls go to the next copy and RET finds the
+	// next copy on the stack. RST n can't be chained like that, RST n
+	// calls a RET so those two get measured together
+	void loadOpcode(State8080& cpu, uint8_t op)
+	{
+		uint8_t* memory = cpu.memory.data();
+		std::memset(memory, 0, cpu.memory.size());
+		cpu.pc = CODE;
+		cpu.sp = STACK;
+		cpu.r = {};
+		cpu.r.b = cpu.r.d = cpu.r.h = DATA >> 8;
+		cpu.setFlags(0x02);
+
+		std::vector<uint8_t> code;
+		if (op == 0xe9) {
+			// PCHL to itself
+			code.push_back(op);
+			cpu.r.h = CODE >> 8;
+			cpu.r.l = CODE & 0xff;
+		} else {
+			code.push_back(0x31);
+			put16(code, STACK);
+			unsigned length = LENGTH[op];
+			for (unsigned i = 0; i < COPIES; i++) {
+				uint16_t next = static_cast<uint16_t>(CODE + code.size() + length);
+				code.push_back(op);
+				if (length == 2) {
+					code.push_back(0x01);
+				} else if (length == 3) {
+					put16(code, isJump(op) ? next : op == 0x31 ? STACK : DATA);
+				}
+				if (isRet(op)) {
+					memory[STACK + i * 2] = static_cast<uint8_t>(next);
+					memory[STACK + i * 2 + 1] = static_cast<uint8_t>(next >> 8);
+				}
+			}
+			code.push_back(0xc3);
+			put16(code, CODE);
+		}
+		if (isRst(op)) {
+			memory[op & 0x38] = 0xc9;
+		}
+		std::memcpy(memory + CODE, code.data(), code.size());
+	}
+
+	std::string opcodeName(uint8_t op)
+	{
+		std::vector<uint8_t> bytes = {op, 0x00, 0x00};
+		std::string name = dissasemble::dissasemble(bytes, 0).symbol;
+		// operands are made up here anyway
+		name = name.substr(0, name.find_first_of(" $"));
+		if (isRst(op)) {
+			name = "RST " + std::to_string((op >> 3) & 7) + " + RET";
+		}
+		return name;
+	}
+
+	// what the loop from loadOpcode() has to take for that many
+	// instructions going by CYCLES, CALL always being taken. 0 for the
+	// conditional calls and returns since those depend on the flags
+	uint64_t expectedCycles(uint8_t op, uint64_t instructions)
+	{
+		if ((op & 0xc7) == 0xc0 || (op & 0xc7) == 0xc4) {
+			return 0;
+		}
+		unsigned opCycles = CYCLES[op] + (op == 0xcd ? CYCLES_BRANCH_TAKEN : 0);
+		std::vector<unsigned> trip;
+		if (op == 0xe9) {
+			trip.push_back(opCycles);
+		} else {
+			trip.push_back(CYCLES[0x31]);
+			for (unsigned i = 0; i < COPIES; i++) {
+				trip.push_back(opCycles);
+				if (isRst(op)) {
+					trip.push_back(CYCLES[0xc9]);
+				}
+			}
+			trip.push_back(CYCLES[0xc3]);
+		}
+		uint64_t cycles = 0;
+		for (uint64_t i = 0; i < instructions; i++) {
+			cycles += trip[i % trip.size()];
+		}
+		return cycles;
+	}
+
+	// a new cpu for every repeat, loadOpcode() writes memory behind the
+	// bus so a decode cache would still hold the last opcode's code
+	void benchOpcodes(Json& json, const Options& options)
+	{
+		json.open("opcodes", '[');
+		std::unique_ptr<State8080> cpu;
+		for (unsigned op = 0; op < 256; op++) {
+			json.open(nullptr, '{');
+			json.value("opcode", static_cast<uint64_t>(op));
+			json.value("name", opcodeName(static_cast<uint8_t>(op)));
+			if (op == 0x76) {
+				// nothing to time, it just sits there
+				json.value("skipped", std::string("HLT stops the cpu"));
+				json.close('}');
+				continue;
+			}
+			uint64_t executed = 0;
+			uint64_t cycles = 0;
+			double seconds = bestOf(options.repeats, [&] {
+				uint64_t start = cpu->cycles;
+				executed = cpu->run(options.opcodeInstructions);
+				cycles = cpu->cycles - start;
+			}, [&] {
+				cpu.reset(new State8080());
+				loadOpcode(*cpu, static_cast<uint8_t>(op));
+			});
+			// anything else means it timed something other than op
+			uint64_t expected = expectedCycles(static_cast<uint8_t>(op), executed);
+			if (expected != 0 && cycles != expected) {
+				throw std::runtime_error(opcodeName(static_cast<uint8_t>(op)) + " took " + std::to_string(cycles)
+					+ " cycles for " + std::to_string(executed) + " instructions, expected " + std::to_string(expected));
+			}
+			rates(json, executed, cycles, seconds);
+			json.close('}');
+		}
+		json.close(']');
+	}
+
+	struct Mix {
+		const char* name;
+		std::vector<uint8_t> code;
+	};
+
+	// hand assembled, each one loops forever from CODE
+	std::vector<Mix> mixes()
+	{
+		std::vector<Mix> list;
+		list.push_back({"alu", {
+			0x3e, 0x01,       // MVI A, 1
+			0x06, 0x03,       // MVI B, 3
+			0x80,             // ADD B
+			0xc6, 0x05,       // ADI 5
+			0x91,             // SUB C
+			0xa2,             // ANA D
+			0xab,             // XRA E
+			0xb4,             // ORA H
+			0xbd,             // CMP L
+			0x3c,             // INR A
+			0x05,             // DCR B
+			0x07,             // RLC
+			0x1f,             // RAR
+			0x88,             // ADC B
+			0x99,             // SBB C
+			0xfe, 0x07,       // CPI 7
+			0x0c,             // INR C
+			0x15,             // DCR D
+			0x27,             // DAA
+			0x2f,             // CMA
+			0x37,             // STC
+			0x3f,             // CMC
+			0xe6, 0x0f,       // ANI 0F
+			0xf6, 0x10,       // ORI 10
+			0xee, 0x03,       // XRI 3
+			0xce, 0x01,       // ACI 1
+			0xd6, 0x02,       // SUI 2
+			0xde, 0x01,       // SBI 1
+			0x0f,             // RRC
+			0x17,             // RAL
+			0x09,             // DAD B
+			0x13,             // INX D
+			0x2b,             // DCX H
+			0x4f,             // MOV C, A
+			0x50,             // MOV D, B
+			0xc3, 0x00, 0x10, // JMP CODE
+		}});
+		list.push_back({"branch", {
+			0x31, 0x00, 0xf0, // 1000  LXI SP, STACK
+			0x06, 0x10,       // 1003  MVI B, 16
+			0x05,             // 1005  DCR B
+			0xc2, 0x05, 0x10, // 1006  JNZ 1005
+			0xcd, 0x1b, 0x10, // 1009  CALL 101B
+			0xcc, 0x1b, 0x10, // 100C  CZ 101B
+			0xc4, 0x1b, 0x10, // 100F  CNZ 101B
+			0xda, 0x18, 0x10, // 1012  JC 1018
+			0xc3, 0x18, 0x10, // 1015  JMP 1018
+			0xc3, 0x00, 0x10, // 1018  JMP CODE
+			0xaf,             // 101B  XRA A
+			0xc8,             // 101C  RZ
+			0xc9,             // 101D  RET
+		}});
+		list.push_back({"memory", {
+			0x31, 0x00, 0xf0, // LXI SP, STACK
+			0x21, 0x00, 0x80, // LXI H, 8000
+			0x11, 0x00, 0x81, // LXI D, 8100
+			0x01, 0x00, 0x82, // LXI B, 8200
+			0x36, 0x05,       // MVI M, 5
+			0x7e,             // MOV A, M
+			0x12,             // STAX D
+			0x0a,             // LDAX B
+			0x77,             // MOV M, A
+			0x23,             // INX H
+			0x13,             // INX D
+			0x03,             // INX B
+			0x32, 0x00, 0x83, // STA 8300
+			0x3a, 0x01, 0x83, // LDA 8301
+			0x22, 0x02, 0x83, // SHLD 8302
+			0x2a, 0x02, 0x83, // LHLD 8302
+			0xc5,             // PUSH B
+			0xd5,             // PUSH D
+			0xd1,             // POP D
+			0xc1,             // POP B
+			0xe5,             // PUSH H
+			0xe3,             // XTHL
+			0xe1,             // POP H
+			0x34,             // INR M
+			0x35,             // DCR M
+			0x5e,             // MOV E, M
+			0xc3, 0x00, 0x10, // JMP CODE
+		}});
+		return list;
+	}
+
+	// through runCycles(), so the JIT gets its turn when it's built in. it
+	// doesn't count instructions, the count comes from running the same
+	// number of cycles a step at a time first
+	void benchMixes(Json& json, const Options& options)
+	{
+		json.open("mixes", '[');
+		for (const Mix& mix : mixes()) {
+			State8080 cpu;
+			std::memcpy(cpu.memory.data() + CODE, mix.code.data(), mix.code.size());
+			cpu.pc = CODE;
+			uint64_t instructions = 0;
+			while (cpu.cycles < options.mixCycles) {
+				instructions += cpu.run(1);
+			}
+			uint64_t cycles = 0;
+			double seconds = bestOf(options.repeats, [&] {
+				uint64_t start = cpu.cycles;
+				cpu.runCycles(options.mixCycles);
+				cycles = cpu.cycles - start;
+			});
+			json.open(nullptr, '{');
+			json.value("name", std::string(mix.name));
+			// what runCycles() did in the same time, instructions don't
+			// come out exact since it can overshoot by one
+			rates(json, instructions * cycles / options.mixCycles, cycles, seconds);
+			json.close('}');
+		}
+		json.close(']');
+	}
+
+	// the whole game headless with nobody pressing anything, once a frame at
+	// a time on the interpreter to count instructions and then timed the
+	// way the emulator runs it, JIT and idle loop skipping included
+	void benchInvaders(Json& json, const Options& options, const SharedImage& rom)
+	{
+		uint64_t instructions = 0;
+		uint64_t countedCycles = 0;
+		{
+			InvadersMachine machine(rom);
+			while (machine.screen.frames < options.frames && machine.cpu.status != Status::Error) {
+				instructions += machine.cpu.run(1000);
+			}
+			countedCycles = machine.cpu.cycles;
+		}
+
+		uint64_t cycles = 0;
+		uint64_t idle = 0;
+		std::unique_ptr<InvadersMachine> machine;
+		double seconds = bestOf(options.repeats, [&] {
+			machine->runFrames(options.frames);
+			cycles = machine->cpu.cycles;
+			idle = machine->cpu.idleCycles;
+		}, [&] {
+			machine.reset(new InvadersMachine(rom));
+		});
+
+		json.open("invaders", '{');
+		json.value("frames", options.frames);
+		json.value("fps", options.frames / seconds);
+		json.value("speed", cycles / seconds / INVADERS_CLOCK_HZ);
+		json.value("idle_cycles", idle);
+		// the same instructions per cycle as the counting run, skipped idle
+		// loops count as if they ran
+		rates(json, instructions * cycles / countedCycles, cycles, seconds);
+		json.close('}');
+	}
+
+	void benchDisassembler(Json& json, const Options& options, const std::vector<uint8_t>& image)
+	{
+		uint64_t instructions = 0;
+		size_t symbols = 0;
+		double seconds = bestOf(options.repeats, [&] {
+			instructions = 0;
+			for (unsigned pass = 0; pass < 16; pass++) {
+				size_t pc = 0;
+				while (pc < image.size()) {
+					dissasemble::Instruction instruction = dissasemble::decode(image.data(), image.size(), pc);
+					char text[dissasemble::TEXT_SIZE];
+					symbols += dissasemble::format(instruction, text);
+					pc += instruction.size;
+					instructions++;
+				}
+			}
+		});
+		// the same through the string interface, which needs room for the
+		// operands of whatever is at the very end
+		std::vector<uint8_t> code = image;
+		code.resize(code.size() + 2);
+		double stringSeconds = bestOf(options.repeats, [&] {
+			for (unsigned pass = 0; pass < 16; pass++) {
+				size_t pc = 0;
+				while (pc < image.size()) {
+					OpcodeData opcode = dissasemble::dissasemble(code, static_cast<int>(pc));
+					symbols += opcode.symbol.size();
+					pc += opcode.size;
+				}
+			}
+		});
+		json.open("disassembler", '{');
+		json.value("bytes", static_cast<uint64_t>(image.size()) * 16);
+		json.value("instructions", instructions);
+		json.value("seconds", seconds);
+		json.value("mips", instructions / seconds / 1e6);
+		json.value("ns_per_instruction", seconds * 1e9 / instructions);
+		json.value("mb_per_second", image.size() * 16 / seconds / 1e6);
+		json.value("us_per_image", seconds * 1e6 / 16);
+		json.value("string_seconds", stringSeconds);
+		json.value("string_ns_per_instruction", stringSeconds * 1e9 / instructions);
+
+		// whole listings of the image 128 times over, one thread and then
+		// chunked across the pool
+		std::vector<uint8_t> corpus;
+		for (unsigned copy = 0; copy < 128; copy++) {
+			corpus.insert(corpus.end(), image.begin(), image.end());
+		}
+		std::string listing;
+		double listingSeconds = bestOf(options.repeats, [&] {
+			listing.clear();
+			dissasemble::listing(corpus.data(), corpus.size(), listing);
+		});
+		ThreadPool pool;
+		double parallelSeconds = bestOf(options.repeats, [&] {
+			listing.clear();
+			dissasemble::listing(pool, corpus.data(), corpus.size(), listing);
+		});
+		symbols += listing.size();
+		json.value("listing_mb_per_second", corpus.size() / listingSeconds / 1e6);
+		json.value("parallel_threads", static_cast<uint64_t>(pool.size()));
+		json.value("parallel_mb_per_second", corpus.size() / parallelSeconds / 1e6);
+		json.close('}');
+		// keeps the symbols from being optimized away
+		if (symbols == 0) {
+			std::cerr << "no output?" << std::endl;
+		}
+	}
+
+	void build(Json& json)
+	{
+		json.open("build", '{');
+#if defined __clang__
+		json.value("compiler", std::string("clang ") + __clang_version__);
+#elif defined __GNUC__
+		json.value("compiler", std::string("gcc ") + __VERSION__);
+#elif defined _MSC_VER
+		json.value("compiler", "msvc " + std::to_string(_MSC_VER));
+#endif
+		// same default as 8080.cpp
+#if defined P8080_DISPATCH_SWITCH
+		json.value("dispatch", std::string("switch"));
+#elif defined P8080_DISPATCH_TABLE || (!defined P8080_DISPATCH_THREADED && !defined __GNUC__)
+		json.value("dispatch", std::string("table"));
+#else
+		json.value("dispatch", std::string("threaded"));
+#endif
+#ifdef P8080_JIT
+		json.value("jit", true);
+#else
+		json.value("jit", false);
+#endif
+#ifdef P8080_DECODE_CACHE
+		json.value("decode_cache", true);
+#else
+		json.value("decode_cache", false);
+#endif
+#ifdef P8080_LAZY_FLAGS
+		json.value("lazy_flags", true);
+#else
+		json.value("lazy_flags", false);
+#endif
+#ifdef P8080_PROFILE
+		json.value("profile", true);
+#else
+		json.value("profile", false);
+#endif
+		json.close('}');
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	std::string output;
+	std::string rom;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--quick") {
+			options.opcodeInstructions /= 10;
+			options.mixCycles /= 10;
+			options.frames /= 10;
+			options.repeats = 3;
+		} else if (arg == "--frames" && i + 1 < argc) {
+			options.frames = std::strtoull(argv[++i], nullptr, 10);
+		} else if (arg == "--out" && i + 1 < argc) {
+			output = argv[++i];
+		} else if (arg[0] == '-') {
+			std::cout << "Usage: " << argv[0] << " [--quick] [--frames n] [--out file] [rom]" << std::endl;
+			std::cout << "  per opcode, instruction mixes and, given the Invaders ROM, the whole game" << std::endl;
+			std::cout << "  and the disassembler on it. JSON goes to stdout unless --out says otherwise" << std::endl;
+			return 0;
+		} else {
+			rom = arg;
+		}
+	}
+
+	p8080::SharedImage image;
+	if (!rom.empty()) {
+		try {
+			image = p8080::InvadersMachine::readRom(rom);
+		} catch (const std::exception& e) {
+			std::cerr << "ERROR: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	std::ostringstream text;
+	Json json(text);
+	try {
+		json.open(nullptr, '{');
+		build(json);
+		benchOpcodes(json, options);
+		benchMixes(json, options);
+		if (image) {
+			benchInvaders(json, options, image);
+			benchDisassembler(json, options, *image);
+		}
+		json.close('}');
+		text << "\n";
+	} catch (const std::exception& e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	if (output.empty()) {
+		std::cout << text.str();
+	} else {
+		std::ofstream file(output);
+		file << text.str();
+		if (!file) {
+			std::cerr << "ERROR: can't write " << output << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Batch.h"
+#include "FrameCapture.h"
+#include "InvadersMachine.h"
+#include "Profiler.h"
+
+namespace {
+	// -j: the same ROM in a lot of machines at once, one per core by default
+	int runBatch(const p8080::SharedImage& rom, size_t count, uint64_t frames)
+	{
+		p8080::BatchRunner batch(rom, count);
+		p8080::ThreadPool pool;
+
+		auto start = std::chrono::steady_clock::now();
+		batch.run(pool, frames);
+		auto end = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+
+		for (size_t i = 0; i < batch.size(); i++) {
+			if (batch.result(i).status == p8080::Status::Error) {
+				std::cerr << "instance " << i << ": " << batch.result(i).error << std::endl;
+			}
+		}
+		size_t ramPages = 0;
+		for (size_t i = 0; i < batch.size(); i++) {
+			ramPages += batch.machine(i).ramPages();
+		}
+		double emulated = static_cast<double>(batch.totalCycles()) / p8080::INVADERS_CLOCK_HZ;
+		std::cout << "instances: " << batch.size() << " on " << pool.size() << " threads\n";
+		std::cout << "failed:    " << batch.failed() << "\n";
+		std::cout << "frames:    " << batch.totalFrames() << "\n";
+		std::cout << "cycles:    " << batch.totalCycles() << "\n";
+		std::cout << "ram:       " << ramPages * p8080::PAGE_SIZE / batch.size() << " bytes per instance\n";
+		std::cout << "seconds:   " << seconds << "\n";
+		std::cout << "fps:       " << batch.totalFrames() / seconds << "\n";
+		std::cout << "speed:     " << emulated / seconds << "x real time\n";
+		return batch.failed() ? 1 : 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	bool batch = false;
+	size_t instances = 0;
+	std::string captureFormat;
+	std::string capturePath;
+	std::string profilePath;
+	size_t captureBuffers = 16;
+	bool verify = false;
+	while (argc > 2 && argv[1][0] == '-') {
+		std::string flag = argv[1];
+		if (flag == "-j") {
+			batch = true;
+			instances = std::strtoull(argv[2], nullptr, 10);
+			if (instances == 0) {
+				instances = std::max(1u, std::thread::hardware_concurrency());
+			}
+			argc -= 2;
+			argv += 2;
+		} else if (flag == "-c" && argc > 3) {
+			captureFormat = argv[2];
+			capturePath = argv[3];
+			argc -= 3;
+			argv += 3;
+		} else if (flag == "-b") {
+			captureBuffers = std::strtoull(argv[2], nullptr, 10);
+			argc -= 2;
+			argv += 2;
+		} else if (flag == "-p") {
+			profilePath = argv[2];
+			argc -= 2;
+			argv += 2;
+		} else if (flag == "-v") {
+			verify = true;
+			argc--;
+			argv++;
+		} else {
+			break;
+		}
+	}
+	if (argc < 2) {
+		std::cout << "Usage: " << argv[0] << " [-j instances] [-c raw|png|y4m path] [-b buffers] [-p file] [-v] rom [frames] [vram dump]" << std::endl;
+		std::cout << "  rom is either a directory with invaders.h/g/f/e or a single 8K image" << std::endl;
+		std::cout << "  -j runs that many machines across every core, -j 0 is one per core" << std::endl;
+		std::cout << "  -c writes every frame to path, for png a name like shots/####.png" << std::endl;
+		std::cout << "     where the # become the frame number, every frame gets written and the" << std::endl;
+		std::cout << "     emulation waits when the disk falls behind" << std::endl;
+		std::cout << "  -b frames -c can have queued for the disk, 16 unless it says otherwise" << std::endl;
+		std::cout << "  -p writes a profile of the ROM to file, needs a build with P8080_PROFILE" << std::endl;
+		std::cout << "  -v checks the ROM against the CRCs of the Midway set" << std::endl;
+		return 0;
+	}
+	std::string rom = argv[1];
+	uint64_t frames = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 60;
+
+	p8080::SharedImage image;
+	try {
+		image = p8080::InvadersMachine::readRom(rom, verify);
+	} catch (const std::exception& e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+#ifndef P8080_PROFILE
+	if (!profilePath.empty()) {
+		std::cerr << "ERROR: -p needs a build with P8080_PROFILE" << std::endl;
+		return 1;
+	}
+#endif
+	if (batch) {
+		if (!capturePath.empty() || !profilePath.empty()) {
+			std::cerr << "ERROR: -c and -p only work on a single machine" << std::endl;
+			return 1;
+		}
+		return runBatch(image, instances, frames);
+	}
+
+	p8080::InvadersMachine machine(image);
+	std::unique_ptr<p8080::FrameCapture> capture;
+	if (!capturePath.empty()) {
+		p8080::CaptureFormat format;
+		if (captureFormat == "raw") {
+			format = p8080::CaptureFormat::Raw;
+		} else if (captureFormat == "png") {
+			format = p8080::CaptureFormat::Png;
+		} else if (captureFormat == "y4m") {
+			format = p8080::CaptureFormat::Y4m;
+		} else {
+			std::cerr << "ERROR: capture format has to be raw, png or y4m" << std::endl;
+			return 1;
+		}
+		try {
+			capture.reset(new p8080::FrameCapture(capturePath, format, captureBuffers, true));
+		} catch (const std::exception& e) {
+			std::cerr << "ERROR: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	if (capture) {
+		for (uint64_t i = 0; i < frames && machine.cpu.status != p8080::Status::Error; i++) {
+			machine.runFrames(1);
+			capture->submit(machine);
+		}
+	} else {
+		machine.runFrames(frames);
+	}
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	double emulated = static_cast<double>(machine.cpu.cycles) / p8080::INVADERS_CLOCK_HZ;
+	std::cout << "frames:  " << machine.screen.frames << "\n";
+	std::cout << "cycles:  " << machine.cpu.cycles << "\n";
+	std::cout << "seconds: " << seconds << "\n";
+	std::cout << "fps:     " << machine.screen.frames / seconds << "\n";
+	std::cout << "speed:   " << emulated / seconds << "x real time\n";
+	if (capture) {
+		try {
+			capture->finish();
+		} catch (const std::exception& e) {
+			std::cerr << "ERROR: " << e.what() << std::endl;
+			return 1;
+		}
+		std::cout << "written: " << capture->written() << " frames\n";
+		std::cout << "dropped: " << capture->dropped() << " frames\n";
+	}
+
+#ifdef P8080_PROFILE
+	if (!profilePath.empty()) {
+		std::ofstream report(profilePath);
+		machine.cpu.profiler->report(report, machine.cpu.bus, machine.cpu.cycles);
+		if (!report) {
+			std::cerr << "ERROR: can't write " << profilePath << std::endl;
+			return 1;
+		}
+	}
+#endif
+
+	if (argc > 3) {
+		std::vector<uint8_t> vram(p8080::INVADERS_VRAM_SIZE);
+		machine.readVideoRam(vram.data());
+		std::ofstream dump(argv[3], std::ios::binary | std::ios::out);
+		dump.write(reinterpret_cast<const char*>(vram.data()), vram.size());
+	}
+	return 0;
+}
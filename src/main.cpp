@@ -1,9 +1,20 @@
-#include <fstream>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <string>
 #include <vector>
 #include <iomanip>
+#include <sstream>
 
+#ifdef _WIN32
+	#include <fcntl.h>
+	#include <io.h>
+#endif
+
+#include "ControlFlow.h"
 #include "Dissasembler.h"
+#include "RomSet.h"
+#include "ThreadPool.h"
 
 
 // literally a hexdump lol
@@ -24,20 +35,99 @@ std::ostream& operator<<(std::ostream& stream, const std::vector<T>& vec)
 
 int main(int argc, char** argv)
 {
-	if (argc < 2) {
-		std::cout << "Usage: " << argv[0] << " filename" << std::endl;
+	std::string outPath = "-";
+	bool parallel = false;
+	size_t threads = 0;
+	std::string analysis;
+	std::vector<uint16_t> entries;
+	while (argc > 3 && argv[1][0] == '-' && argv[1][1]) {
+		std::string flag = argv[1];
+		if (flag == "-o") {
+			outPath = argv[2];
+		} else if (flag == "-j") {
+			parallel = true;
+			threads = std::strtoull(argv[2], nullptr, 10);
+		} else if (flag == "-a") {
+			analysis = argv[2];
+		} else if (flag == "-e") {
+			entries.push_back(static_cast<uint16_t>(std::strtoul(argv[2], nullptr, 0)));
+		} else {
+			break;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2 || (!analysis.empty() && analysis != "listing" && analysis != "dot" && analysis != "json")) {
+		std::cout << "Usage: " << argv[0] << " [-o listing] [-j threads] [-a listing|dot|json] [-e entry]... filename" << std::endl;
+		std::cout << "  - reads the image from stdin, the listing goes to stdout unless -o says otherwise" << std::endl;
+		std::cout << "  -j splits big images in chunks across that many threads, -j 0 is one per core" << std::endl;
+		std::cout << "  -a follows the code from reset and the RST vectors, listing puts the data" << std::endl;
+		std::cout << "     in DB lines, dot and json write the control flow graph" << std::endl;
+		std::cout << "  -e adds an entry point for -a, like 0x1000, for code only reached through PCHL" << std::endl;
 		return 0;
 	}
-	std::ifstream file(argv[1], std::ios::binary | std::ios::in);
-	std::vector<uint8_t> codeBuffer(
-		(std::istreambuf_iterator<char>(file)), 
-		std::istreambuf_iterator<char>()
-	);
-	file.close();
-	
-	size_t pc = 0;
-	while(pc < codeBuffer.size()) {
-		pc += dissasemble::dissasemble(codeBuffer, pc).size;
+	std::string inPath = argv[1];
+
+#ifdef _WIN32
+	// no newline translation on the way in or out
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	// the whole image in memory, then the whole listing, then one write
+	std::vector<uint8_t> codeBuffer;
+	if (inPath == "-") {
+		uint8_t chunk[1 << 16];
+		size_t read;
+		while ((read = std::fread(chunk, 1, sizeof(chunk), stdin)) > 0) {
+			codeBuffer.insert(codeBuffer.end(), chunk, chunk + read);
+		}
+		if (std::ferror(stdin)) {
+			std::cerr << "ERROR: can't read " << inPath << std::endl;
+			return 1;
+		}
+	} else {
+		try {
+			codeBuffer = p8080::readFile(inPath);
+		} catch (const std::exception& e) {
+			std::cerr << "ERROR: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	std::string listing;
+	if (!analysis.empty()) {
+		std::vector<uint16_t> from = p8080::ControlFlow::defaultEntries(0, codeBuffer.size());
+		from.insert(from.end(), entries.begin(), entries.end());
+		p8080::ControlFlow flow(codeBuffer.data(), codeBuffer.size(), 0, from);
+		if (analysis == "listing") {
+			flow.listing(listing);
+		} else {
+			std::ostringstream text;
+			if (analysis == "dot") {
+				flow.writeDot(text);
+			} else {
+				flow.writeJson(text);
+			}
+			listing = text.str();
+		}
+	} else if (parallel) {
+		p8080::ThreadPool pool(threads);
+		dissasemble::listing(pool, codeBuffer.data(), codeBuffer.size(), listing);
+	} else {
+		dissasemble::listing(codeBuffer.data(), codeBuffer.size(), listing);
+	}
+
+	FILE* out = outPath == "-" ? stdout : std::fopen(outPath.c_str(), "wb");
+	if (!out) {
+		std::cerr << "ERROR: can't open " << outPath << std::endl;
+		return 1;
+	}
+	bool failed = std::fwrite(listing.data(), 1, listing.size(), out) != listing.size();
+	failed = (out == stdout ? std::fflush(out) : std::fclose(out)) != 0 || failed;
+	if (failed) {
+		std::cerr << "ERROR: can't write " << outPath << std::endl;
+		return 1;
 	}
 	return 0;
-}
\ No newline at end of file
+}
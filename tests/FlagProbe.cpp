@@ -0,0 +1,59 @@
+#include "FlagProbe.h"
+
+#include "8080.h"
+
+namespace p8080 {
+
+FlagProbe::FlagProbe()
+	: cpu(new State8080())
+{
+}
+
+FlagProbe::~FlagProbe() = default;
+
+void FlagProbe::load(uint16_t address, const uint8_t* code, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		cpu->memory[static_cast<uint16_t>(address + i)] = code[i];
+	}
+}
+
+void FlagProbe::start(const uint8_t regs[7], uint16_t sp, uint8_t psw)
+{
+	cpu->r = {regs[0], regs[1], regs[2], regs[3], regs[4], regs[5], regs[6]};
+	cpu->sp = sp;
+	cpu->pc = 0;
+	cpu->setFlags(psw);
+}
+
+void FlagProbe::run(uint64_t steps, uint32_t until, std::vector<uint8_t>& seen)
+{
+	for (uint64_t i = 0; i < steps && cpu->pc != until; i++) {
+		uint8_t op = cpu->memory[cpu->pc];
+		if (op == 0x76) {
+			return;
+		}
+		cpu->Emulate8080p();
+		seen.push_back(op);
+		if ((op & 0xC7) == 0xC2 || (op & 0xC7) == 0xC4 || (op & 0xC7) == 0xC0) {
+			seen.push_back(static_cast<uint8_t>(cpu->pc));
+			seen.push_back(static_cast<uint8_t>(cpu->pc >> 8));
+		} else if (op == 0xF5) {
+			seen.push_back(cpu->memory[cpu->sp]);
+		} else if (op == 0x27) {
+			seen.push_back(cpu->r.a);
+		}
+	}
+}
+
+uint8_t FlagProbe::flags()
+{
+	return cpu->flags();
+}
+
+uint8_t FlagProbe::a() const
+{
+	return cpu->r.a;
+}
+
+}
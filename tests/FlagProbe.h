@@ -0,0 +1,42 @@
+// no include guard on purpose, lazyflags.cpp includes this once for the
+// eager core in p8080 and once more with p8080 defined to p8080_lazy
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace p8080 {
+
+class State8080;
+
+// one cpu, eager or lazy depending on how FlagProbe.cpp was built, that
+// runs code and writes down what every instruction reading the flags saw.
+// the flags themselves are only asked for at the end, so lazy flags stay
+// pending as long as they would in a real run
+class FlagProbe {
+public:
+	// until for a run that shouldn't stop anywhere
+	static constexpr uint32_t NOWHERE = 0x10000;
+
+	FlagProbe();
+	~FlagProbe();
+
+	// size bytes of code at address, the rest of memory stays as it is
+	void load(uint16_t address, const uint8_t* code, size_t size);
+	// a, b, c, d, e, h, l in regs, pc at 0, and flags set through setFlags()
+	void start(const uint8_t regs[7], uint16_t sp, uint8_t psw);
+	// up to steps instructions, until pc gets to until or up to a HLT,
+	// which is left alone. seen gets the opcode of every instruction and
+	// after it, for conditional jumps, calls and returns the pc, for PUSH
+	// PSW the byte pushed and for DAA A
+	void run(uint64_t steps, uint32_t until, std::vector<uint8_t>& seen);
+
+	// flags(), the one consumer that comes from outside
+	uint8_t flags();
+	uint8_t a() const;
+
+private:
+	std::unique_ptr<State8080> cpu;
+};
+
+}
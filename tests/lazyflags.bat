@@ -0,0 +1,13 @@
+@REM lazy flags against eager flags, run from the repo root. the core gets
+@REM built twice, the lazy copy with its namespace renamed so both fit in
+@REM one binary
+set FLAGS=-std=c++17 -O2 -Wall -Wextra -Werror -I.\src -I.\tests
+for %%f in (.\src\8080.cpp .\src\Bus.cpp .\src\Ports.cpp .\src\Scheduler.cpp .\tests\FlagProbe.cpp) do (
+g++ -c %%f %FLAGS% -o %%~nf.eager.o
+g++ -c %%f %FLAGS% -DP8080_LAZY_FLAGS -Dp8080=p8080_lazy -o %%~nf.lazy.o
+)
+g++ .\tests\lazyflags.cpp ^
+8080.eager.o Bus.eager.o Ports.eager.o Scheduler.eager.o FlagProbe.eager.o ^
+8080.lazy.o Bus.lazy.o Ports.lazy.o Scheduler.lazy.o FlagProbe.lazy.o ^
+%FLAGS% -o lazyflags.exe
+lazyflags.exe
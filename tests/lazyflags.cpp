@@ -0,0 +1,179 @@
+// lazy flags against eager flags, two copies of the core in one binary and
+// the same code run on both. first every flag setting op over every A,
+// operand, CY and AC, then seeded random programs, and everything that
+// reads the flags has to see the same thing on both
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FlagProbe.h"
+#define p8080 p8080_lazy
+#include "FlagProbe.h"
+#undef p8080
+
+namespace {
+	constexpr uint8_t CY = 0x01;
+	constexpr uint8_t AC = 0x10;
+	constexpr uint8_t SZP = 0xC4;
+
+	// ADD ADC SUB SBB ANA XRA ORA CMP with B, then the immediate ones
+	constexpr uint8_t TWO_OPERANDS[] = {
+		0x80, 0x88, 0x90, 0x98, 0xA0, 0xA8, 0xB0, 0xB8,
+		0xC6, 0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE,
+	};
+	// INR A, DCR A, INR B, DCR B, ADD A, ADC A, SUB A, SBB A, ANA A, XRA A,
+	// ORA A, CMP A, DAA, the rotates, STC and CMC
+	constexpr uint8_t ONE_OPERAND[] = {
+		0x3C, 0x3D, 0x04, 0x05, 0x87, 0x8F, 0x97, 0x9F, 0xA7, 0xAF, 0xB7, 0xBF,
+		0x27, 0x07, 0x0F, 0x17, 0x1F, 0x37, 0x3F,
+	};
+
+	struct Pair {
+		p8080::FlagProbe eager;
+		p8080_lazy::FlagProbe lazy;
+		std::vector<uint8_t> eagerSeen;
+		std::vector<uint8_t> lazySeen;
+
+		void load(uint16_t address, const uint8_t* code, size_t size)
+		{
+			eager.load(address, code, size);
+			lazy.load(address, code, size);
+		}
+
+		// empty if both agree, what differs otherwise
+		std::string run(const uint8_t regs[7], uint16_t sp, uint8_t psw, uint64_t steps, uint32_t until)
+		{
+			eagerSeen.clear();
+			lazySeen.clear();
+			eager.start(regs, sp, psw);
+			lazy.start(regs, sp, psw);
+			eager.run(steps, until, eagerSeen);
+			lazy.run(steps, until, lazySeen);
+			for (size_t i = 0; i < eagerSeen.size() && i < lazySeen.size(); i++) {
+				if (eagerSeen[i] != lazySeen[i]) {
+					return "byte " + std::to_string(i) + " of what was seen, eager " + std::to_string(eagerSeen[i])
+						+ ", lazy " + std::to_string(lazySeen[i]);
+				}
+			}
+			if (eagerSeen.size() != lazySeen.size()) {
+				return "eager ran " + std::to_string(eagerSeen.size()) + " bytes worth, lazy " + std::to_string(lazySeen.size());
+			}
+			uint8_t eagerFlags = eager.flags();
+			uint8_t lazyFlags = lazy.flags();
+			if (eagerFlags != lazyFlags) {
+				return "flags() eager " + std::to_string(eagerFlags) + ", lazy " + std::to_string(lazyFlags);
+			}
+			if (eager.a() != lazy.a()) {
+				return "A eager " + std::to_string(eager.a()) + ", lazy " + std::to_string(lazy.a());
+			}
+			return std::string();
+		}
+	};
+
+	// op, then every conditional jump and call with the target one past
+	// the NOP after it, then PUSH PSW and DAA. returns where it ends
+	uint16_t sweepProgram(Pair& pair, uint8_t op, uint8_t operand)
+	{
+		std::vector<uint8_t> code = {op};
+		if (op >= 0xC0) {
+			code.push_back(operand);
+		}
+		for (uint8_t kind : {0xC2, 0xC4}) {
+			for (uint8_t condition = 0; condition < 8; condition++) {
+				uint16_t target = static_cast<uint16_t>(code.size() + 4);
+				code.push_back(static_cast<uint8_t>(kind | condition << 3));
+				code.push_back(static_cast<uint8_t>(target));
+				code.push_back(static_cast<uint8_t>(target >> 8));
+				code.push_back(0x00);
+			}
+		}
+		code.push_back(0xF5);
+		code.push_back(0x27);
+		pair.load(0, code.data(), code.size());
+		return static_cast<uint16_t>(code.size());
+	}
+
+	bool sweep(Pair& pair, uint8_t op, bool twoOperands, uint64_t& cases)
+	{
+		for (unsigned operand = 0; operand < (twoOperands ? 256u : 1u); operand++) {
+			uint16_t end = sweepProgram(pair, op, static_cast<uint8_t>(operand));
+			for (unsigned a = 0; a < 256; a++) {
+				for (unsigned in = 0; in < 4; in++) {
+					// INR B and DCR B go over B along with A
+					uint8_t b = static_cast<uint8_t>(twoOperands ? operand : a);
+					uint8_t regs[7] = {static_cast<uint8_t>(a), b, 0, 0, 0, 0, 0};
+					// S, Z and P that most ops overwrite, and the rotates keep
+					uint8_t psw = static_cast<uint8_t>((in & 1 ? CY : 0) | (in & 2 ? AC : 0) | ((a * 7 + operand) & SZP));
+					std::string differs = pair.run(regs, 0xF000, psw, 64, end);
+					cases++;
+					if (!differs.empty()) {
+						std::cerr << "FAIL: opcode " << static_cast<int>(op) << " A " << a << " operand " << operand
+							<< " psw " << static_cast<int>(psw) << ": " << differs << std::endl;
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	// all of memory random, which is mostly ALU ops and branches anyway,
+	// HLT left out so it doesn't stop after a couple hundred instructions,
+	// one that gets stored later still ends the run
+	bool program(Pair& pair, uint32_t seed, uint64_t steps)
+	{
+		std::mt19937 random(seed);
+		std::vector<uint8_t> memory(0x10000);
+		for (uint8_t& byte : memory) {
+			byte = static_cast<uint8_t>(random());
+			if (byte == 0x76) {
+				byte = 0x00;
+			}
+		}
+		pair.load(0, memory.data(), memory.size());
+		uint8_t regs[7];
+		for (uint8_t& reg : regs) {
+			reg = static_cast<uint8_t>(random());
+		}
+		uint16_t sp = static_cast<uint16_t>(random());
+		uint8_t psw = static_cast<uint8_t>(random());
+		std::string differs = pair.run(regs, sp, psw, steps, p8080::FlagProbe::NOWHERE);
+		if (!differs.empty()) {
+			std::cerr << "FAIL: program " << seed << ": " << differs << std::endl;
+			return false;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t programs = argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 500;
+	uint32_t seed = argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 8080;
+	uint64_t steps = 20000;
+
+	Pair pair;
+	uint64_t cases = 0;
+	for (uint8_t op : TWO_OPERANDS) {
+		if (!sweep(pair, op, true, cases)) {
+			return 1;
+		}
+	}
+	for (uint8_t op : ONE_OPERAND) {
+		if (!sweep(pair, op, false, cases)) {
+			return 1;
+		}
+	}
+	std::cout << "sweep:    " << cases << " cases\n";
+
+	for (uint32_t i = 0; i < programs; i++) {
+		if (!program(pair, seed + i, steps)) {
+			return 1;
+		}
+	}
+	std::cout << "programs: " << programs << " of " << steps << " instructions from seed " << seed << "\n";
+	return 0;
+}